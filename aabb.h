@@ -8,26 +8,28 @@
 #include <cmath>     // for math functions
 
 // AXIS-ALIGNED BOUNDING BOX - THIS IS NECESSARY!! for BVH acceleration
-class aabb
+template <typename T>
+class aabb_t
 {
 public:
-    interval x, y, z; // intervals for each axis
+    using interval_type = interval_t<T>;
+    interval_type x, y, z; // intervals for each axis
 
-    aabb() = default; // defaults to empty box
+    aabb_t() = default; // defaults to empty box
 
-    aabb(const interval &x, const interval &y, const interval &z)
+    aabb_t(const interval_type &x, const interval_type &y, const interval_type &z)
         : x(x), y(y), z(z) {}
 
-    aabb(const point3 &a, const point3 &b)
+    aabb_t(const vec3_t<T> &a, const vec3_t<T> &b)
     {
         // Construct AABB from two corner points
-        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
-        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
-        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        x = (a[0] <= b[0]) ? interval_type(a[0], b[0]) : interval_type(b[0], a[0]);
+        y = (a[1] <= b[1]) ? interval_type(a[1], b[1]) : interval_type(b[1], a[1]);
+        z = (a[2] <= b[2]) ? interval_type(a[2], b[2]) : interval_type(b[2], a[2]);
     }
 
     // get the interval for a specific axis, where 0=x, 1=y, 2=z
-    const interval &axis_interval(int n) const
+    const interval_type &axis_interval(int n) const
     {
         if (n == 1)
             return y;
@@ -37,13 +39,13 @@ public:
     }
 
     // fast ray-box intersection test, this is the heart of BVH efficiency!
-    bool hit(const ray &r, interval ray_t) const
+    bool hit(const ray_t<T> &r, interval_type ray_t) const
     {
-        auto invD = 1.0 / r.direction().x();
+        T invD = T(1) / r.direction().x();
         auto t0 = (x.min - r.origin().x()) * invD;
         auto t1 = (x.max - r.origin().x()) * invD;
 
-        if (invD < 0.0)
+        if (invD < 0)
             std::swap(t0, t1);
 
         auto tmin = std::max(t0, ray_t.min);
@@ -53,11 +55,11 @@ public:
             return false;
 
         // Y axis
-        invD = 1.0 / r.direction().y();
+        invD = T(1) / r.direction().y();
         t0 = (y.min - r.origin().y()) * invD;
         t1 = (y.max - r.origin().y()) * invD;
 
-        if (invD < 0.0)
+        if (invD < 0)
             std::swap(t0, t1);
 
         tmin = std::max(t0, tmin);
@@ -67,11 +69,11 @@ public:
             return false;
 
         // Z axis
-        invD = 1.0 / r.direction().z();
+        invD = T(1) / r.direction().z();
         t0 = (z.min - r.origin().z()) * invD;
         t1 = (z.max - r.origin().z()) * invD;
 
-        if (invD < 0.0)
+        if (invD < 0)
             std::swap(t0, t1);
 
         tmin = std::max(t0, tmin);
@@ -91,22 +93,24 @@ public:
     }
 
     // combine two bounding boxes
-    static aabb surrounding_box(const aabb &box0, const aabb &box1)
+    static aabb_t surrounding_box(const aabb_t &box0, const aabb_t &box1)
     {
-        return aabb(
-            interval(std::min(box0.x.min, box1.x.min), std::max(box0.x.max, box1.x.max)),
-            interval(std::min(box0.y.min, box1.y.min), std::max(box0.y.max, box1.y.max)),
-            interval(std::min(box0.z.min, box1.z.min), std::max(box0.z.max, box1.z.max)));
+        return aabb_t(
+            interval_type(std::min(box0.x.min, box1.x.min), std::max(box0.x.max, box1.x.max)),
+            interval_type(std::min(box0.y.min, box1.y.min), std::max(box0.y.max, box1.y.max)),
+            interval_type(std::min(box0.z.min, box1.z.min), std::max(box0.z.max, box1.z.max)));
     }
 
     // get the center point of the bounding box
-    point3 center() const
+    vec3_t<T> center() const
     {
-        return point3(
-            (x.min + x.max) * 0.5,
-            (y.min + y.max) * 0.5,
-            (z.min + z.max) * 0.5);
+        return vec3_t<T>(
+            (x.min + x.max) * T(0.5),
+            (y.min + y.max) * T(0.5),
+            (z.min + z.max) * T(0.5));
     }
 };
 
+using aabb = aabb_t<real>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,248 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+// animated sequences. an animated_scene holds still objects and moving ones, every moving object an
+// instance placed by a transform_track (keyframes, or any function of time). set_time moves them and
+// refits the BVH over all of them bottom up (bvh_tree::refit) instead of building it again. a refit
+// keeps the tree's topology, so once objects have wandered away from where the build grouped them,
+// sibling boxes grow and overlap and rays visit more nodes. every refit therefore compares the tree's
+// SAH cost with the one the last build left, and rebuilds once it has got worse by more than
+// rebuild_threshold.
+
+#include "hittable.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// one pose of a moving object: scaled, then turned about 'axis' (through the origin), then moved by
+// 'position'
+struct keyframe
+{
+    double time = 0;
+    vec3 position = vec3(0, 0, 0);
+    vec3 axis = vec3(0, 1, 0);
+    double degrees = 0;
+    double scale = 1;
+
+    affine_transform transform() const
+    {
+        return affine_transform::translate(position) * affine_transform::rotate(axis, degrees) *
+               affine_transform::scale(scale);
+    }
+};
+
+// where a moving object is at any time
+class transform_track
+{
+public:
+    transform_track() = default; // the identity, always
+
+    // keyframes in any order. between two of them position, angle and scale are interpolated linearly
+    // (so 0 to 360 degrees is one full turn) about the earlier one's axis; before the first and after
+    // the last the object holds still.
+    transform_track(std::vector<keyframe> keys) : keys(std::move(keys))
+    {
+        std::stable_sort(this->keys.begin(), this->keys.end(), [](const keyframe &a, const keyframe &b)
+                         { return a.time < b.time; });
+    }
+
+    // a transform computed for every frame
+    transform_track(std::function<affine_transform(double)> fn) : function(std::move(fn)) {}
+
+    affine_transform at(double time) const
+    {
+        if (function)
+            return function(time);
+        if (keys.empty())
+            return affine_transform();
+        if (time <= keys.front().time)
+            return keys.front().transform();
+        if (time >= keys.back().time)
+            return keys.back().transform();
+
+        auto next = std::upper_bound(keys.begin(), keys.end(), time, [](double t, const keyframe &k)
+                                     { return t < k.time; });
+        const keyframe &a = next[-1], &b = *next;
+        double s = (time - a.time) / (b.time - a.time);
+        keyframe k = a;
+        k.position = a.position + real(s) * (b.position - a.position);
+        k.degrees = a.degrees + s * (b.degrees - a.degrees);
+        k.scale = a.scale + s * (b.scale - a.scale);
+        return k.transform();
+    }
+
+private:
+    std::vector<keyframe> keys;
+    std::function<affine_transform(double)> function;
+};
+
+struct animation_options
+{
+    bvh_build_options build;        // for the first build and every rebuild (its pool also moves objects)
+    double rebuild_threshold = 1.3; // rebuild when a refit leaves the SAH cost above this times the last build's
+    bool compare_rebuild = false;   // also time a full build on frames that only refit, for frame_update
+};
+
+// what set_time did
+struct frame_update
+{
+    double time = 0;
+    double move_ms = 0;      // new transforms and bounds of the moving objects
+    double refit_ms = 0;     // refit and its SAH cost, 0 on the first frame
+    double refit_sah = 0;    // SAH cost after the refit
+    bool rebuilt = false;    // the tree was built from scratch (first frame, or the refit was too poor)
+    double rebuild_ms = 0;   // the build, when there was one or compare_rebuild timed one
+    double rebuild_sah = 0;  // SAH cost of that build
+};
+
+class animated_scene : public hittable
+{
+public:
+    animation_options options;
+
+    // an object that never moves
+    void add(shared_ptr<hittable> object)
+    {
+        objects.push_back(std::move(object));
+        built = false;
+    }
+
+    // an object placed by 'track' (its transform applies to the object where it is)
+    void add(shared_ptr<const hittable> object, transform_track track)
+    {
+        movers.push_back({make_shared<instance>(std::move(object), affine_transform()), std::move(track), objects.size()});
+        objects.push_back(movers.back().placed);
+        built = false;
+    }
+
+    // move everything to where it is at 'time' and bring the BVH up to date: built on the first call
+    // (and after add), refitted or rebuilt after that. not while rays are being traced.
+    frame_update set_time(double time)
+    {
+        using clock = std::chrono::steady_clock;
+        auto ms_since = [](clock::time_point start)
+        { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+        frame_update update;
+        update.time = time;
+
+        auto start = clock::now();
+        bounds.resize(objects.size());
+        if (!built)
+            for (size_t i = 0; i < objects.size(); i++)
+                bounds[i] = objects[i]->bounding_box();
+        move_range(time, options.build.pool);
+        update.move_ms = ms_since(start);
+
+        if (built)
+        {
+            start = clock::now();
+            tree.refit(bounds);
+            update.refit_sah = tree.sah_cost(options.build);
+            update.refit_ms = ms_since(start);
+        }
+
+        if (!built || update.refit_sah > options.rebuild_threshold * built_sah)
+        {
+            rebuild();
+            update.rebuilt = true;
+            update.rebuild_ms = tree.stats().build_ms;
+            update.rebuild_sah = built_sah;
+            rebuilds++;
+        }
+        else if (options.compare_rebuild)
+        {
+            bvh_tree fresh;
+            fresh.build(bounds, options.build);
+            update.rebuild_ms = fresh.stats().build_ms;
+            update.rebuild_sah = fresh.stats().sah_cost;
+        }
+        return update;
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval &t)
+                             {
+            if (!slots[slot]->hit(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true; });
+    }
+
+    aabb bounding_box() const override { return tree.bounds(); }
+
+    const bvh_tree &acceleration() const { return tree; }
+    size_t object_count() const { return objects.size(); }
+    size_t moving_count() const { return movers.size(); }
+    size_t rebuild_count() const { return rebuilds; } // first build included
+
+private:
+    struct mover
+    {
+        shared_ptr<instance> placed;
+        transform_track track;
+        size_t index; // in objects
+    };
+
+    std::vector<shared_ptr<hittable>> objects; // in the order they were added
+    std::vector<mover> movers;
+    std::vector<aabb> bounds;          // of objects, what the tree is built or refitted over
+    std::vector<const hittable *> slots; // objects in leaf slot order
+    bvh_tree tree;
+    double built_sah = 0;
+    bool built = false;
+    size_t rebuilds = 0;
+
+    void move_range(double time, thread_pool *pool)
+    {
+        auto move = [&](size_t begin, size_t end)
+        {
+            for (size_t m = begin; m < end; m++)
+            {
+                movers[m].placed->set_transform(movers[m].track.at(time));
+                bounds[movers[m].index] = movers[m].placed->bounding_box();
+            }
+        };
+
+        size_t n = movers.size();
+        if (!pool || n < 8192)
+        {
+            move(0, n);
+            return;
+        }
+        size_t chunks = size_t(pool->size()) * 4;
+        pool->parallel_for(chunks, [&](size_t c, unsigned int)
+                           { move(n * c / chunks, n * (c + 1) / chunks); });
+    }
+
+    void rebuild()
+    {
+        tree.build(bounds, options.build);
+        built_sah = tree.stats().sah_cost;
+        built = true;
+        slots.resize(objects.size());
+        for (size_t s = 0; s < slots.size(); s++)
+            slots[s] = objects[tree.prim_indices[s]].get();
+    }
+};
+
+// "image.png" -> "image_0007.png": where frame 7 of a sequence goes
+inline std::string frame_output_path(const std::string &path, int frame)
+{
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + number;
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+#endif
@@ -0,0 +1,2037 @@
+// performance benchmarks, these want an optimised build:
+//   g++ -O2 -pthread -o benchmark benchmark.cpp
+//   ./benchmark [section]
+// with no section every benchmark runs.
+//   ./benchmark suite [max primitives] [file.json]
+// runs the regression suite alone and writes its numbers as JSON (benchmark.json by default), so runs
+// of different versions can be compared by a script.
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "triangle_mesh.h"
+#include "obj_loader.h"
+#include "scene_snapshot.h"
+#include "scenes.h"
+#include "ray_packet.h"
+#include "simd_leaf.h"
+#include "image_writer.h"
+#include "denoiser.h"
+#include "instance.h"
+#include "distributed.h"
+#include "animation.h"
+#include "scene_loader.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// thread counts to sweep: 1, 2, 4, ... up to the hardware concurrency (always included)
+static std::vector<unsigned int> thread_counts()
+{
+    unsigned int hw = std::thread::hardware_concurrency();
+    if (hw == 0)
+        hw = 4;
+
+    std::vector<unsigned int> counts;
+    for (unsigned int n = 1; n < hw; n *= 2)
+        counts.push_back(n);
+    counts.push_back(hw);
+    return counts;
+}
+
+// trace random diffuse/metal/glass paths from the main.cpp viewpoint, returns the number of rays cast
+static uint64_t trace_paths(const hittable &world, int paths, int max_depth)
+{
+    const point3 eye(13, 2, 3);
+    uint64_t rays = 0;
+
+    for (int i = 0; i < paths; i++)
+    {
+        point3 target(random_double(-3, 3), random_double(-0.5, 1.5), random_double(-3, 3));
+        ray r(eye, target - eye);
+
+        for (int depth = 0; depth < max_depth; depth++)
+        {
+            rays++;
+            hit_record rec;
+            if (!world.hit(r, interval(ray_t_min, infinity), rec))
+                break;
+
+            ray scattered;
+            color attenuation;
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+                break;
+            r = scattered;
+        }
+    }
+
+    return rays;
+}
+
+// random_double() and path tracing throughput as the thread count grows. with the old std::rand()
+// every thread serialised on the shared generator state; now each one should scale on its own.
+static void bench_rng()
+{
+    std::clog << "== rng: per-thread generator scaling ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh_world = make_shared<bvh_node>(world);
+
+    const uint64_t numbers_total = 200000000;
+    const int paths_total = 400000;
+    const int max_depth = 16;
+
+    double base_numbers = 0, base_rays = 0;
+    for (unsigned int n : thread_counts())
+    {
+        std::vector<std::thread> threads;
+        std::vector<double> sinks(n);
+
+        auto start = bench_clock::now();
+        for (unsigned int t = 0; t < n; t++)
+        {
+            threads.emplace_back([&, t]()
+                                 {
+                seed_random(mix_seed(1, t));
+                double sum = 0;
+                for (uint64_t i = 0; i < numbers_total / n; i++)
+                    sum += random_double();
+                sinks[t] = sum; });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        double numbers_per_sec = numbers_total / seconds_since(start);
+
+        std::vector<uint64_t> rays(n);
+        threads.clear();
+        start = bench_clock::now();
+        for (unsigned int t = 0; t < n; t++)
+        {
+            threads.emplace_back([&, t]()
+                                 {
+                seed_random(mix_seed(2, t));
+                rays[t] = trace_paths(*bvh_world, paths_total / n, max_depth); });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        double elapsed = seconds_since(start);
+
+        uint64_t total_rays = 0;
+        for (auto count : rays)
+            total_rays += count;
+        double rays_per_sec = total_rays / elapsed;
+
+        if (n == 1)
+        {
+            base_numbers = numbers_per_sec;
+            base_rays = rays_per_sec;
+        }
+
+        std::clog << "threads " << n
+                  << "  random_double " << numbers_per_sec / 1e6 << " M/s (x" << numbers_per_sec / base_numbers << ")"
+                  << "  rays " << rays_per_sec / 1e6 << " M/s (x" << rays_per_sec / base_rays << ")\n";
+    }
+}
+
+// fixed set of rays for traversal benchmarks: half from the main.cpp camera towards the scene,
+// half from random points in random directions (like secondary bounces)
+static std::vector<ray> make_ray_set(size_t count, double extent)
+{
+    std::vector<ray> rays;
+    rays.reserve(count);
+    const point3 eye(13, 2, 3);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i % 2 == 0)
+        {
+            point3 target(random_double(-extent, extent), random_double(-0.5, 2), random_double(-extent, extent));
+            rays.emplace_back(eye, target - eye);
+        }
+        else
+        {
+            point3 origin(random_double(-extent, extent), random_double(0.01, 2), random_double(-extent, extent));
+            rays.emplace_back(origin, random_unit_vector());
+        }
+    }
+    return rays;
+}
+
+// closest hit over the whole ray set, returns Mrays/s and a checksum of hit distances
+static double time_closest_hits(const hittable &world, const std::vector<ray> &rays, double &checksum)
+{
+    checksum = 0;
+    auto start = bench_clock::now();
+    for (const auto &r : rays)
+    {
+        hit_record rec;
+        if (world.hit(r, interval(ray_t_min, infinity), rec))
+            checksum += rec.t;
+    }
+    return rays.size() / seconds_since(start) / 1e6;
+}
+
+// pointer-tree bvh_node against the flattened linear_bvh
+static void bench_bvh()
+{
+    std::clog << "== bvh: bvh_node vs linear_bvh ==\n";
+
+    for (size_t n : {size_t(0), size_t(10000), size_t(200000)})
+    {
+        seed_random(3);
+        material_table materials;
+        hittable_list world;
+        if (n == 0)
+            create_impressive_scene(world, materials);
+        else
+            create_sphere_field(world, materials, n);
+        double extent = (n == 0) ? 11.0 : 0.5 * std::sqrt(double(n));
+        auto rays = make_ray_set(500000, extent);
+
+        auto start = bench_clock::now();
+        auto tree = make_shared<bvh_node>(world);
+        double tree_build_ms = seconds_since(start) * 1e3;
+
+        start = bench_clock::now();
+        auto flat = make_shared<linear_bvh>(world);
+        double flat_build_ms = seconds_since(start) * 1e3;
+
+        double tree_sum, flat_sum;
+        double tree_mrays = time_closest_hits(*tree, rays, tree_sum);
+        double flat_mrays = time_closest_hits(*flat, rays, flat_sum);
+
+        std::clog << world.objects.size() << " objects\n"
+                  << "  bvh_node    build " << tree_build_ms << " ms, " << tree_mrays << " Mrays/s\n"
+                  << "  linear_bvh  build " << flat_build_ms << " ms, " << flat_mrays << " Mrays/s"
+                  << " (x" << flat_mrays / tree_mrays << "), " << flat->stats().node_count << " nodes, "
+                  << flat->stats().node_count * sizeof(linear_bvh_node) / 1024 << " KiB\n";
+        if (std::fabs(tree_sum - flat_sum) > 1e-6 * std::fabs(tree_sum))
+            std::clog << "  WARNING: hit distance checksums differ (" << tree_sum << " vs " << flat_sum << ")\n";
+    }
+}
+
+// median split against binned SAH for a few leaf sizes and bin counts
+static void bench_sah()
+{
+    std::clog << "== sah: median vs binned SAH builds ==\n";
+
+    for (size_t n : {size_t(0), size_t(200000)})
+    {
+        seed_random(3);
+        material_table materials;
+        hittable_list world;
+        if (n == 0)
+            create_impressive_scene(world, materials);
+        else
+            create_sphere_field(world, materials, n);
+        double extent = (n == 0) ? 11.0 : 0.5 * std::sqrt(double(n));
+        auto rays = make_ray_set(500000, extent);
+
+        std::clog << world.objects.size() << " objects\n";
+
+        struct config
+        {
+            std::string name;
+            bvh_build_options options;
+        };
+        std::vector<config> configs;
+        bvh_build_options median;
+        median.split_method = bvh_split_method::median;
+        configs.push_back({"median leaf 4", median});
+        bvh_build_options lbvh;
+        lbvh.split_method = bvh_split_method::lbvh;
+        configs.push_back({"lbvh leaf 4", lbvh});
+        for (int leaf : {1, 4, 8})
+            for (int bins : {8, 16, 32})
+            {
+                bvh_build_options sah;
+                sah.max_leaf_size = leaf;
+                sah.sah_bins = bins;
+                configs.push_back({"sah leaf " + std::to_string(leaf) + " bins " + std::to_string(bins), sah});
+            }
+
+        for (const auto &c : configs)
+        {
+            linear_bvh bvh(world, c.options);
+            double checksum;
+            double mrays = time_closest_hits(bvh, rays, checksum);
+            std::clog << "  " << c.name << ": build " << bvh.stats().build_ms << " ms, SAH cost "
+                      << bvh.stats().sah_cost << ", " << bvh.stats().node_count << " nodes, depth "
+                      << bvh.stats().max_depth << ", " << mrays << " Mrays/s\n";
+        }
+    }
+}
+
+// build time against thread count for the parallel builders. only boxes are generated, no hittables,
+// so this can go to millions of primitives without spending the run on allocating spheres.
+static void bench_build()
+{
+    std::clog << "== build: parallel BVH construction ==\n";
+
+    for (size_t n : {size_t(1000000), size_t(4000000)})
+    {
+        seed_random(4);
+        std::vector<aabb> boxes(n);
+        double half_extent = 0.5 * std::sqrt(double(n));
+        for (auto &box : boxes)
+        {
+            point3 c(random_double(-half_extent, half_extent), random_double(0, 2), random_double(-half_extent, half_extent));
+            vec3 r = vec3::random(0.05, 0.25);
+            box = aabb(c - r, c + r);
+        }
+
+        std::clog << n << " primitives\n";
+        for (auto method : {bvh_split_method::sah, bvh_split_method::lbvh})
+        {
+            double base_ms = 0;
+            for (unsigned int threads : thread_counts())
+            {
+                thread_pool pool(threads);
+                bvh_build_options options;
+                options.split_method = method;
+                options.pool = &pool;
+
+                bvh_tree tree;
+                tree.build(boxes, options);
+                double ms = tree.stats().build_ms;
+                if (threads == 1)
+                    base_ms = ms;
+
+                std::clog << "  " << (method == bvh_split_method::sah ? "sah " : "lbvh")
+                          << " threads " << threads << ": " << ms << " ms (x" << base_ms / ms
+                          << "), SAH cost " << tree.stats().sah_cost << "\n";
+            }
+        }
+    }
+}
+
+// binary bvh_node, flattened binary linear_bvh and the collapsed 4/8 wide trees, all built with the
+// same SAH options so only the layout and the box test differ
+static void bench_wide()
+{
+    std::clog << "== wide: binary vs 4/8-wide BVH";
+#if defined(__AVX__)
+    std::clog << " (SSE + AVX)";
+#elif defined(__SSE2__) || defined(_M_X64)
+    std::clog << " (SSE, 8-wide falls back to scalar, build with -mavx2)";
+#else
+    std::clog << " (scalar)";
+#endif
+    std::clog << " ==\n";
+
+    for (size_t n : {size_t(0), size_t(10000), size_t(200000)})
+    {
+        seed_random(3);
+        material_table materials;
+        hittable_list world;
+        if (n == 0)
+            create_impressive_scene(world, materials);
+        else
+            create_sphere_field(world, materials, n);
+        double extent = (n == 0) ? 11.0 : 0.5 * std::sqrt(double(n));
+        auto rays = make_ray_set(500000, extent);
+
+        bvh_node tree(world);
+        linear_bvh flat(world);
+        bvh4 wide4(world);
+        bvh8 wide8(world);
+
+        double sums[4];
+        double mrays[4] = {
+            time_closest_hits(tree, rays, sums[0]),
+            time_closest_hits(flat, rays, sums[1]),
+            time_closest_hits(wide4, rays, sums[2]),
+            time_closest_hits(wide8, rays, sums[3])};
+
+        std::clog << world.objects.size() << " objects\n"
+                  << "  bvh_node   " << mrays[0] << " Mrays/s\n"
+                  << "  linear_bvh " << mrays[1] << " Mrays/s (x" << mrays[1] / mrays[0] << ")\n"
+                  << "  bvh4       " << mrays[2] << " Mrays/s (x" << mrays[2] / mrays[0] << "), "
+                  << wide4.acceleration().nodes.size() << " nodes, " << wide4.acceleration().memory_bytes() / 1024 << " KiB\n"
+                  << "  bvh8       " << mrays[3] << " Mrays/s (x" << mrays[3] / mrays[0] << "), "
+                  << wide8.acceleration().nodes.size() << " nodes, " << wide8.acceleration().memory_bytes() / 1024 << " KiB\n";
+        for (int k = 1; k < 4; k++)
+            if (std::fabs(sums[k] - sums[0]) > 1e-6 * std::fabs(sums[0]))
+                std::clog << "  WARNING: hit distance checksum " << k << " differs (" << sums[k] << " vs " << sums[0] << ")\n";
+    }
+}
+
+// writes a latitude/longitude tessellated unit sphere as OBJ (with normals and uvs), about
+// 2 * rings * segments triangles, and returns the triangle count
+static size_t write_sphere_obj(const std::string &path, int rings, int segments)
+{
+    std::ofstream out(path);
+    char line[160];
+    for (int r = 0; r <= rings; r++)
+        for (int s = 0; s <= segments; s++)
+        {
+            double theta = pi * r / rings, phi = 2 * pi * s / segments;
+            double x = std::sin(theta) * std::cos(phi), y = std::cos(theta), z = std::sin(theta) * std::sin(phi);
+            std::snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvn %.6f %.6f %.6f\nvt %.6f %.6f\n",
+                          x, y, z, x, y, z, double(s) / segments, double(r) / rings);
+            out << line;
+        }
+
+    size_t triangles = 0;
+    for (int r = 0; r < rings; r++)
+        for (int s = 0; s < segments; s++)
+        {
+            int a = r * (segments + 1) + s + 1, b = a + segments + 1;
+            std::snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                          a, a, a, b, b, b, b + 1, b + 1, b + 1, a + 1, a + 1, a + 1);
+            out << line;
+            triangles += 2;
+        }
+    return triangles;
+}
+
+// OBJ load throughput against thread count, memory per triangle of triangle_mesh against a list of
+// triangle objects, and traversal speed of the two
+static void bench_mesh()
+{
+    std::clog << "== mesh: OBJ loading and triangle_mesh footprint ==\n";
+
+    std::string path = (std::filesystem::temp_directory_path() / "rt_bench_sphere.obj").string();
+    size_t written = write_sphere_obj(path, 1000, 1000);
+    std::clog << "wrote " << written << " triangles to " << path << "\n";
+
+    material_table materials;
+    auto mat = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+    shared_ptr<triangle_mesh> mesh;
+    obj_load_stats stats;
+    double base = 0;
+    for (unsigned int threads : thread_counts())
+    {
+        thread_pool pool(threads);
+        obj_load_options options;
+        options.pool = &pool;
+        mesh = load_obj(path, mat, options, &stats);
+        if (threads == 1)
+            base = stats.seconds;
+        std::clog << "  threads " << threads << ": " << stats.seconds * 1e3 << " ms (x" << base / stats.seconds << "), "
+                  << stats.file_bytes / stats.seconds / (1 << 20) << " MiB/s, "
+                  << stats.triangles / stats.seconds / 1e6 << " Mtris/s\n";
+    }
+
+    // what the same triangles cost as individual triangle objects in a hittable_list under a linear_bvh
+    double object_bytes = sizeof(triangle) + 2 * sizeof(void *) /* make_shared control block */ +
+                          sizeof(shared_ptr<hittable>) /* hittable_list + bvh object arrays */ * 2 +
+                          sizeof(linear_bvh_node) + sizeof(uint32_t);
+    std::clog << "  triangle_mesh: " << stats.mesh_bytes / double(stats.triangles) << " bytes/triangle ("
+              << stats.vertices << " vertices, " << stats.triangles << " triangles)\n"
+              << "  triangle objects: ~" << object_bytes << " bytes/triangle\n";
+
+    hittable_list triangles;
+    for (size_t t = 0; t < mesh->triangle_count(); t++)
+        triangles.add(make_shared<triangle>(mesh->vertex(mesh->indices[3 * t]), mesh->vertex(mesh->indices[3 * t + 1]),
+                                            mesh->vertex(mesh->indices[3 * t + 2]), mat));
+    linear_bvh triangle_bvh(triangles);
+
+    std::vector<ray> rays;
+    for (int i = 0; i < 500000; i++)
+    {
+        point3 origin = 3.0 * random_unit_vector();
+        rays.emplace_back(origin, point3(random_double(-0.5, 0.5), random_double(-0.5, 0.5), random_double(-0.5, 0.5)) - origin);
+    }
+    double mesh_sum, list_sum;
+    double mesh_mrays = time_closest_hits(*mesh, rays, mesh_sum);
+    double list_mrays = time_closest_hits(triangle_bvh, rays, list_sum);
+    std::clog << "  traversal: triangle_mesh " << mesh_mrays << " Mrays/s, triangle objects " << list_mrays << " Mrays/s\n";
+    if (std::fabs(mesh_sum - list_sum) > 1e-6 * std::fabs(list_sum))
+        std::clog << "  WARNING: hit distance checksums differ (" << mesh_sum << " vs " << list_sum << ")\n";
+
+    std::remove(path.c_str());
+}
+
+// thousands of transformed copies of one mesh: instances of the shared triangle_mesh under a top level
+// linear_bvh against every copy flattened into triangle objects under one big linear_bvh. memory is
+// counted from the structures' sizes like bench_mesh does, build time includes creating the objects.
+static void bench_instancing()
+{
+    std::clog << "== instancing: two level BVH vs flattened copies ==\n";
+
+    std::string path = (std::filesystem::temp_directory_path() / "rt_bench_instance.obj").string();
+    write_sphere_obj(path, 24, 24);
+    material_table materials;
+    auto mat = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+    shared_ptr<triangle_mesh> mesh = load_obj(path, mat);
+    std::remove(path.c_str());
+    const size_t mesh_triangles = mesh->triangle_count();
+    std::clog << "mesh: " << mesh_triangles << " triangles, " << mesh->memory_bytes() / 1024.0 << " KiB\n";
+
+    const size_t pointer_bytes = sizeof(shared_ptr<hittable>);
+    const size_t control_block = 2 * sizeof(void *); // make_shared's reference counts
+    auto tree_bytes = [](const bvh_tree &tree)
+    { return tree.nodes.size() * sizeof(linear_bvh_node) + tree.prim_indices.size() * sizeof(uint32_t); };
+
+    for (size_t count : {size_t(1000), size_t(4000), size_t(16000)})
+    {
+        seed_random(9);
+        double half_extent = 2.0 * std::sqrt(double(count));
+        std::vector<affine_transform> transforms;
+        for (size_t i = 0; i < count; i++)
+            transforms.push_back(affine_transform::translate(vec3(random_double(-half_extent, half_extent),
+                                                                  random_double(0, 4),
+                                                                  random_double(-half_extent, half_extent))) *
+                                 affine_transform::rotate(random_unit_vector(), random_double(0, 360)) *
+                                 affine_transform::scale(random_double(0.3, 1.0), random_double(0.3, 1.0), 1.0));
+
+        std::vector<ray> rays;
+        for (int i = 0; i < 200000; i++)
+        {
+            point3 origin(random_double(-half_extent, half_extent), 20, random_double(-half_extent, half_extent));
+            rays.emplace_back(origin, vec3(random_double(-0.5, 0.5), -1, random_double(-0.5, 0.5)));
+        }
+
+        auto start = bench_clock::now();
+        hittable_list instances;
+        for (const auto &t : transforms)
+            instances.add(make_shared<instance>(mesh, t));
+        linear_bvh tlas(instances);
+        double instanced_ms = seconds_since(start) * 1e3;
+        double instanced_bytes = mesh->memory_bytes() +
+                                 count * (sizeof(instance) + control_block + 2 * pointer_bytes) +
+                                 tree_bytes(tlas.acceleration());
+        double instanced_sum;
+        double instanced_mrays = time_closest_hits(tlas, rays, instanced_sum);
+        std::clog << count << " instances (" << count * mesh_triangles / 1e6 << " M triangles)\n"
+                  << "  instanced: build " << instanced_ms << " ms, " << instanced_bytes / (1 << 20) << " MiB, "
+                  << instanced_mrays << " Mrays/s\n";
+
+        // the flattened scene needs ~300 bytes per triangle, only built while that stays around 1.5 GB
+        if (count * mesh_triangles > 5000000)
+        {
+            double estimate = count * mesh_triangles *
+                              (sizeof(triangle) + control_block + 2 * pointer_bytes + 2 * sizeof(linear_bvh_node) / 4.0 +
+                               sizeof(uint32_t));
+            std::clog << "  flattened: skipped, would need ~" << estimate / (1 << 20) << " MiB\n";
+            continue;
+        }
+
+        start = bench_clock::now();
+        double flattened_ms, flattened_bytes, flattened_mrays, flattened_sum;
+        {
+            hittable_list copies;
+            for (const auto &t : transforms)
+                for (size_t tri = 0; tri < mesh_triangles; tri++)
+                    copies.add(make_shared<triangle>(t.point(mesh->vertex(mesh->indices[3 * tri])),
+                                                     t.point(mesh->vertex(mesh->indices[3 * tri + 1])),
+                                                     t.point(mesh->vertex(mesh->indices[3 * tri + 2])), mat));
+            linear_bvh flat(copies);
+            flattened_ms = seconds_since(start) * 1e3;
+            flattened_bytes = copies.objects.size() * (sizeof(triangle) + control_block + 2 * pointer_bytes) +
+                              tree_bytes(flat.acceleration());
+            flattened_mrays = time_closest_hits(flat, rays, flattened_sum);
+        }
+        std::clog << "  flattened: build " << flattened_ms << " ms, " << flattened_bytes / (1 << 20) << " MiB, "
+                  << flattened_mrays << " Mrays/s\n"
+                  << "  instancing: x" << flattened_bytes / instanced_bytes << " less memory, x"
+                  << flattened_ms / instanced_ms << " faster build, x" << instanced_mrays / flattened_mrays
+                  << " traversal speed\n";
+        if (std::fabs(instanced_sum - flattened_sum) > 1e-4 * std::fabs(flattened_sum))
+            std::clog << "  WARNING: hit distance checksums differ (" << instanced_sum << " vs " << flattened_sum << ")\n";
+    }
+}
+
+// drop a file from the page cache so the next mapping really comes from disk (best effort, POSIX only)
+static void evict_from_page_cache(const std::string &path)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+// rebuilding scene + BVH against mapping a snapshot, cold (page cache dropped) and warm. "first rays"
+// is the time to trace a batch of rays right after loading, which is when a mapping pays for page faults
+static void bench_snapshot()
+{
+    std::clog << "== snapshot: rebuild vs memory mapped snapshot ==\n";
+
+    std::string path = (std::filesystem::temp_directory_path() / "rt_bench_scene.snap").string();
+    for (size_t n : {size_t(0), size_t(1000000)})
+    {
+        seed_random(3);
+        double extent = (n == 0) ? 11.0 : 0.5 * std::sqrt(double(n));
+        auto rays = make_ray_set(100000, extent);
+
+        auto start = bench_clock::now();
+        material_table materials;
+        hittable_list world;
+        if (n == 0)
+            create_impressive_scene(world, materials);
+        else
+            create_sphere_field(world, materials, n);
+        double scene_ms = seconds_since(start) * 1e3;
+        linear_bvh bvh(world);
+        double rebuild_ms = scene_ms + bvh.stats().build_ms;
+
+        start = bench_clock::now();
+        save_scene_snapshot(path, world);
+        double save_ms = seconds_since(start) * 1e3;
+
+        double built_sum;
+        time_closest_hits(bvh, rays, built_sum);
+
+        std::clog << world.objects.size() << " objects: scene " << scene_ms << " ms + BVH " << bvh.stats().build_ms
+                  << " ms = " << rebuild_ms << " ms to rebuild, snapshot saved in " << save_ms << " ms ("
+                  << std::filesystem::file_size(path) / 1024 << " KiB)\n";
+
+        for (const char *label : {"cold", "warm"})
+        {
+            if (std::strcmp(label, "cold") == 0)
+                evict_from_page_cache(path);
+
+            start = bench_clock::now();
+            scene_snapshot snapshot(path);
+            double load_ms = seconds_since(start) * 1e3;
+            double sum;
+            double first_ms = rays.size() / time_closest_hits(snapshot, rays, sum) / 1e3;
+            std::clog << "  " << label << ": mapped in " << load_ms << " ms, first " << rays.size() << " rays "
+                      << first_ms << " ms\n";
+            if (std::fabs(sum - built_sum) > 1e-6 * std::fabs(built_sum))
+                std::clog << "  WARNING: snapshot hit checksum differs (" << sum << " vs " << built_sum << ")\n";
+        }
+
+        start = bench_clock::now();
+        scene_snapshot verified(path, true);
+        std::clog << "  full verification pass: " << seconds_since(start) * 1e3 << " ms\n";
+    }
+    std::remove(path.c_str());
+}
+
+// render through the camera with std::cout captured, returns the 8 bit channel values of the image
+static std::vector<int> render_to_pixels(camera &cam, const hittable &world)
+{
+    std::ostringstream image;
+    std::streambuf *old = std::cout.rdbuf(image.rdbuf());
+    cam.render(world);
+    std::cout.rdbuf(old);
+
+    std::istringstream in(image.str());
+    std::string magic;
+    int width, height, max_value;
+    in >> magic >> width >> height >> max_value;
+    std::vector<int> pixels(size_t(width) * height * 3);
+    for (int &value : pixels)
+        in >> value;
+    return pixels;
+}
+
+// recursive ray_color against the iterative integrator with Russian roulette at a few minimum
+// depths: time and rays per sample, and how far the image moves (roulette adds noise, not bias)
+static void bench_integrator()
+{
+    std::clog << "== integrator: recursive vs iterative with Russian roulette ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh_world = make_shared<linear_bvh>(world);
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 320;
+    cam.samples_per_pixel = 32;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.report_utilisation = false;
+
+    auto mean = [](const std::vector<int> &pixels)
+    {
+        double sum = 0;
+        for (int value : pixels)
+            sum += value;
+        return sum / pixels.size();
+    };
+
+    cam.integrator = integrator_type::recursive;
+    auto reference = render_to_pixels(cam, *bvh_world);
+    path_stats base = cam.last_render_stats();
+    std::clog << "recursive          " << base.nanoseconds_per_sample() << " ns/sample, "
+              << base.average_length() << " rays/sample, mean pixel " << mean(reference) << "\n";
+
+    cam.integrator = integrator_type::iterative;
+    for (int min_depth : {1, 3, 5, 50})
+    {
+        cam.rr_min_depth = min_depth;
+        auto pixels = render_to_pixels(cam, *bvh_world);
+        path_stats run = cam.last_render_stats();
+
+        double squared = 0;
+        for (size_t k = 0; k < pixels.size(); k++)
+            squared += double(pixels[k] - reference[k]) * (pixels[k] - reference[k]);
+
+        std::clog << "iterative rr >= " << min_depth << (min_depth < 10 ? "  " : " ")
+                  << run.nanoseconds_per_sample() << " ns/sample, " << run.average_length() << " rays/sample, "
+                  << "saved " << base.nanoseconds_per_sample() - run.nanoseconds_per_sample() << " ns/sample ("
+                  << 100.0 * (1.0 - run.seconds / base.seconds) << "%), mean pixel " << mean(pixels)
+                  << ", rms diff " << std::sqrt(squared / pixels.size()) << "\n";
+    }
+}
+
+// camera rays of the main.cpp view, one per pixel, ordered in blocks of block_w x block_h pixels so
+// that every consecutive run of block_w * block_h rays is one packet
+static std::vector<ray> make_camera_rays(int width, int height, double defocus_angle, int block_w, int block_h)
+{
+    const point3 lookfrom(13, 2, 3), lookat(0, 0, 0);
+    const vec3 vup(0, 1, 0);
+    const double focus_dist = 10.0;
+    double h = std::tan(degrees_to_radians(20.0) / 2);
+    double viewport_height = 2 * h * focus_dist;
+    double viewport_width = viewport_height * (double(width) / height);
+    vec3 w = unit_vector(lookfrom - lookat), u = unit_vector(cross(vup, w)), v = cross(w, u);
+    vec3 delta_u = viewport_width * u / width, delta_v = viewport_height * -v / height;
+    point3 pixel00 = lookfrom - focus_dist * w - viewport_width * u / 2 + viewport_height * v / 2 +
+                     0.5 * (delta_u + delta_v);
+    double defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle / 2));
+
+    std::vector<ray> rays;
+    rays.reserve(size_t(width) * height);
+    for (int by = 0; by < height; by += block_h)
+        for (int bx = 0; bx < width; bx += block_w)
+            for (int k = 0; k < block_w * block_h; k++)
+            {
+                int i = std::min(width - 1, bx + k % block_w), j = std::min(height - 1, by + k / block_w);
+                point3 target = pixel00 + (i + random_double() - 0.5) * delta_u + (j + random_double() - 0.5) * delta_v;
+                vec3 disk = random_in_unit_disk();
+                point3 origin = lookfrom + defocus_radius * (disk.x() * u + disk.y() * v);
+                rays.emplace_back(origin, target - origin);
+            }
+    return rays;
+}
+
+// closest hits of camera rays in packets of N, returns Mrays/s and a checksum of hit distances
+template <int N>
+static double time_packet_hits(const packet_tracer &tracer, const std::vector<ray> &rays, double &checksum)
+{
+    checksum = 0;
+    hit_record recs[N];
+    auto start = bench_clock::now();
+    for (size_t first = 0; first + N <= rays.size(); first += N)
+    {
+        uint32_t hits = tracer.hit<N>(&rays[first], (1u << N) - 1, interval(ray_t_min, infinity), recs);
+        for (int k = 0; k < N; k++)
+            if (hits & (1u << k))
+                checksum += recs[k].t;
+    }
+    return rays.size() / seconds_since(start) / 1e6;
+}
+
+// primary ray throughput, single rays through linear_bvh against 4, 8 and 16 ray packets, with the
+// main.cpp depth of field and with a pinhole camera
+static void bench_packet()
+{
+    std::clog << "== packet: coherent camera ray packets ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh = make_shared<linear_bvh>(world);
+    packet_tracer tracer(*bvh);
+
+    for (double defocus : {0.0, 0.6})
+    {
+        std::clog << (defocus > 0 ? "defocus 0.6\n" : "pinhole\n");
+        double base = 0;
+        auto report = [&](const char *name, double mrays, double sum, double reference)
+        {
+            if (base == 0)
+                base = mrays;
+            std::clog << "  " << name << " " << mrays << " Mrays/s (x" << mrays / base << ")\n";
+            if (std::fabs(sum - reference) > 1e-6 * std::fabs(reference))
+                std::clog << "  WARNING: hit distance checksums differ (" << sum << " vs " << reference << ")\n";
+        };
+
+        // the same rays in the same order for every variant, 4x4 blocks hold whole 2x2 and 4x2 blocks
+        seed_random(11);
+        auto rays = make_camera_rays(1280, 720, defocus, 4, 4);
+        double reference, sum;
+        time_closest_hits(*bvh, rays, reference); // warm up
+        double mrays = time_closest_hits(*bvh, rays, reference);
+        report("single    ", mrays, reference, reference);
+        mrays = time_packet_hits<4>(tracer, rays, sum);
+        report("packet 4  ", mrays, sum, reference);
+        mrays = time_packet_hits<8>(tracer, rays, sum);
+        report("packet 8  ", mrays, sum, reference);
+        mrays = time_packet_hits<16>(tracer, rays, sum);
+        report("packet 16 ", mrays, sum, reference);
+    }
+}
+
+// megakernel (iterative integrator, one path after another per tile) against wavefront mode, on the
+// main.cpp scene (every small sphere has its own material) and on a big field of spheres
+static void bench_wavefront()
+{
+    std::clog << "== wavefront: breadth first stages vs megakernel ==\n";
+
+    for (size_t n : {size_t(0), size_t(100000)})
+    {
+        seed_random(5);
+        material_table materials;
+        hittable_list world;
+        if (n == 0)
+            create_impressive_scene(world, materials);
+        else
+            create_sphere_field(world, materials, n);
+        auto bvh_world = make_shared<linear_bvh>(world);
+        std::clog << world.objects.size() << " objects, " << materials.size() << " materials\n";
+
+        camera cam;
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.image_width = 320;
+        cam.samples_per_pixel = 32;
+        cam.max_depth = 50;
+        cam.vfov = 20;
+        cam.lookfrom = (n == 0) ? point3(13, 2, 3) : point3(0, 20, 40);
+        cam.lookat = point3(0, 0, 0);
+        cam.defocus_angle = 0.6;
+        cam.focus_dist = 10.0;
+        cam.report_utilisation = false;
+
+        double base_seconds = 0, base_mean = 0;
+        for (integrator_type mode : {integrator_type::iterative, integrator_type::wavefront})
+        {
+            cam.integrator = mode;
+            auto pixels = render_to_pixels(cam, *bvh_world);
+            const path_stats &run = cam.last_render_stats();
+
+            double mean = 0;
+            for (int value : pixels)
+                mean += value;
+            mean /= pixels.size();
+            if (mode == integrator_type::iterative)
+                base_seconds = run.seconds, base_mean = mean;
+
+            std::clog << (mode == integrator_type::iterative ? "  megakernel " : "  wavefront  ")
+                      << run.segments / run.seconds / 1e6 << " Mrays/s, " << run.nanoseconds_per_sample()
+                      << " ns/sample (x" << base_seconds / run.seconds << "), mean pixel " << mean
+                      << " (megakernel " << base_mean << ")\n";
+        }
+    }
+}
+
+// float against double: build the benchmark twice (with and without -DRT_USE_FLOAT) and run this
+// section in the same directory with both. each run saves its image as precision_<type>.ppm; once
+// the other one is there the image error is reported against it, next to the noise floor (the same
+// build with another seed), which is what a different precision has to stay close to.
+static void bench_precision()
+{
+    const char *name = scalar_traits<real>::name;
+    const char *other = std::is_same<real, float>::value ? "double" : "float";
+    std::clog << "== precision: " << name << " build ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto start = bench_clock::now();
+    auto bvh_world = make_shared<linear_bvh>(world);
+    double build_ms = seconds_since(start) * 1e3;
+
+    std::clog << "sizeof vec3 " << sizeof(vec3) << ", ray " << sizeof(ray) << ", aabb " << sizeof(aabb)
+              << ", hit_record " << sizeof(hit_record) << ", sphere " << sizeof(sphere) << ", triangle "
+              << sizeof(triangle) << " bytes\n";
+
+    // an OBJ sphere through the triangle path too: memory per triangle of a mesh
+    std::string obj_path = "precision_mesh.obj";
+    write_sphere_obj(obj_path, 300, 600);
+    auto mesh = load_obj(obj_path, materials.make<lambertian>(color(0.5, 0.5, 0.5)));
+    std::remove(obj_path.c_str());
+    std::clog << "mesh " << mesh->triangle_count() << " triangles, "
+              << double(mesh->memory_bytes()) / mesh->triangle_count() << " bytes/triangle\n";
+
+    auto rays = make_ray_set(500000, 11.0);
+    double sum;
+    std::clog << "linear_bvh build " << build_ms << " ms, " << time_closest_hits(*bvh_world, rays, sum)
+              << " Mrays/s closest hit\n";
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 320;
+    cam.samples_per_pixel = 32;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.report_utilisation = false;
+
+    auto pixels = render_to_pixels(cam, *bvh_world);
+    std::clog << "render " << cam.last_render_stats().nanoseconds_per_sample() << " ns/sample\n";
+    cam.seed = 1;
+    auto reseeded = render_to_pixels(cam, *bvh_world);
+
+    auto rms = [](const std::vector<int> &a, const std::vector<int> &b)
+    {
+        double squared = 0;
+        for (size_t k = 0; k < a.size(); k++)
+            squared += double(a[k] - b[k]) * (a[k] - b[k]);
+        return std::sqrt(squared / a.size());
+    };
+    std::clog << "noise floor (seed 0 vs 1) rms " << rms(pixels, reseeded) << "\n";
+
+    {
+        std::ofstream out(std::string("precision_") + name + ".ppm");
+        out << "P3\n" << 320 << ' ' << 180 << "\n255\n";
+        for (int value : pixels)
+            out << value << '\n';
+    }
+
+    std::ifstream in(std::string("precision_") + other + ".ppm");
+    if (!in)
+    {
+        std::clog << "run the " << other << " build of this section to compare images\n";
+        return;
+    }
+    std::string magic;
+    int width, height, max_value;
+    in >> magic >> width >> height >> max_value;
+    std::vector<int> theirs(pixels.size());
+    for (int &value : theirs)
+        in >> value;
+    int max_diff = 0;
+    for (size_t k = 0; k < pixels.size(); k++)
+        max_diff = std::max(max_diff, std::abs(pixels[k] - theirs[k]));
+    std::clog << name << " vs " << other << " rms " << rms(pixels, theirs) << ", max " << max_diff << "\n";
+}
+
+// one block kernel call against W scalar hit() calls on the same primitives, over many rays.
+// returns primitive tests per second (millions) and sums the nearest hit distances into checksum
+template <int W, typename Block, typename Prim>
+static double time_leaf_kernel(const std::vector<Block> &blocks, const std::vector<shared_ptr<Prim>> &prims,
+                               const std::vector<ray> &rays, bool simd, double &checksum)
+{
+    checksum = 0;
+    uint64_t tests = 0;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        const ray &r = rays[i];
+        size_t b = i % blocks.size();
+        if (simd)
+        {
+            float t;
+            if (blocks[b].hit(r, float(ray_t_min), std::numeric_limits<float>::infinity(), t) >= 0)
+                checksum += t;
+        }
+        else
+        {
+            hit_record rec;
+            interval ray_t(ray_t_min, infinity);
+            bool hit = false;
+            for (int k = 0; k < W; k++)
+                if (static_cast<const hittable &>(*prims[b * W + k]).hit(r, ray_t, rec))
+                    ray_t.max = rec.t, hit = true;
+            if (hit)
+                checksum += rec.t;
+        }
+        tests += W;
+    }
+    return tests / seconds_since(start) / 1e6;
+}
+
+// random primitives in a unit-ish cluster, packed W to a block, and rays aimed through the cluster
+template <int W>
+static void bench_leaf_kernels()
+{
+    const size_t block_count = 4096;
+    seed_random(17);
+    material_table materials;
+    auto mat = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+
+    std::vector<shared_ptr<sphere>> spheres;
+    std::vector<shared_ptr<triangle>> triangles;
+    std::vector<sphere_block<W>> sphere_blocks(block_count);
+    std::vector<triangle_block<W>> triangle_blocks(block_count);
+    for (size_t b = 0; b < block_count; b++)
+        for (int k = 0; k < W; k++)
+        {
+            point3 c = vec3::random(-1, 1);
+            spheres.push_back(make_shared<sphere>(c, real(random_double(0.1, 0.4)), mat));
+            sphere_blocks[b].add(*spheres.back());
+            triangles.push_back(make_shared<triangle>(c, c + vec3::random(-0.6, 0.6), c + vec3::random(-0.6, 0.6), mat));
+            triangle_blocks[b].add(*triangles.back());
+        }
+
+    std::vector<ray> rays;
+    for (int i = 0; i < 1000000; i++)
+    {
+        point3 origin = 5 * random_unit_vector();
+        rays.emplace_back(origin, vec3::random(-1, 1) - origin);
+    }
+
+    double scalar_sum, simd_sum;
+    double scalar = time_leaf_kernel<W>(sphere_blocks, spheres, rays, false, scalar_sum);
+    double simd = time_leaf_kernel<W>(sphere_blocks, spheres, rays, true, simd_sum);
+    std::clog << "  spheres x" << W << "    scalar " << scalar << " M tests/s, block " << simd << " M tests/s (x"
+              << simd / scalar << "), checksum " << scalar_sum << " vs " << simd_sum << "\n";
+
+    scalar = time_leaf_kernel<W>(triangle_blocks, triangles, rays, false, scalar_sum);
+    simd = time_leaf_kernel<W>(triangle_blocks, triangles, rays, true, simd_sum);
+    std::clog << "  triangles x" << W << "  scalar " << scalar << " M tests/s, block " << simd << " M tests/s (x"
+              << simd / scalar << "), checksum " << scalar_sum << " vs " << simd_sum << "\n";
+}
+
+// the leaf kernels on their own, then whole scenes: linear_bvh (one virtual hit() per primitive)
+// against simd_leaf_bvh with 4 and 8 wide leaf blocks
+static void bench_leaf()
+{
+    std::clog << "== leaf: SIMD sphere/triangle blocks vs scalar hit() ==\n";
+    bench_leaf_kernels<4>();
+    bench_leaf_kernels<8>();
+
+    for (int scene = 0; scene < 3; scene++)
+    {
+        seed_random(3);
+        material_table materials;
+        hittable_list world;
+        double extent = 11.0;
+        if (scene == 0)
+            create_impressive_scene(world, materials);
+        else if (scene == 1)
+        {
+            create_sphere_field(world, materials, 200000);
+            extent = 0.5 * std::sqrt(200000.0);
+        }
+        else
+        {
+            // the tessellated OBJ sphere as separate triangle objects
+            std::string path = "leaf_bench.obj";
+            write_sphere_obj(path, 200, 400);
+            auto mesh = load_obj(path, materials.make<lambertian>(color(0.5, 0.5, 0.5)));
+            std::remove(path.c_str());
+            for (size_t t = 0; t < mesh->triangle_count(); t++)
+                world.add(make_shared<triangle>(mesh->vertex(mesh->indices[3 * t]), mesh->vertex(mesh->indices[3 * t + 1]),
+                                                mesh->vertex(mesh->indices[3 * t + 2]), mesh->mat));
+            extent = 1.0;
+        }
+        auto rays = make_ray_set(500000, extent);
+
+        linear_bvh flat(world);
+        simd_leaf_bvh<4> leaf4(world);
+        simd_leaf_bvh<8> leaf8(world);
+
+        double flat_sum, sum4, sum8;
+        double flat_mrays = time_closest_hits(flat, rays, flat_sum);
+        double mrays4 = time_closest_hits(leaf4, rays, sum4);
+        double mrays8 = time_closest_hits(leaf8, rays, sum8);
+
+        std::clog << world.objects.size() << " objects\n"
+                  << "  linear_bvh        " << flat_mrays << " Mrays/s, SAH cost " << flat.stats().sah_cost << "\n"
+                  << "  simd_leaf_bvh<4>  " << mrays4 << " Mrays/s (x" << mrays4 / flat_mrays << ")\n"
+                  << "  simd_leaf_bvh<8>  " << mrays8 << " Mrays/s (x" << mrays8 / flat_mrays << "), SAH cost "
+                  << leaf8.stats().sah_cost << "\n";
+        for (double sum : {sum4, sum8})
+            if (std::fabs(sum - flat_sum) > 1e-4 * std::fabs(flat_sum))
+                std::clog << "  WARNING: hit distance checksums differ (" << flat_sum << " vs " << sum << ")\n";
+    }
+}
+
+// writing a 4K framebuffer: the old per channel write_color P3 path against the buffered writers,
+// encode time on its own and encode + write to a file, plus the file sizes
+static void bench_image()
+{
+    std::clog << "== image output: write_color P3 vs buffered P3/P6/PFM/PNG (3840x2160) ==\n";
+
+    const int width = 3840, height = 2160;
+    std::vector<color> pixels(size_t(width) * height);
+    seed_random(42);
+    for (auto &p : pixels)
+    {
+        // mostly in range, some dark values where the gamma curve is steep, some overexposed
+        double scale = random_double() < 0.1 ? 0.01 : 1.2;
+        p = color(scale * random_double(), scale * random_double(), scale * random_double());
+    }
+    std::string path = "image_bench.out";
+
+    auto start = bench_clock::now();
+    {
+        std::ofstream file(path);
+        file << "P3\n"
+             << width << ' ' << height << "\n255\n";
+        for (const auto &p : pixels)
+            write_color(file, p);
+    }
+    double old_seconds = seconds_since(start);
+    size_t old_size = std::filesystem::file_size(path);
+    std::ifstream old_file(path);
+    std::string old_bytes((std::istreambuf_iterator<char>(old_file)), std::istreambuf_iterator<char>());
+    std::clog << "  write_color P3       " << old_seconds * 1e3 << " ms, " << old_size / 1048576.0 << " MB\n";
+
+    (void)gamma_quantiser::instance(); // build the table outside the timings
+    const std::pair<const char *, image_format> formats[] = {
+        {"P3", image_format::p3}, {"P6", image_format::p6}, {"PFM", image_format::pfm}, {"PNG", image_format::png}};
+    for (const auto &f : formats)
+    {
+        start = bench_clock::now();
+        std::string encoded = encode_image(f.second, width, height, pixels.data());
+        double encode_seconds = seconds_since(start);
+
+        start = bench_clock::now();
+        write_image(path, f.second, width, height, pixels.data());
+        double total_seconds = seconds_since(start);
+
+        std::clog << "  buffered " << f.first << std::string(12 - std::strlen(f.first), ' ') << total_seconds * 1e3
+                  << " ms (encode " << encode_seconds * 1e3 << " ms), " << encoded.size() / 1048576.0 << " MB, x"
+                  << old_seconds / total_seconds << "\n";
+        if (f.second == image_format::p3 && encoded != old_bytes)
+            std::clog << "  WARNING: buffered P3 differs from write_color\n";
+    }
+
+    // the table against the sqrt it replaces, on every channel of the framebuffer
+    const gamma_quantiser &quantise = gamma_quantiser::instance();
+    double lut_sum = 0, sqrt_sum = 0;
+    start = bench_clock::now();
+    for (const auto &p : pixels)
+        lut_sum += quantise(p.x()) + quantise(p.y()) + quantise(p.z());
+    double lut_seconds = seconds_since(start);
+    start = bench_clock::now();
+    for (const auto &p : pixels)
+        for (int c = 0; c < 3; c++)
+            sqrt_sum += int(256 * std::max(0.0, std::min(0.999, linear_to_gamma(p[c]))));
+    double sqrt_seconds = seconds_since(start);
+    std::clog << "  quantise: table " << lut_seconds * 1e3 << " ms, sqrt + clamp " << sqrt_seconds * 1e3 << " ms"
+              << (lut_sum == sqrt_sum ? "" : "  WARNING: results differ") << "\n";
+
+    std::remove(path.c_str());
+}
+
+// progressive rendering: what cutting a render into passes costs, what a checkpoint costs, and that
+// passes and an interrupted + resumed render give the one pass image
+static void bench_progressive()
+{
+    std::clog << "== progressive: passes and checkpoints ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh_world = make_shared<linear_bvh>(world);
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 320;
+    cam.samples_per_pixel = 32;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.report_utilisation = false;
+
+    auto reference = render_to_pixels(cam, *bvh_world);
+    double one_pass = cam.last_render_stats().seconds;
+    std::clog << "one pass of 32 spp      " << one_pass << " s\n";
+
+    for (int pass : {8, 1})
+    {
+        cam.pass_samples = pass;
+        auto pixels = render_to_pixels(cam, *bvh_world);
+        double seconds = cam.last_render_stats().seconds;
+        std::clog << "passes of " << pass << " spp" << std::string(pass < 10 ? 9 : 8, ' ') << seconds << " s (x"
+                  << seconds / one_pass << ")" << (pixels == reference ? "" : "  WARNING: image differs") << "\n";
+    }
+
+    // a render stopped by its time budget after the first pass, then resumed to the end
+    std::string path = "progressive_bench.ckpt";
+    cam.pass_samples = 4;
+    cam.checkpoint_path = path;
+    cam.time_budget = 1e-6;
+    render_to_pixels(cam, *bvh_world);
+    double stopped = cam.last_render_stats().seconds;
+    size_t bytes = std::filesystem::file_size(path);
+
+    cam.time_budget = 0;
+    cam.resume = true;
+    auto resumed = render_to_pixels(cam, *bvh_world);
+    std::clog << "stopped at 4 spp        " << stopped << " s, checkpoint " << bytes / 1048576.0 << " MB\n"
+              << "resumed to 32 spp       " << cam.last_render_stats().seconds << " s"
+              << (resumed == reference ? ", same image as one pass" : "  WARNING: image differs") << "\n";
+
+    // save and load on their own, at 1920x1080
+    accumulation_buffer buffer;
+    buffer.reset(1920, 1080, 0);
+    auto start = bench_clock::now();
+    buffer.save(path, 1);
+    double save_seconds = seconds_since(start);
+    start = bench_clock::now();
+    buffer.load(path, 1);
+    std::clog << "1920x1080 checkpoint    save " << save_seconds * 1e3 << " ms, load " << seconds_since(start) * 1e3
+              << " ms, " << std::filesystem::file_size(path) / 1048576.0 << " MB\n";
+    std::remove(path.c_str());
+}
+
+// adaptive sampling at equal error: every render is compared with a 1024 spp uniform reference
+// (rms error of the displayed, gamma 2 values), and the uniform sample count that would give an
+// adaptive render's error is read off the uniform renders' error curve (log-log interpolation).
+// the reference's own noise is taken out of every error: with per sample variance v, a uniform
+// render of n spp measures v/n + v/1024, so the 16 spp render gives v.
+static void bench_adaptive()
+{
+    std::clog << "== adaptive sampling: samples saved at equal error ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh_world = make_shared<linear_bvh>(world);
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 160;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.report_utilisation = false;
+
+    auto render = [&](int spp, double threshold, uint64_t seed)
+    {
+        cam.samples_per_pixel = spp;
+        cam.adaptive_threshold = threshold;
+        cam.seed = seed;
+        render_to_pixels(cam, *bvh_world);
+        std::vector<double> display;
+        for (const color &c : cam.image())
+            for (int a = 0; a < 3; a++)
+                display.push_back(linear_to_gamma(std::min(1.0, double(c[a]))));
+        return display;
+    };
+
+    auto reference = render(1024, 0, 99); // its own seed, so its noise is independent of the others'
+
+    double reference_noise = 0; // mean squared error the reference contributes
+    auto rms = [&](const std::vector<double> &display)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < display.size(); i++)
+            sum += (display[i] - reference[i]) * (display[i] - reference[i]);
+        return std::sqrt(std::max(0.0, sum / display.size() - reference_noise));
+    };
+
+    std::vector<std::pair<double, double>> uniform; // (spp, rms error)
+    for (int spp : {16, 32, 64, 128, 256})
+    {
+        auto display = render(spp, 0, 1);
+        if (spp == 16)
+        {
+            double measured = rms(display);
+            reference_noise = measured * measured / (1.0 / 16 + 1.0 / 1024) / 1024;
+        }
+        double error = rms(display);
+        uniform.push_back({double(spp), error});
+        std::clog << "uniform  " << spp << " spp" << std::string(spp < 100 ? 21 : 20, ' ') << "rms " << error << ", "
+                  << cam.last_render_stats().seconds << " s\n";
+    }
+
+    auto equal_error_spp = [&](double error)
+    {
+        for (size_t i = 1; i < uniform.size(); i++)
+            if (error >= uniform[i].second || i + 1 == uniform.size())
+            {
+                auto a = uniform[i - 1], b = uniform[i];
+                double t = std::log(error / a.second) / std::log(b.second / a.second);
+                return std::exp(std::log(a.first) + t * std::log(b.first / a.first));
+            }
+        return uniform.back().first;
+    };
+
+    for (double threshold : {0.02, 0.01, 0.005})
+    {
+        double error = rms(render(256, threshold, 1));
+        double average = double(cam.last_render_stats().samples) / cam.image().size();
+        double equal = equal_error_spp(error);
+        std::clog << "adaptive " << threshold << " (cap 256)" << std::string(threshold < 0.01 ? 6 : 7, ' ') << "rms "
+                  << error << ", " << cam.last_render_stats().seconds << " s, " << average
+                  << " spp on average, uniform needs ~" << equal << " spp: " << 100.0 * (1.0 - average / equal)
+                  << "% samples saved\n";
+    }
+}
+
+// à-trous denoiser: low spp renders before and after denoising against a 1024 spp reference (rms of
+// the displayed values, the reference's own noise taken out as in bench_adaptive), the time the
+// feature buffers and the filter take, and the uniform spp the same error would need without it
+static void bench_denoise()
+{
+    std::clog << "== denoise: a-trous filter guided by albedo/normal/depth ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_impressive_scene(world, materials);
+    auto bvh_world = make_shared<linear_bvh>(world);
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 200;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.report_utilisation = false;
+
+    auto display = [](const std::vector<color> &image)
+    {
+        std::vector<double> values;
+        for (const color &c : image)
+            for (int a = 0; a < 3; a++)
+                values.push_back(linear_to_gamma(std::min(1.0, double(c[a]))));
+        return values;
+    };
+
+    cam.samples_per_pixel = 1024;
+    cam.seed = 99;
+    render_to_pixels(cam, *bvh_world);
+    auto reference = display(cam.image());
+
+    double reference_noise = 0;
+    auto rms = [&](const std::vector<double> &values)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < values.size(); i++)
+            sum += (values[i] - reference[i]) * (values[i] - reference[i]);
+        return std::sqrt(std::max(0.0, sum / values.size() - reference_noise));
+    };
+
+    cam.seed = 1;
+    double per_sample_variance = 0;
+    for (int spp : {4, 16, 64})
+    {
+        cam.samples_per_pixel = spp;
+        cam.use_denoiser = false;
+        render_to_pixels(cam, *bvh_world);
+        double render_seconds = cam.last_render_stats().seconds;
+        std::vector<color> noisy = cam.image();
+        if (spp == 4)
+        {
+            double measured = rms(display(noisy));
+            per_sample_variance = measured * measured / (1.0 / 4 + 1.0 / 1024);
+            reference_noise = per_sample_variance / 1024;
+        }
+        double noisy_error = rms(display(noisy));
+
+        // same samples again, then the feature buffers and the filter; the render's own stats stop
+        // before them, so the rest of the wall time is their cost (and writing the image)
+        cam.use_denoiser = true;
+        auto start = bench_clock::now();
+        render_to_pixels(cam, *bvh_world);
+        double overhead_ms = (seconds_since(start) - cam.last_render_stats().seconds) * 1e3;
+
+        // the filter on its own
+        feature_buffers features = cam.features();
+        denoise_options options = cam.denoiser;
+        options.pool = thread_pool::global().get();
+        start = bench_clock::now();
+        auto denoised = denoise(cam.image_width, cam.height(), noisy, features, options);
+        double denoise_ms = seconds_since(start) * 1e3;
+        double error = rms(display(denoised));
+
+        std::clog << spp << " spp" << std::string(spp < 10 ? 3 : 2, ' ') << "render " << render_seconds
+                  << " s, rms " << noisy_error << " -> denoised " << error << " (features + filter "
+                  << overhead_ms << " ms, filter " << denoise_ms << " ms); uniform needs ~" << per_sample_variance / (error * error) << " spp for that error\n";
+    }
+}
+
+// light sampling on the Cornell box (small emitters, no sky): bounces only, next event estimation and
+// MIS, each given the same time budget. rms of the displayed values against a 1024 spp MIS reference
+// (its own noise taken out, measured on the MIS run), and the mean image luminance, which has to agree
+// between the modes since all three are unbiased.
+static void bench_lights()
+{
+    std::clog << "== lights: bounces only vs next event estimation vs MIS at equal time ==\n";
+
+    material_table materials;
+    hittable_list world;
+    create_cornell_scene(world, materials);
+    auto bvh_world = make_shared<linear_bvh>(world);
+
+    camera cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 100;
+    cam.max_depth = 10;
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.sky_brightness = 0;
+    cam.lights = light_list::collect(world);
+    cam.report_utilisation = false;
+    std::clog << cam.lights.size() << " emissive primitives\n";
+
+    auto display = [](const std::vector<color> &image)
+    {
+        std::vector<double> values;
+        for (const color &c : image)
+            for (int a = 0; a < 3; a++)
+                values.push_back(linear_to_gamma(std::min(1.0, double(c[a]))));
+        return values;
+    };
+    auto mean_luminance = [](const std::vector<color> &image)
+    {
+        double sum = 0;
+        for (const color &c : image)
+            sum += luminance(c);
+        return sum / image.size();
+    };
+
+    cam.direct_light = light_sampling::mis;
+    cam.samples_per_pixel = 1024;
+    cam.seed = 99;
+    render_to_pixels(cam, *bvh_world);
+    auto reference = display(cam.image());
+    std::clog << "reference  1024 spp in " << cam.last_render_stats().seconds << " s, mean luminance "
+              << mean_luminance(cam.image()) << "\n";
+
+    auto squared_error = [&](const std::vector<double> &values)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < values.size(); i++)
+            sum += (values[i] - reference[i]) * (values[i] - reference[i]);
+        return sum / values.size();
+    };
+
+    struct mode
+    {
+        const char *name;
+        light_sampling sampling;
+    };
+    const mode modes[] = {{"mis", light_sampling::mis},
+                          {"nee", light_sampling::next_event},
+                          {"off", light_sampling::off}};
+
+    cam.seed = 1;
+    cam.pass_samples = 1;
+    cam.samples_per_pixel = 1 << 20; // the budget ends every run
+    for (double budget : {0.5, 2.0})
+    {
+        cam.time_budget = budget;
+        double reference_noise = 0;
+        for (const mode &m : modes)
+        {
+            cam.direct_light = m.sampling;
+            render_to_pixels(cam, *bvh_world);
+            path_stats run = cam.last_render_stats();
+            double spp = double(run.samples) / (cam.image_width * cam.height());
+            double error2 = squared_error(display(cam.image()));
+            if (m.sampling == light_sampling::mis)
+                reference_noise = error2 / (1.0 / spp + 1.0 / 1024) / 1024; // same per sample noise as the reference
+            double error = std::sqrt(std::max(0.0, error2 - reference_noise));
+            std::clog << budget << " s  " << m.name << "  " << spp << " spp, " << run.average_length()
+                      << " rays/sample, rms " << error << ", mean luminance " << mean_luminance(cam.image())
+                      << ", efficiency 1/(rms^2 t) " << 1.0 / (error * error * run.seconds) << "\n";
+        }
+    }
+}
+
+// the scene and camera of the distributed benchmark, built the same way by the coordinator and by every
+// worker process (the scene generator is seeded, so they all get the same spheres)
+static void distributed_scene(material_table &materials, shared_ptr<linear_bvh> &world, camera &cam)
+{
+    seed_random(21);
+    hittable_list list;
+    create_impressive_scene(list, materials);
+    world = make_shared<linear_bvh>(list);
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 320;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+    cam.use_multithreading = false; // one process per worker is the parallelism here
+    cam.report_utilisation = false;
+    cam.output_format = image_format::pfm;
+    cam.output_path = (std::filesystem::temp_directory_path() / "rt_bench_distributed.pfm").string();
+}
+
+// "benchmark distributed-worker <address>": one worker process of bench_distributed
+static int run_distributed_worker(const char *address)
+{
+    material_table materials;
+    shared_ptr<linear_bvh> world;
+    camera cam;
+    distributed_scene(materials, world, cam);
+    std::clog.setstate(std::ios::failbit); // the coordinator does the talking
+    try
+    {
+        run_render_worker(address, cam, *world);
+    }
+    catch (const std::exception &)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+// this benchmark started again as a worker for address
+static pid_t spawn_worker(const std::string &address)
+{
+    std::string self = std::filesystem::read_symlink("/proc/self/exe").string();
+    std::string section = "distributed-worker";
+    char *args[] = {self.data(), section.data(), const_cast<char *>(address.c_str()), nullptr};
+    pid_t pid;
+    if (posix_spawn(&pid, self.c_str(), nullptr, nullptr, args, environ) != 0)
+        throw std::runtime_error("cannot start a worker process");
+    return pid;
+}
+#endif
+
+// distributed rendering on this machine: single threaded worker processes (this benchmark started
+// again) connected to a coordinator over a unix socket, for 1, 2, 4 ... workers. scaling efficiency is
+// t(1) / (n t(n)); with more workers than hardware threads it can only drop. then the same frame with
+// 4 jobs per tile, and with one worker killed part way through: the image must not change.
+static void bench_distributed()
+{
+    std::clog << "== distributed: worker processes on one machine ==\n";
+#ifdef _WIN32
+    std::clog << "needs posix_spawn, skipped\n";
+#else
+    material_table materials;
+    shared_ptr<linear_bvh> world;
+    camera cam;
+    distributed_scene(materials, world, cam);
+
+    cam.render(*world);
+    const std::vector<color> local = cam.image();
+    double local_seconds = cam.last_render_stats().seconds;
+    std::clog << "local render, 1 thread  " << local_seconds << " s\n";
+
+    auto same_image = [&](const std::vector<color> &image)
+    {
+        return image.size() == local.size() && std::memcmp(image.data(), local.data(), local.size() * sizeof(color)) == 0;
+    };
+
+    std::string address = "unix:" + (std::filesystem::temp_directory_path() / "rt_bench_distributed.sock").string();
+    render_coordinator coordinator(address);
+
+    // renders the frame on 'workers' fresh processes, killing one of them after kill_after seconds
+    auto run = [&](int workers, const distributed_options &options, double kill_after, distributed_stats &stats)
+    {
+        std::vector<pid_t> pids;
+        for (int i = 0; i < workers; i++)
+            pids.push_back(spawn_worker(coordinator.address()));
+        std::thread killer;
+        if (kill_after > 0)
+            killer = std::thread([&]
+                                 {
+                std::this_thread::sleep_for(std::chrono::duration<double>(kill_after));
+                kill(pids[0], SIGKILL); });
+
+        accumulation_buffer samples = coordinator.render(cam, *world, options, &stats);
+        if (killer.joinable())
+            killer.join();
+        for (pid_t pid : pids)
+            waitpid(pid, nullptr, 0);
+
+        path_stats totals;
+        totals.samples = samples.total_samples();
+        totals.segments = stats.segments;
+        totals.seconds = stats.seconds;
+        cam.render_from(*world, samples, totals);
+        return cam.image();
+    };
+
+    distributed_options options;
+    options.tile_size = 32;
+    options.progress = false;
+
+    double one_worker = 0;
+    unsigned int hw = std::max(1u, std::thread::hardware_concurrency());
+    for (int workers : {1, 2, 4, 8})
+    {
+        if (workers > 4 && unsigned(workers) > hw)
+            break;
+        distributed_stats stats;
+        auto image = run(workers, options, 0, stats);
+        if (workers == 1)
+            one_worker = stats.seconds;
+        std::clog << workers << " worker" << (workers > 1 ? "s " : "  ") << "              " << stats.seconds
+                  << " s, scaling efficiency " << 100.0 * one_worker / (workers * stats.seconds) << "%"
+                  << (unsigned(workers) > hw ? " (more workers than hardware threads)" : "") << ", "
+                  << stats.jobs << " jobs, worker time " << stats.worker_seconds << " s"
+                  << (same_image(image) ? ", same image as local" : "  WARNING: image differs from local") << "\n";
+    }
+
+    // sample ranges as jobs: deterministic, but different generators than the local render
+    distributed_stats stats;
+    options.job_samples = cam.samples_per_pixel / 4;
+    auto split = run(2, options, 0, stats);
+    std::clog << "2 workers, 4 jobs/tile   " << stats.seconds << " s, " << stats.jobs << " jobs\n";
+
+    distributed_stats failed;
+    auto recovered = run(2, options, 0.25 * one_worker, failed);
+    bool same = std::memcmp(split.data(), recovered.data(), split.size() * sizeof(color)) == 0;
+    std::clog << "  one worker killed      " << failed.seconds << " s, " << failed.requeued << " job"
+              << (failed.requeued == 1 ? "" : "s") << " handed out again"
+              << (same ? ", same image as without the failure" : "  WARNING: image differs") << "\n";
+    std::remove(cam.output_path.c_str());
+#endif
+}
+
+// a field of drifting spheres over 30 frames, its BVH kept up to date three ways: built from scratch
+// every frame, refitted and rebuilt once the SAH cost got 30% worse, and only ever refitted. the
+// update cost is only half the story, a stale tree makes every ray slower, so each frame also traces
+// a ray set through it.
+static void bench_animation()
+{
+    std::clog << "== animation: BVH refit vs rebuild ==\n";
+
+    const size_t n = 200000;
+    const int frames = 30;
+    seed_random(9);
+    material_table materials;
+    auto mat = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+    double half_extent = 0.5 * std::sqrt(double(n));
+
+    // every sphere moves in a straight line, up to 0.3 units (two radii or so) per frame
+    std::vector<shared_ptr<sphere>> spheres;
+    std::vector<transform_track> tracks;
+    for (size_t i = 0; i < n; i++)
+    {
+        point3 c(random_double(-half_extent, half_extent), random_double(0, 2), random_double(-half_extent, half_extent));
+        spheres.push_back(make_shared<sphere>(c, random_double(0.05, 0.25), mat));
+        keyframe start, end;
+        end.time = frames;
+        end.position = random_double(0, 0.3) * frames * vec3(real(random_double(-1, 1)), 0, real(random_double(-1, 1)));
+        tracks.emplace_back(std::vector<keyframe>{start, end});
+    }
+    auto rays = make_ray_set(100000, half_extent);
+
+    for (double threshold : {0.0, 1.3, infinity})
+    {
+        animated_scene scene;
+        for (size_t i = 0; i < n; i++)
+            scene.add(spheres[i], tracks[i]);
+        scene.options.rebuild_threshold = threshold;
+        scene.options.compare_rebuild = threshold == 1.3;
+
+        std::clog << (threshold == 0 ? "rebuild every frame" : threshold == 1.3 ? "refit, rebuild at 1.3x SAH" : "refit only") << "\n";
+        double update_ms = 0, trace_s = 0;
+        for (int frame = 0; frame <= frames; frame++)
+        {
+            frame_update update = scene.set_time(frame);
+            update_ms += update.move_ms + update.refit_ms + (update.rebuilt ? update.rebuild_ms : 0);
+            double checksum;
+            double mrays = time_closest_hits(scene, rays, checksum);
+            trace_s += rays.size() / (mrays * 1e6);
+            if (scene.options.compare_rebuild && frame > 0 && (frame % 5 == 0 || update.rebuilt))
+                std::clog << "  frame " << std::setw(2) << frame << ": refit " << update.refit_ms << " ms, SAH cost "
+                          << update.refit_sah << (update.rebuilt ? " -> rebuilt " : ", a full build ")
+                          << update.rebuild_ms << " ms, SAH cost " << update.rebuild_sah << "\n";
+            if (frame == frames)
+                std::clog << "  last frame " << mrays << " Mrays/s, SAH cost " << scene.acceleration().sah_cost() << "\n";
+        }
+        std::clog << "  " << scene.rebuild_count() << " builds, BVH updates " << update_ms << " ms, tracing "
+                  << trace_s * 1e3 << " ms (" << frames + 1 << " frames of " << rays.size() << " rays)\n";
+    }
+}
+
+// scene file loading: a generated file of n spheres and triangles (half each, four materials) parsed
+// with 1, 2, 4... threads, in primitives and megabytes per second
+static void bench_scene_file()
+{
+    std::clog << "== scene-file: parallel scene parsing ==\n";
+
+    std::string path = (std::filesystem::temp_directory_path() / "rt_bench_scene.scene").string();
+    for (size_t n : {size_t(100000), size_t(1000000)})
+    {
+        seed_random(11);
+        {
+            std::ofstream out(path);
+            out << "camera lookfrom 13 2 3 lookat 0 0 0 vfov 20\n"
+                << "material m0 lambertian 0.5 0.5 0.5\nmaterial m1 lambertian 0.7 0.2 0.2\n"
+                << "material m2 metal 0.8 0.8 0.8 0.1\nmaterial m3 dielectric 1.5\n";
+            double half_extent = 0.5 * std::sqrt(double(n));
+            char line[256];
+            for (size_t i = 0; i < n; i++)
+            {
+                double x = random_double(-half_extent, half_extent), y = random_double(0, 2),
+                       z = random_double(-half_extent, half_extent);
+                int m = int(random_double() * 4);
+                if (i % 2 == 0)
+                    std::snprintf(line, sizeof(line), "sphere %.6g %.6g %.6g %.4g m%d\n", x, y, z, random_double(0.05, 0.25), m);
+                else
+                    std::snprintf(line, sizeof(line), "triangle %.6g %.6g %.6g %.6g %.6g %.6g %.6g %.6g %.6g m%d\n", x, y, z,
+                                  x + random_double(-0.3, 0.3), y + random_double(-0.3, 0.3), z + random_double(-0.3, 0.3),
+                                  x + random_double(-0.3, 0.3), y + random_double(-0.3, 0.3), z + random_double(-0.3, 0.3), m);
+                out << line;
+            }
+        }
+
+        std::clog << n << " primitives, " << std::filesystem::file_size(path) / double(1 << 20) << " MiB\n";
+        for (unsigned int threads : thread_counts())
+        {
+            thread_pool pool(threads);
+            scene_load_options options;
+            options.pool = threads > 1 ? &pool : nullptr;
+            scene_load_stats stats;
+            hittable_list world;
+            material_table materials;
+            load_scene(path, world, materials, options, &stats);
+            std::clog << "  threads " << threads << ": parse " << stats.parse_seconds * 1e3 << " ms ("
+                      << stats.primitives_per_second() / 1e6 << " M primitives/s, "
+                      << stats.file_bytes / stats.parse_seconds / double(1 << 20) << " MiB/s), whole load "
+                      << stats.seconds * 1e3 << " ms with the triangle mesh BVHs\n";
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// just enough JSON for the suite's results: nested objects and arrays of numbers and strings, indented
+// two spaces per level. keys are given for members of objects and left out for elements of arrays.
+class json_writer
+{
+public:
+    explicit json_writer(std::ostream &out) : out(out) {}
+
+    json_writer &begin_object(const char *key = nullptr) { return open(key, '{'); }
+    json_writer &end_object() { return close('}'); }
+    json_writer &begin_array(const char *key = nullptr) { return open(key, '['); }
+    json_writer &end_array() { return close(']'); }
+
+    template <typename T>
+    std::enable_if_t<std::is_arithmetic_v<T>, json_writer &> value(const char *key, T v)
+    {
+        element(key);
+        if constexpr (std::is_integral_v<T>)
+            out << v;
+        else if (std::isfinite(v))
+            out << std::setprecision(9) << double(v);
+        else
+            out << "null";
+        return *this;
+    }
+
+    json_writer &value(const char *key, const std::string &v)
+    {
+        element(key);
+        out << '"';
+        for (char c : v)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+            else
+                out << c;
+        }
+        out << '"';
+        return *this;
+    }
+
+private:
+    std::ostream &out;
+    std::vector<bool> empty; // per open level: nothing written into it yet
+
+    void element(const char *key)
+    {
+        if (!empty.empty())
+        {
+            if (!empty.back())
+                out << ',';
+            empty.back() = false;
+            out << '\n' << std::string(2 * empty.size(), ' ');
+        }
+        if (key)
+            out << '"' << key << "\": ";
+    }
+
+    json_writer &open(const char *key, char bracket)
+    {
+        element(key);
+        out << bracket;
+        empty.push_back(true);
+        return *this;
+    }
+
+    json_writer &close(char bracket)
+    {
+        bool nothing = empty.back();
+        empty.pop_back();
+        if (!nothing)
+            out << '\n' << std::string(2 * empty.size(), ' ');
+        out << bracket;
+        if (empty.empty())
+            out << '\n';
+        return *this;
+    }
+};
+
+// nanoseconds per call of hit(r) over the ray set, the best of 'sweeps' passes (the others had more
+// interference), and the share of rays that hit
+template <typename Hit>
+static double time_hit_calls(const std::vector<ray> &rays, int sweeps, Hit &&hit, double &hit_rate)
+{
+    double best = infinity;
+    size_t hits = 0;
+    for (int sweep = 0; sweep < sweeps; sweep++)
+    {
+        hits = 0;
+        auto start = bench_clock::now();
+        for (const ray &r : rays)
+            hits += hit(r) ? 1 : 0;
+        best = std::min(best, seconds_since(start));
+    }
+    hit_rate = double(hits) / rays.size();
+    return best * 1e9 / rays.size();
+}
+
+// rays from random points 4 to 6 units out, aimed at random points within 'spread' of the origin: a
+// primitive of about unit size there is hit by a fair share and missed by the rest
+static std::vector<ray> make_probe_rays(size_t count, double spread)
+{
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        point3 origin = random_double(4, 6) * random_unit_vector();
+        point3 target = random_double(0, spread) * random_unit_vector();
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+// the regression suite: fixed cost microbenchmarks of the hit functions, then for 10^3, 10^4 ...
+// max_primitives primitives (create_primitive_field, half spheres and half mesh triangles) the scene
+// generation time (the mesh's own BVH included), the top level BVH build times, closest hit
+// throughput on a fixed ray set and an end-to-end render (samples/s and rays/s, rays counting every
+// segment a path traced). everything is also written to json_path. the ray sets and scenes are
+// seeded, so two runs measure the same work.
+static void bench_suite(size_t max_primitives, const std::string &json_path)
+{
+    std::clog << "== suite: microbenchmarks and scaling curves, JSON to " << json_path << " ==\n";
+
+    std::ofstream file(json_path);
+    if (!file)
+        throw std::runtime_error(json_path + ": cannot write benchmark results");
+    json_writer json(file);
+    auto pool = thread_pool::global();
+
+    json.begin_object()
+        .value("format", 1)
+        .value("real", std::string(sizeof(real) == sizeof(float) ? "float" : "double"))
+#if defined(__VERSION__)
+        .value("compiler", std::string(__VERSION__))
+#endif
+#if defined(__AVX__)
+        .value("simd", std::string("avx"))
+#elif defined(__SSE2__) || defined(_M_X64)
+        .value("simd", std::string("sse2"))
+#else
+        .value("simd", std::string("none"))
+#endif
+        .value("threads", pool->size());
+
+    // one primitive of each kind on its own, the cost of a single hit call
+    seed_random(22);
+    const int sweeps = 5;
+    auto probes = make_probe_rays(1 << 16, 1.5);
+    const material *none = nullptr;
+    sphere ball(point3(0, 0, 0), 1, none);
+    triangle tri(point3(-1, -1, 0), point3(1, -1, 0), point3(0, 1, 0.5), none);
+    aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+
+    material_table materials;
+    hittable_list demo;
+    create_impressive_scene(demo, materials);
+    bvh_node tree(demo);
+    linear_bvh flat(demo);
+    auto scene_rays = make_ray_set(1 << 16, 11.0);
+
+    const interval all(ray_t_min, infinity);
+    json.begin_array("micro");
+    auto measure = [&](const char *name, const std::vector<ray> &rays, auto &&hit)
+    {
+        double hit_rate;
+        double ns = time_hit_calls(rays, sweeps, hit, hit_rate);
+        std::clog << name << std::string(18 - std::strlen(name), ' ') << ns << " ns/call, " << 100 * hit_rate
+                  << "% hit\n";
+        json.begin_object().value("name", std::string(name)).value("ns_per_call", ns).value("hit_rate", hit_rate)
+            .value("rays", rays.size()).end_object();
+    };
+    measure("sphere::hit", probes, [&](const ray &r)
+            { hit_record rec; return ball.hit(r, all, rec); });
+    measure("triangle::hit", probes, [&](const ray &r)
+            { hit_record rec; return tri.hit(r, all, rec); });
+    measure("aabb::hit", probes, [&](const ray &r)
+            { return box.hit(r, all); });
+    measure("bvh_node::hit", scene_rays, [&](const ray &r)
+            { hit_record rec; return tree.hit(r, all, rec); });
+    measure("linear_bvh::hit", scene_rays, [&](const ray &r)
+            { hit_record rec; return flat.hit(r, all, rec); });
+    json.end_array();
+
+    // scaling curves
+    json.begin_array("scaling");
+    for (size_t n = 1000; n <= max_primitives; n *= 10)
+    {
+        seed_random(22);
+        bvh_build_options options;
+        options.pool = pool.get();
+
+        auto start = bench_clock::now();
+        material_table field_materials;
+        hittable_list field;
+        create_primitive_field(field, field_materials, n, 0.5, options);
+        double scene_ms = seconds_since(start) * 1e3;
+
+        double extent = 0.5 * std::sqrt(double(n));
+        auto rays = make_ray_set(200000, extent);
+
+        json.begin_object().value("primitives", n).value("scene_ms", scene_ms);
+        json.begin_object("build");
+        double sah_ms = 0;
+        shared_ptr<linear_bvh> world;
+        for (auto method : {bvh_split_method::lbvh, bvh_split_method::sah})
+        {
+            options.split_method = method;
+            world = make_shared<linear_bvh>(field, options);
+            const auto &stats = world->stats();
+            const char *name = method == bvh_split_method::sah ? "sah" : "lbvh";
+            if (method == bvh_split_method::sah)
+                sah_ms = stats.build_ms;
+            json.begin_object(name).value("ms", stats.build_ms).value("nodes", stats.node_count)
+                .value("sah_cost", stats.sah_cost).end_object();
+        }
+        json.end_object();
+
+        // the top level is the SAH build from here on
+        double checksum;
+        double mrays = time_closest_hits(*world, rays, checksum);
+
+        camera cam;
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.image_width = 320;
+        cam.samples_per_pixel = 4;
+        cam.max_depth = 16;
+        cam.vfov = 40;
+        cam.lookfrom = point3(0, 3, extent + 4); // low over the edge of the field, looking across it
+        cam.lookat = point3(0, 0.5, 0);
+        cam.pool = pool;
+        cam.report_utilisation = false;
+        cam.output_format = image_format::pfm;
+        cam.output_path = (std::filesystem::temp_directory_path() / "rt_bench_suite.pfm").string();
+        cam.render(*world);
+        const path_stats &run = cam.last_render_stats();
+        std::remove(cam.output_path.c_str());
+
+        std::clog << n << " primitives: scene " << scene_ms << " ms, SAH build " << sah_ms << " ms, closest hit "
+                  << mrays << " Mrays/s, render " << run.samples / run.seconds / 1e6 << " Msamples/s, "
+                  << run.segments / run.seconds / 1e6 << " Mrays/s\n";
+        json.value("closest_hit_mrays_per_second", mrays)
+            .begin_object("render")
+            .value("width", cam.image_width)
+            .value("samples_per_pixel", cam.samples_per_pixel)
+            .value("seconds", run.seconds)
+            .value("samples_per_second", run.samples / run.seconds)
+            .value("rays_per_second", run.segments / run.seconds)
+            .value("rays_per_sample", run.average_length())
+            .end_object()
+            .end_object();
+    }
+    json.end_array().end_object();
+    std::clog << "results written to " << json_path << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    const char *section = argc > 1 ? argv[1] : "all";
+    bool all = std::strcmp(section, "all") == 0;
+
+    if (std::strcmp(section, "distributed-worker") == 0 && argc > 2)
+        return run_distributed_worker(argv[2]);
+
+    if (all || std::strcmp(section, "rng") == 0)
+        bench_rng();
+    if (all || std::strcmp(section, "bvh") == 0)
+        bench_bvh();
+    if (all || std::strcmp(section, "sah") == 0)
+        bench_sah();
+    if (all || std::strcmp(section, "build") == 0)
+        bench_build();
+    if (all || std::strcmp(section, "wide") == 0)
+        bench_wide();
+    if (all || std::strcmp(section, "mesh") == 0)
+        bench_mesh();
+    if (all || std::strcmp(section, "snapshot") == 0)
+        bench_snapshot();
+    if (all || std::strcmp(section, "integrator") == 0)
+        bench_integrator();
+    if (all || std::strcmp(section, "packet") == 0)
+        bench_packet();
+    if (all || std::strcmp(section, "wavefront") == 0)
+        bench_wavefront();
+    if (all || std::strcmp(section, "precision") == 0)
+        bench_precision();
+    if (all || std::strcmp(section, "leaf") == 0)
+        bench_leaf();
+    if (all || std::strcmp(section, "image") == 0)
+        bench_image();
+    if (all || std::strcmp(section, "progressive") == 0)
+        bench_progressive();
+    if (all || std::strcmp(section, "adaptive") == 0)
+        bench_adaptive();
+    if (all || std::strcmp(section, "denoise") == 0)
+        bench_denoise();
+    if (all || std::strcmp(section, "lights") == 0)
+        bench_lights();
+    if (all || std::strcmp(section, "instancing") == 0)
+        bench_instancing();
+    if (all || std::strcmp(section, "distributed") == 0)
+        bench_distributed();
+    if (all || std::strcmp(section, "animation") == 0)
+        bench_animation();
+    if (all || std::strcmp(section, "scene-file") == 0)
+        bench_scene_file();
+    if (all || std::strcmp(section, "suite") == 0)
+    {
+        size_t max_primitives = !all && argc > 2 ? size_t(std::atof(argv[2])) : 1000000;
+        bench_suite(max_primitives, !all && argc > 3 ? argv[3] : "benchmark.json");
+    }
+
+    return 0;
+}
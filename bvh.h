@@ -6,6 +6,7 @@
 #include "aabb.h"
 #include "triangle.h"
 #include "sphere.h"
+#include "trace_stats.h"
 #include <algorithm>
 #include <memory>
 
@@ -44,13 +45,17 @@ public:
         {
             // then we have more than 2 objects - split and recurse
 
-            // sort objects along the chosen axis
-            std::sort(objects.begin() + start, objects.begin() + end,
-                      [axis](const shared_ptr<hittable> &a, const shared_ptr<hittable> &b)
-                      {
-                          return get_bounding_box_static(a).axis_interval(axis).min <
-                                 get_bounding_box_static(b).axis_interval(axis).min;
-                      });
+            // sort objects along the chosen axis. the keys are looked up once up front, not twice per
+            // comparison inside the sort
+            std::vector<std::pair<double, shared_ptr<hittable>>> keyed;
+            keyed.reserve(object_span);
+            for (size_t i = start; i < end; i++)
+                keyed.emplace_back(get_bounding_box_static(objects[i]).axis_interval(axis).min, objects[i]);
+
+            std::sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b)
+                      { return a.first < b.first; });
+            for (size_t i = start; i < end; i++)
+                objects[i] = std::move(keyed[i - start].second);
 
             // split in the middle
             auto mid = start + object_span / 2;
@@ -62,12 +67,15 @@ public:
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
         // we will early exit if ray doesn't hit bounding box for optimization's sake
+        RT_STAT(nodes_visited);
+        RT_STAT(box_tests);
         if (!bbox.hit(r, ray_t))
             return false;
 
         // Test both children
         bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        // single object leaves point both children at the same object, don't test it twice
+        bool hit_right = (right != left) && right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
 
         return hit_left || hit_right;
     }
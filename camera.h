@@ -3,11 +3,55 @@
 
 #include "hittable.h"
 #include "rtweekend.h"
+#include "denoiser.h"
+#include "image_writer.h"
+#include "lights.h"
 #include "material.h"
+#include "progressive.h"
+#include "ray_packet.h"
+#include "trace_stats.h"
+#include "thread_pool.h"
+#include "wavefront.h"
+#include <algorithm>
+#include <chrono>
 #include <thread>
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(material::max_kinds <= trace_counters::material_kinds, "trace_counters::hits is indexed by material::kind()");
+
+// how camera rays are turned into colors
+enum class integrator_type
+{
+    recursive, // ray_color calls itself once per bounce until max_depth
+    iterative, // one loop carrying the path throughput, with Russian roulette after rr_min_depth bounces
+    wavefront  // the iterative estimate, breadth first: batches of paths bounce together in stages
+               // (multithreaded renders only, single threaded ones run it as iterative)
+};
+
+// how paths find the scene's emitters (camera::lights)
+enum class light_sampling
+{
+    off,        // only by bouncing into them
+    next_event, // a shadow ray to a random point on a light at every diffuse bounce, bounces into lights add nothing
+    mis         // both, weighted by the power heuristic (multiple importance sampling)
+};
+
+// what the last render() traced. a segment is one ray cast into the scene (shadow rays included), so
+// segments / samples is the average path length.
+struct path_stats
+{
+    uint64_t samples = 0;
+    uint64_t segments = 0;
+    double seconds = 0.0;
+
+    double average_length() const { return samples ? double(segments) / samples : 0.0; }
+    double nanoseconds_per_sample() const { return samples ? 1e9 * seconds / samples : 0.0; }
+};
 
 class camera
 {
@@ -19,6 +63,32 @@ public:
     int samples_per_pixel = 10;     // Count of random samples for each pixel
     int max_depth = 10;             // Maximum number of ray bounces into scene
     bool use_multithreading = true; // Enable/disable multithreading
+    uint64_t seed = 0;              // Base seed for the per-thread random generators
+    int tile_size = 16;             // Edge length in pixels of the square tiles handed to workers
+    unsigned int num_threads = 0;   // Worker threads, 0 = one per hardware thread
+    bool report_utilisation = true; // Print per-thread utilisation after a multithreaded render
+
+    integrator_type integrator = integrator_type::recursive;
+    int rr_min_depth = 3; // Bounces an iterative path always makes before Russian roulette may end it
+
+    // camera rays of 2x2 (4), 4x2 (8) or 4x4 (16) neighbouring pixels are traced as one packet when the
+    // world is a linear_bvh and the render is multithreaded. 1 traces every ray on its own.
+    int packet_size = 1;
+
+    size_t wavefront_batch = size_t(1) << 18; // Paths in flight at once in wavefront mode
+
+    // emitters the integrators sample directly, usually light_list::collect(world). with none (or
+    // light_sampling::off) every path is traced exactly as without light sampling.
+    light_list lights;
+    light_sampling direct_light = light_sampling::mis;
+    double sky_brightness = 1.0; // Scale of the sky gradient, 0 for scenes lit only by their emitters
+
+    image_format output_format = image_format::p3; // Encoding of the finished image
+    std::string output_path;                       // File the image goes to, stdout when empty
+
+    // worker pool, kept alive across render() calls. left empty it is created on first use (the shared
+    // global pool when num_threads is 0); set it to share one pool with other work such as BVH builds.
+    shared_ptr<thread_pool> pool;
 
     double vfov = 90; // vertical fov
 
@@ -29,16 +99,156 @@ public:
     double defocus_angle = 0; // Variation angle of rays through each pixel
     double focus_dist = 10;   // Distance from camera lookfrom point to plane of perfect focus
 
+    // progressive rendering: the samples go into a linear accumulation buffer in passes of
+    // pass_samples per pixel, until samples_per_pixel are in or time_budget runs out. the generators
+    // carry over between passes, so the image is the same however the samples are cut into passes,
+    // and the same as after a resume from a checkpoint. (wavefront renders run in one pass.)
+    int pass_samples = 0;            // Samples per pixel per pass, 0 = all of them in one pass
+    double time_budget = 0;          // Seconds, no pass starts that is expected to end after it. 0 = no limit
+    double preview_interval = 0;     // Seconds between intermediate images written to output_path. 0 = none
+    std::string checkpoint_path;     // The accumulation buffer is saved here during and after the render
+    double checkpoint_interval = 60; // Seconds between checkpoint saves while rendering
+    bool resume = false;             // Start from the checkpoint at checkpoint_path instead of from nothing
+
+    // adaptive sampling: after adaptive_min_samples, a pass only samples the pixels whose estimated
+    // error (accumulation_buffer::display_error) is still above adaptive_threshold, and
+    // samples_per_pixel becomes the per pixel cap. passes are pass_samples, or adaptive_min_samples
+    // when that is 0.
+    double adaptive_threshold = 0;    // Standard error of a pixel's displayed luminance, 0 = off
+    int adaptive_min_samples = 16;    // Samples every pixel gets before its error is trusted
+    std::string sample_map_path;      // Heat map of the samples each pixel got, format from the extension
+
+    // traversal statistics (trace_stats.h), only in builds with -DRT_STATS: render() prints them when it
+    // is done, and cost_map_path gets a heat map of the box and primitive tests every pixel's samples made
+    std::string cost_map_path;
+
+    // first hit albedo, normal and depth of every pixel, for the denoiser or written out as PFM files.
+    // they come from feature_samples extra camera rays per pixel with generators of their own, so
+    // asking for them does not change the rendered samples.
+    int feature_samples = 8;
+    std::string feature_prefix; // Writes <prefix>_albedo.pfm, <prefix>_normal.pfm and <prefix>_depth.pfm
+    bool use_denoiser = false;  // Run the à-trous denoiser (denoiser.h) on the finished image
+    denoise_options denoiser;   // Its settings, the pool is filled in by render()
+
     void render(const hittable &world)
     {
+        stats = path_stats();
+        auto start_time = std::chrono::steady_clock::now();
+
+        initialize();
         if (use_multithreading)
         {
-            render_multithreaded(world);
+            prepare_workers(world);
+            pool->reset_stats();
         }
+        if (trace_stats_enabled)
+            reset_trace_counters();
+        pixel_cost.clear();
+        if (trace_stats_enabled && !cost_map_path.empty())
+            pixel_cost.assign(size_t(image_width) * image_height, 0);
+
+        uint64_t samples;
+        if (use_multithreading && integrator == integrator_type::wavefront)
+            samples = render_wavefront_image(world);
         else
+            samples = render_progressive(world);
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        stats.samples = samples;
+        if (use_multithreading && report_utilisation)
+            pool->print_utilisation(std::clog, stats.seconds, integrator == integrator_type::wavefront ? "chunks" : "tiles");
+        if (trace_stats_enabled)
         {
-            render_single_threaded(world);
+            trace = collect_trace_counters();
+            trace.print(std::clog);
         }
+        write_cost_map();
+        finish_image(world);
+    }
+
+    // distributed rendering (distributed.h). a worker calls begin_jobs once, then render_job for every
+    // job it is given: samples [sample_begin, sample_end) of the pixels in the region's rectangle. a
+    // pixel's generator for a job is seeded from the pixel and sample_begin (from the pixel alone when
+    // the job starts at sample 0, like a local render), so the merged image depends on how the frame was
+    // cut into jobs, but not on which worker rendered which job or how often a job had to be redone.
+    void begin_jobs(const hittable &world)
+    {
+        initialize();
+        if (use_multithreading)
+            prepare_workers(world);
+        accumulation.reset(image_width, image_height, seed);
+        accumulation.active.assign(accumulation.active.size(), 0);
+    }
+
+    // returns the segments traced
+    uint64_t render_job(const hittable &world, int sample_begin, int sample_end, accumulation_region &region)
+    {
+        for (int j = region.y0; j < region.y1; j++)
+            for (int i = region.x0; i < region.x1; i++)
+            {
+                size_t p = size_t(j) * image_width + i;
+                accumulation.sum[p] = color(0, 0, 0);
+                accumulation.count[p] = 0;
+                accumulation.moments[2 * p] = accumulation.moments[2 * p + 1] = 0;
+                accumulation.rng[p].reseed(sample_begin == 0 ? mix_seed(seed, p) : mix_seed(mix_seed(seed, p), uint64_t(sample_begin)));
+                accumulation.active[p] = 1;
+            }
+
+        std::atomic<uint64_t> segments{0};
+        quiet = true;
+        render_pass(world, sample_end - sample_begin, segments, {region.x0, region.y0, region.x1, region.y1});
+        quiet = false;
+
+        accumulation.extract(region);
+        for (int j = region.y0; j < region.y1; j++)
+            for (int i = region.x0; i < region.x1; i++)
+                accumulation.active[size_t(j) * image_width + i] = 0;
+        return segments;
+    }
+
+    // what the coordinator and its workers compare before working together, see fingerprint
+    uint64_t render_fingerprint(const hittable &world)
+    {
+        initialize();
+        return fingerprint(world);
+    }
+
+    // the image from samples rendered elsewhere: then the same as render() after its passes (feature
+    // buffers, denoiser, output). 'run' becomes last_render_stats().
+    void render_from(const hittable &world, const accumulation_buffer &samples, const path_stats &run)
+    {
+        initialize();
+        if (use_multithreading && (use_denoiser || !feature_prefix.empty()))
+            prepare_workers(world);
+        accumulation = samples;
+        accumulation.resolve(framebuffer);
+        stats = run;
+        finish_image(world);
+    }
+
+    const path_stats &last_render_stats() const { return stats; }
+
+    // what the last render() traced, all zero without -DRT_STATS
+    const trace_counters &last_trace_stats() const { return trace; }
+
+    // the linear colors of the last render, row by row from the top, image_width wide
+    const std::vector<color> &image() const { return framebuffer; }
+    int height() const { return image_height; }
+
+    // the first hit features of the last render, when it computed them
+    const feature_buffers &features() const { return feature_buffer; }
+
+    // encode the framebuffer in output_format and write it to output_path (or stdout) in one go
+    void write_output() const
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        if (output_path.empty())
+            write_image(std::cout, output_format, image_width, image_height, framebuffer.data());
+        else
+            write_image(output_path, output_format, image_width, image_height, framebuffer.data());
+        std::clog << "Image written in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count()
+                  << " ms" << std::endl;
     }
 
 private:
@@ -55,6 +265,84 @@ private:
     vec3 defocus_disk_u; // Defocus disk horizontal radius
     vec3 defocus_disk_v; // Defocus disk vertical radius
 
+    path_stats stats;                // filled in by render()
+    trace_counters trace;            // filled in by render() with RT_STATS
+    std::vector<uint64_t> pixel_cost; // per pixel traversal work, only while a cost map is being rendered
+    std::vector<color> framebuffer; // linear pixel colors, written out once the render is done
+    accumulation_buffer accumulation; // sample sums and generators of a progressive render
+    feature_buffers feature_buffer;   // first hit albedo, normal and depth, see render_features
+
+    std::unique_ptr<packet_tracer> packets; // set up by render_multithreaded when packets are in use
+
+    struct tile
+    {
+        int x0, y0, x1, y1; // pixel bounds, [x0,x1) x [y0,y1)
+    };
+
+    bool quiet = false; // no progress lines, set while rendering a distributed job
+
+    // box and primitive tests the calling thread made so far, 0 without RT_STATS
+    static uint64_t thread_cost()
+    {
+#ifdef RT_STATS
+        return thread_counters().cost();
+#else
+        return 0;
+#endif
+    }
+
+    // pixel_cost as a heat map, scaled to its 99th percentile so a few pixels that hit a pathological
+    // corner of the BVH do not leave everything else black
+    void write_cost_map() const
+    {
+        if (cost_map_path.empty())
+            return;
+        if (!trace_stats_enabled)
+        {
+            std::clog << "Cost map skipped, it needs a build with -DRT_STATS" << std::endl;
+            return;
+        }
+        if (use_multithreading && integrator == integrator_type::wavefront)
+        {
+            std::clog << "Cost map skipped, wavefront renders do not trace pixel by pixel" << std::endl;
+            return;
+        }
+
+        std::vector<uint64_t> sorted(pixel_cost);
+        size_t rank = sorted.size() * 99 / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        double scale = double(std::max<uint64_t>(1, sorted[rank]));
+
+        std::vector<color> heat(pixel_cost.size());
+        for (size_t p = 0; p < pixel_cost.size(); p++)
+            heat[p] = heat_color(std::min(1.0, pixel_cost[p] / scale));
+        write_image(cost_map_path, image_format_for_path(cost_map_path), image_width, image_height, heat.data());
+        std::clog << "Cost map written to " << cost_map_path << " (white = " << sorted[rank]
+                  << " tests per pixel or more)" << std::endl;
+    }
+
+    // everything after the samples are in: path statistics, feature buffers, denoiser, output
+    void finish_image(const hittable &world)
+    {
+        std::clog << "Average path length " << stats.average_length() << " rays, "
+                  << stats.nanoseconds_per_sample() << " ns per sample" << std::endl;
+
+        if (use_denoiser || !feature_prefix.empty())
+            render_features(world);
+        if (use_denoiser)
+        {
+            auto denoise_start = std::chrono::steady_clock::now();
+            denoise_options options = denoiser;
+            options.pool = use_multithreading ? pool.get() : nullptr;
+            framebuffer = denoise(image_width, image_height, framebuffer, feature_buffer, options);
+            std::clog << "Denoised in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoise_start).count()
+                      << " ms" << std::endl;
+        }
+
+        write_output();
+    }
+
     void initialize()
     {
         image_height = int(image_width / aspect_ratio);
@@ -93,108 +381,636 @@ private:
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
     }
-    // singl threaded
-    void render_single_threaded(const hittable &world)
+    // the worker pool and, when the world allows it, the packet tracer
+    void prepare_workers(const hittable &world)
     {
-        initialize();
+        if (!pool || (num_threads != 0 && pool->size() != num_threads))
+            pool = (num_threads == 0) ? thread_pool::global() : make_shared<thread_pool>(num_threads);
 
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
+        std::clog << "Using " << pool->size() << " threads for rendering" << std::endl;
 
-        for (int j = 0; j < image_height; j++)
+        packets.reset();
+        if (packet_size > 1)
         {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; i++)
+            auto bvh = dynamic_cast<const linear_bvh *>(&world);
+            if ((packet_size == 4 || packet_size == 8 || packet_size == 16) && bvh)
+                packets = std::make_unique<packet_tracer>(*bvh);
+            else
+                std::clog << "Packet size " << packet_size << " ignored, packets need a linear_bvh world and 4, 8 or 16 rays"
+                          << std::endl;
+        }
+    }
+
+    // passes into the accumulation buffer until samples_per_pixel are in or the time budget is spent.
+    // returns the samples traced by this call (a resumed render does not count the checkpoint's).
+    uint64_t render_progressive(const hittable &world)
+    {
+        uint64_t key = fingerprint(world);
+        if (resume && !checkpoint_path.empty())
+        {
+            accumulation.load(checkpoint_path, key);
+            if (accumulation.width != image_width || accumulation.height != image_height)
+                throw std::runtime_error(checkpoint_path + ": checkpoint is for a different image size");
+            std::clog << "Resuming from " << checkpoint_path << " at " << accumulation.samples << " samples per pixel"
+                      << std::endl;
+        }
+        else
+            accumulation.reset(image_width, image_height, seed);
+
+        const int first_samples = accumulation.samples;
+        const uint64_t first_total = accumulation.total_samples();
+        const bool adaptive = adaptive_threshold > 0;
+        const int per_pass = pass_samples > 0 ? pass_samples
+                             : adaptive      ? std::max(1, adaptive_min_samples)
+                                             : std::max(1, samples_per_pixel);
+        auto start_time = std::chrono::steady_clock::now();
+        auto since = [](std::chrono::steady_clock::time_point t)
+        { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count(); };
+        auto last_preview = start_time, last_checkpoint = start_time;
+        std::atomic<uint64_t> segments{0};
+
+        while (accumulation.samples < samples_per_pixel)
+        {
+            size_t active = accumulation.select(adaptive_min_samples, adaptive_threshold);
+            if (active == 0)
             {
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; sample++)
+                std::clog << "Every pixel below the error threshold at " << accumulation.samples
+                          << " samples per pixel" << std::endl;
+                break;
+            }
+
+            int count = std::min(per_pass, samples_per_pixel - accumulation.samples);
+            render_pass(world, count, segments, {0, 0, image_width, image_height});
+            accumulation.samples += count;
+
+            double elapsed = since(start_time);
+            bool last = accumulation.samples >= samples_per_pixel;
+            if (per_pass < samples_per_pixel)
+                std::clog << "\rPass done: " << accumulation.samples << "/" << samples_per_pixel
+                          << " samples per pixel after " << elapsed << " s, "
+                          << 100.0 * active / accumulation.count.size() << "% of pixels sampled" << std::endl;
+
+            // stop before a pass that would end past the budget, judging by the passes so far
+            if (!last && time_budget > 0)
+            {
+                double per_sample = elapsed / (accumulation.samples - first_samples);
+                int next = std::min(per_pass, samples_per_pixel - accumulation.samples);
+                if (elapsed + per_sample * next > time_budget)
                 {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+                    std::clog << "Time budget of " << time_budget << " s reached at " << accumulation.samples
+                              << " samples per pixel" << std::endl;
+                    break;
                 }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
             }
+            if (last)
+                break;
+
+            if (preview_interval > 0 && since(last_preview) >= preview_interval)
+            {
+                if (output_path.empty())
+                    std::clog << "Intermediate images need an output file, skipped" << std::endl;
+                else
+                {
+                    accumulation.resolve(framebuffer);
+                    write_output();
+                }
+                last_preview = std::chrono::steady_clock::now();
+            }
+            if (!checkpoint_path.empty() && since(last_checkpoint) >= checkpoint_interval)
+            {
+                accumulation.save(checkpoint_path, key);
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+        }
+
+        if (!checkpoint_path.empty())
+        {
+            accumulation.save(checkpoint_path, key);
+            std::clog << "Checkpoint saved to " << checkpoint_path << " (" << accumulation.samples
+                      << " samples per pixel)" << std::endl;
+        }
+
+        stats.segments = segments;
+        accumulation.resolve(framebuffer);
+
+        uint64_t total = accumulation.total_samples();
+        if (adaptive)
+        {
+            uint64_t cap = uint64_t(image_width) * image_height * samples_per_pixel;
+            std::clog << "Adaptive sampling: " << total << " samples, " << double(total) / accumulation.count.size()
+                      << " per pixel on average, " << 100.0 * (1.0 - double(total) / cap) << "% fewer than "
+                      << samples_per_pixel << " everywhere" << std::endl;
+        }
+        if (!sample_map_path.empty())
+        {
+            std::vector<color> heat;
+            accumulation.sample_map(heat);
+            write_image(sample_map_path, image_format_for_path(sample_map_path), image_width, image_height, heat.data());
+            std::clog << "Sample map written to " << sample_map_path << std::endl;
+        }
+        return total - first_total;
+    }
+
+    // count more samples for every active pixel of 'area', added to the accumulation buffer. single
+    // threaded it goes scanline by scanline; multithreaded the area is cut into small tiles, visited in
+    // Morton (Z-curve) order so consecutive tiles are close together on screen, and the tiles go through
+    // the persistent work-stealing pool. a thread that lands on cheap sky tiles just steals more tiles
+    // instead of idling like the old row bands did.
+    void render_pass(const hittable &world, int count, std::atomic<uint64_t> &segments, const tile &area)
+    {
+        if (!use_multithreading)
+        {
+            uint64_t pass_segments = 0;
+            for (int j = area.y0; j < area.y1; j++)
+            {
+                if (!quiet)
+                    std::clog << "\rScanlines remaining: " << (area.y1 - j) << ' ' << std::flush;
+                for (int i = area.x0; i < area.x1; i++)
+                    if (accumulation.active[size_t(j) * image_width + i])
+                        accumulate_pixel(i, j, count, world, pass_segments);
+            }
+            segments += pass_segments;
+            if (!quiet)
+                std::clog << "\rDone.                 \n";
+            return;
         }
 
+        auto tiles = make_tiles(area);
+
+        // progress tracking
+        std::atomic<int> completed_tiles{0};
+        std::mutex progress_mutex;
+        int total_tiles = int(tiles.size());
+
+        pool->parallel_for(tiles.size(), [&](size_t t, unsigned int)
+                           {
+                const tile &tl = tiles[t];
+                uint64_t tile_segments = 0;
+                if (packets)
+                    render_tile_packets(tl, count, world, tile_segments);
+                else
+                    for (int j = tl.y0; j < tl.y1; j++)
+                        for (int i = tl.x0; i < tl.x1; i++)
+                            if (accumulation.active[size_t(j) * image_width + i])
+                                accumulate_pixel(i, j, count, world, tile_segments);
+                segments += tile_segments;
+
+                // update progress
+                int completed = ++completed_tiles;
+                if (!quiet && (completed % 64 == 0 || completed == total_tiles))
+                {
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    std::clog << "\rTiles remaining: " << (total_tiles - completed) << "    " << std::flush;
+                } });
+
+        if (!quiet)
+            std::clog << "\rDone.                 \n";
+    }
+
+    // the whole image in wavefront mode, all samples at once straight into the framebuffer
+    uint64_t render_wavefront_image(const hittable &world)
+    {
+        if (pass_samples > 0 || time_budget > 0 || !checkpoint_path.empty())
+            std::clog << "Wavefront renders run in one pass, progressive options ignored" << std::endl;
+
+        framebuffer.assign(size_t(image_width) * image_height, color(0, 0, 0));
+        std::atomic<uint64_t> segments{0};
+        render_wavefront(world, framebuffer, segments);
+        stats.segments = segments;
         std::clog << "\rDone.                 \n";
+        return uint64_t(image_width) * image_height * samples_per_pixel;
     }
 
-    // first attempt at multithreading so it doesn take a million years to render
+    // the feature buffers: feature_samples jittered camera rays per pixel (depth of field included),
+    // averaged. the pixel's generator for them is derived from its index and a fixed stream, so they
+    // are the same for every render of the view and do not disturb the image's own generators.
+    void render_features(const hittable &world)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        size_t n = size_t(image_width) * image_height;
+        feature_buffer.albedo.assign(n, color(0, 0, 0));
+        feature_buffer.normal.assign(n, vec3(0, 0, 0));
+        feature_buffer.depth.assign(n, 0.0f);
+        const int count = std::max(1, feature_samples);
 
-    void render_multithreaded(const hittable &world)
+        auto row = [&](size_t j)
+        {
+            xoshiro256 &rng = thread_rng();
+            const xoshiro256 saved = rng;
+            for (int i = 0; i < image_width; i++)
+            {
+                size_t p = j * image_width + i;
+                rng.reseed(mix_seed(mix_seed(seed, p), 0xFEA7u));
+                color albedo(0, 0, 0);
+                vec3 normal(0, 0, 0);
+                double depth = 0;
+                int hits = 0;
+                for (int s = 0; s < count; s++)
+                {
+                    ray r = get_ray(i, int(j));
+                    hit_record rec;
+                    if (world.hit(r, interval(ray_t_min, infinity), rec))
+                    {
+                        albedo += rec.mat->surface_albedo();
+                        normal += rec.normal;
+                        depth += double(rec.t) * r.direction().length();
+                        hits++;
+                    }
+                    else
+                        albedo += background(r);
+                }
+                feature_buffer.albedo[p] = albedo / real(count);
+                feature_buffer.normal[p] = normal / real(count);
+                feature_buffer.depth[p] = hits ? float(depth / hits) : 0.0f;
+            }
+            rng = saved;
+        };
+        if (use_multithreading)
+            pool->parallel_for(size_t(image_height), [&](size_t j, unsigned int)
+                               { row(j); });
+        else
+            for (int j = 0; j < image_height; j++)
+                row(size_t(j));
+
+        // the denoiser judges color differences against the noise where the samples give an estimate
+        feature_buffer.variance.clear();
+        if (accumulation.count.size() == n && !(use_multithreading && integrator == integrator_type::wavefront))
+        {
+            feature_buffer.variance.resize(n);
+            for (size_t p = 0; p < n; p++)
+                feature_buffer.variance[p] = float(accumulation.mean_variance(p));
+        }
+
+        std::clog << "Feature buffers in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count()
+                  << " ms" << std::endl;
+
+        if (!feature_prefix.empty())
+        {
+            std::vector<color> depth(n);
+            for (size_t p = 0; p < n; p++)
+                depth[p] = color(feature_buffer.depth[p], feature_buffer.depth[p], feature_buffer.depth[p]);
+            write_image(feature_prefix + "_albedo.pfm", image_format::pfm, image_width, image_height,
+                        feature_buffer.albedo.data());
+            write_image(feature_prefix + "_normal.pfm", image_format::pfm, image_width, image_height,
+                        feature_buffer.normal.data());
+            write_image(feature_prefix + "_depth.pfm", image_format::pfm, image_width, image_height, depth.data());
+            std::clog << "Feature buffers written to " << feature_prefix << "_{albedo,normal,depth}.pfm" << std::endl;
+        }
+    }
+
+    // identifies what a checkpoint's samples were rendered with. a checkpoint only resumes a render
+    // of the same size, seed, integrator and view, of a scene with the same bounds.
+    uint64_t fingerprint(const hittable &world) const
     {
-        initialize();
+        uint64_t h = 0x9E3779B97F4A7C15ull;
+        auto add = [&](double value)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            h = mix_seed(h, bits);
+        };
+        for (double value : {double(image_width), double(image_height), double(max_depth), double(rr_min_depth),
+                             double(int(integrator)), vfov, defocus_angle, focus_dist, sky_brightness,
+                             double(sampling_lights() ? int(direct_light) : 0), double(lights.size())})
+            add(value);
+        h = mix_seed(h, seed);
+        for (const vec3 &v : {lookfrom, lookat, vup})
+            for (int a = 0; a < 3; a++)
+                add(v[a]);
+        aabb box = world.bounding_box();
+        for (int a = 0; a < 3; a++)
+        {
+            add(box.axis_interval(a).min);
+            add(box.axis_interval(a).max);
+        }
+        return h;
+    }
 
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
+    // spread the low 16 bits of v out to the even bit positions
+    static uint32_t part1by1(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
 
-        // create output buffer
-        std::vector<std::vector<color>> image_buffer(image_height, std::vector<color>(image_width));
+    // the area cut into tile_size squares
+    std::vector<tile> make_tiles(const tile &area) const
+    {
+        int ts = std::max(1, tile_size);
+        int tiles_x = (area.x1 - area.x0 + ts - 1) / ts;
+        int tiles_y = (area.y1 - area.y0 + ts - 1) / ts;
 
-        // progress tracking
-        std::atomic<int> completed_lines{0};
-        std::mutex progress_mutex;
+        std::vector<std::pair<uint32_t, tile>> keyed;
+        for (int ty = 0; ty < tiles_y; ty++)
+            for (int tx = 0; tx < tiles_x; tx++)
+            {
+                tile tl{area.x0 + tx * ts, area.y0 + ty * ts, std::min(area.x1, area.x0 + (tx + 1) * ts),
+                        std::min(area.y1, area.y0 + (ty + 1) * ts)};
+                keyed.push_back({part1by1(uint32_t(tx)) | (part1by1(uint32_t(ty)) << 1), tl});
+            }
+
+        std::sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b)
+                  { return a.first < b.first; });
 
-        // Number of threads (use hardware concurrency)
-        unsigned int num_threads = std::thread::hardware_concurrency();
-        if (num_threads == 0)
-            num_threads = 4; // fallback
+        std::vector<tile> tiles;
+        for (const auto &k : keyed)
+            tiles.push_back(k.second);
+        return tiles;
+    }
 
-        std::clog << "Using " << num_threads << " threads for rendering" << std::endl;
+    // count more samples of one pixel, added to its running sum. the pixel's generator is swapped into
+    // the thread's while it samples: it was seeded from the pixel index, so the image comes out the same
+    // no matter which thread renders which tile, how big the tiles are or how the samples are split
+    // into passes.
+    void accumulate_pixel(int i, int j, int count, const hittable &world, uint64_t &segments)
+    {
+        size_t index = size_t(j) * image_width + i;
+        xoshiro256 &rng = thread_rng();
+        rng = accumulation.rng[index];
 
-        // thread worker function
-        auto render_chunk = [&](int start_row, int end_row)
+        color pixel_color = accumulation.sum[index];
+        double y = accumulation.moments[2 * index], y2 = accumulation.moments[2 * index + 1];
+        uint64_t cost = thread_cost();
+        for (int sample = 0; sample < count; sample++)
         {
-            for (int j = start_row; j < end_row; j++)
+            ray r = get_ray(i, j);
+            color c = integrator != integrator_type::recursive ? trace_path(r, color(1, 1, 1), 0, world, segments)
+                                                               : ray_color(r, max_depth, world, segments);
+            pixel_color += c;
+            double l = luminance(c);
+            y += l;
+            y2 += l * l;
+        }
+        accumulation.sum[index] = pixel_color;
+        accumulation.rng[index] = rng;
+        accumulation.count[index] += uint32_t(count);
+        accumulation.moments[2 * index] = y;
+        accumulation.moments[2 * index + 1] = y2;
+        if (!pixel_cost.empty())
+            pixel_cost[index] += thread_cost() - cost;
+    }
+
+    void render_tile_packets(const tile &tl, int count, const hittable &world, uint64_t &segments)
+    {
+        if (packet_size == 4)
+            render_tile_packets<4, 2>(tl, count, world, segments);
+        else if (packet_size == 8)
+            render_tile_packets<8, 4>(tl, count, world, segments);
+        else
+            render_tile_packets<16, 4>(tl, count, world, segments);
+    }
+
+    // count more samples of the tile's pixels, in blocks of N pixels, W wide. every pixel keeps its own
+    // generator, taken from the accumulation buffer like accumulate_pixel does and swapped into the
+    // thread's generator whenever that pixel draws numbers, so the image is the same as with single
+    // rays. only the camera rays go through the packet, the bounces after the first hit are traced one
+    // path at a time.
+    template <int N, int W>
+    void render_tile_packets(const tile &tl, int count, const hittable &world, uint64_t &segments)
+    {
+        xoshiro256 &rng = thread_rng();
+        const xoshiro256 saved = rng;
+
+        for (int by = tl.y0; by < tl.y1; by += N / W)
+            for (int bx = tl.x0; bx < tl.x1; bx += W)
             {
-                for (int i = 0; i < image_width; i++)
+                xoshiro256 pixel_rng[N];
+                color sums[N];
+                double y[N], y2[N];
+                int px[N], py[N];
+                uint32_t active = 0;
+                int lanes = 0;
+                for (int k = 0; k < N; k++)
                 {
-                    color pixel_color(0, 0, 0);
-                    for (int sample = 0; sample < samples_per_pixel; sample++)
+                    px[k] = bx + k % W;
+                    py[k] = by + k / W;
+                    size_t index = size_t(py[k]) * image_width + px[k];
+                    if (px[k] < tl.x1 && py[k] < tl.y1 && accumulation.active[index]) // index only read in bounds
                     {
-                        ray r = get_ray(i, j);
-                        pixel_color += ray_color(r, max_depth, world);
+                        active |= 1u << k;
+                        lanes++;
+                        pixel_rng[k] = accumulation.rng[index];
+                        sums[k] = accumulation.sum[index];
+                        y[k] = accumulation.moments[2 * index];
+                        y2[k] = accumulation.moments[2 * index + 1];
                     }
-                    image_buffer[j][i] = pixel_samples_scale * pixel_color;
                 }
+                if (!active)
+                    continue;
 
-                // update progress
-                int completed = ++completed_lines;
-                if (completed % 10 == 0)
+                ray rays[N];
+                hit_record recs[N];
+                for (int sample = 0; sample < count; sample++)
                 {
-                    std::lock_guard<std::mutex> lock(progress_mutex);
-                    std::clog << "\rScanlines remaining: " << (image_height - completed) << ' ' << std::flush;
+                    for (int k = 0; k < N; k++)
+                        if (active & (1u << k))
+                        {
+                            rng = pixel_rng[k];
+                            rays[k] = get_ray(px[k], py[k]);
+                            pixel_rng[k] = rng;
+                        }
+
+                    uint64_t cost = thread_cost();
+                    uint32_t hits = packets->hit<N>(rays, active, interval(ray_t_min, infinity), recs);
+                    // the packet's traversal is shared, every pixel in it gets an even part
+                    uint64_t packet_cost = (thread_cost() - cost) / uint64_t(lanes);
+
+                    for (int k = 0; k < N; k++)
+                        if (active & (1u << k))
+                        {
+                            rng = pixel_rng[k];
+                            cost = thread_cost();
+                            color c = continue_path(rays[k], (hits >> k) & 1, recs[k], world, segments);
+                            if (!pixel_cost.empty())
+                                pixel_cost[size_t(py[k]) * image_width + px[k]] += packet_cost + thread_cost() - cost;
+                            pixel_rng[k] = rng;
+                            sums[k] += c;
+                            double l = luminance(c);
+                            y[k] += l;
+                            y2[k] += l * l;
+                        }
                 }
+
+                for (int k = 0; k < N; k++)
+                    if (active & (1u << k))
+                    {
+                        size_t index = size_t(py[k]) * image_width + px[k];
+                        accumulation.sum[index] = sums[k];
+                        accumulation.rng[index] = pixel_rng[k];
+                        accumulation.count[index] += uint32_t(count);
+                        accumulation.moments[2 * index] = y[k];
+                        accumulation.moments[2 * index + 1] = y2[k];
+                    }
             }
-        };
 
-        // launch threads
-        std::vector<std::thread> threads;
-        int rows_per_thread = image_height / num_threads;
+        rng = saved;
+    }
+
+    // wavefront mode. the image's paths (pixel by pixel, every sample of a pixel in a row) go through
+    // in batches of wavefront_batch. a path's generator is seeded from its pixel and sample, so the
+    // image does not depend on the thread count or batch size, though it is not the image the
+    // per-pixel integrators make, since those draw a pixel's samples from one stream.
+    void render_wavefront(const hittable &world, std::vector<color> &image_buffer, std::atomic<uint64_t> &segments)
+    {
+        using wavefront_detail::chunk_count;
+        using wavefront_detail::for_each_chunk;
+        thread_pool *workers = pool.get();
 
-        for (unsigned int t = 0; t < num_threads; t++)
+        const size_t spp = size_t(std::max(1, samples_per_pixel));
+        const size_t total = size_t(image_width) * image_height * spp;
+        const size_t batch = std::min(total, std::max<size_t>(1, wavefront_batch));
+
+        wavefront_paths paths;
+        paths.resize(batch);
+        std::vector<uint32_t> queue, sorted;
+        double stage_seconds[5] = {}; // generate, extend, sort, shade, compact
+        auto time_stage = [&](int stage, auto &&fn)
         {
-            int start_row = t * rows_per_thread;
-            int end_row = (t == num_threads - 1) ? image_height : (t + 1) * rows_per_thread;
-            threads.emplace_back(render_chunk, start_row, end_row);
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            stage_seconds[stage] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        for (size_t first = 0; first < total; first += batch)
+        {
+            const size_t n = std::min(batch, total - first);
+            const size_t chunks = chunk_count(workers, n);
+
+            // camera rays for the whole batch
+            time_stage(0, [&]()
+                       {
+                queue.resize(n);
+                for_each_chunk(workers, chunks, n, [&](size_t, size_t begin, size_t end)
+                               {
+                    xoshiro256 &rng = thread_rng();
+                    const xoshiro256 saved = rng;
+                    for (size_t p = begin; p < end; p++)
+                    {
+                        size_t id = first + p, pixel = id / spp;
+                        rng.reseed(mix_seed(mix_seed(seed, pixel), id % spp));
+                        ray r = get_ray(int(pixel % image_width), int(pixel / image_width));
+                        paths.rng[p] = rng;
+                        paths.origin[p] = r.origin();
+                        paths.direction[p] = r.direction();
+                        paths.throughput[p] = color(1, 1, 1);
+                        paths.radiance[p] = color(0, 0, 0);
+                        paths.pdf[p] = 0;
+                        paths.alive[p] = 1;
+                        queue[p] = uint32_t(p);
+                    }
+                    rng = saved; }); });
+
+            for (int depth = 0; depth < max_depth && !queue.empty(); depth++)
+            {
+                segments += queue.size();
+
+                time_stage(1, [&]()
+                           { for_each_chunk(workers, chunk_count(workers, queue.size()), queue.size(),
+                                            [&](size_t, size_t begin, size_t end)
+                                            {
+                    for (size_t q = begin; q < end; q++)
+                    {
+                        uint32_t p = queue[q];
+                        RT_STAT_RAY(depth);
+                        bool hit = world.hit(ray(paths.origin[p], paths.direction[p]), interval(ray_t_min, infinity),
+                                             paths.hit[p]);
+                        paths.kind[p] = uint8_t(hit ? 1 + paths.hit[p].mat->kind() : 0);
+                        if (hit)
+                            RT_STAT_HIT(paths.kind[p] - 1);
+                    } }); });
+
+                // misses first, then one run per material kind
+                time_stage(2, [&]()
+                           { wavefront_sort(workers, queue, sorted, material::max_kinds + 1, [&](uint32_t p)
+                                            { return paths.kind[p]; }); });
+
+                time_stage(3, [&]()
+                           { for_each_chunk(workers, chunk_count(workers, sorted.size()), sorted.size(),
+                                            [&](size_t, size_t begin, size_t end)
+                                            {
+                    xoshiro256 &rng = thread_rng();
+                    const xoshiro256 saved = rng;
+                    uint64_t shadow_rays = 0;
+                    for (size_t q = begin; q < end; q++)
+                        shade_wavefront(paths, sorted[q], depth, world, rng, shadow_rays);
+                    segments += shadow_rays;
+                    rng = saved; }); });
+
+                time_stage(4, [&]()
+                           { wavefront_compact(workers, sorted, queue, [&](uint32_t p)
+                                               { return paths.alive[p] != 0; }); });
+            }
+
+            // every pixel whose samples are in this batch adds them up, pixels do not share paths
+            size_t first_pixel = first / spp, last_pixel = (first + n - 1) / spp;
+            for_each_chunk(workers, chunk_count(workers, last_pixel - first_pixel + 1), last_pixel - first_pixel + 1,
+                           [&](size_t, size_t begin, size_t end)
+                           {
+                for (size_t pixel = first_pixel + begin; pixel < first_pixel + end; pixel++)
+                {
+                    size_t p0 = std::max(pixel * spp, first) - first;
+                    size_t p1 = std::min((pixel + 1) * spp, first + n) - first;
+                    color sum(0, 0, 0);
+                    for (size_t p = p0; p < p1; p++)
+                        sum += paths.radiance[p];
+                    image_buffer[pixel] += pixel_samples_scale * sum;
+                } });
+
+            std::clog << "\rPaths remaining: " << (total - first - n) << "    " << std::flush;
         }
 
-        // wait for all threads to complete
-        for (auto &thread : threads)
+        std::clog << "\nWavefront stages: generate " << stage_seconds[0] << " s, extend " << stage_seconds[1]
+                  << " s, sort " << stage_seconds[2] << " s, shade " << stage_seconds[3] << " s, compact "
+                  << stage_seconds[4] << " s" << std::endl;
+    }
+
+    // one bounce of one path, with the path's own generator swapped into the thread's. the shadow ray
+    // of light sampling is traced right here rather than in a stage of its own.
+    void shade_wavefront(wavefront_paths &paths, uint32_t p, int depth, const hittable &world, xoshiro256 &rng,
+                         uint64_t &segments) const
+    {
+        ray r(paths.origin[p], paths.direction[p]);
+        if (paths.kind[p] == 0)
         {
-            thread.join();
+            paths.radiance[p] += paths.throughput[p] * background(r);
+            paths.alive[p] = 0;
+            RT_STAT_END(escaped);
+            return;
         }
 
-        // then, output the image buffer
-        for (int j = 0; j < image_height; j++)
+        rng = paths.rng[p];
+        const hit_record &rec = paths.hit[p];
+        color throughput = paths.throughput[p];
+        paths.radiance[p] += throughput * hit_emission(r, rec, paths.pdf[p]);
+        if (depth + 1 < max_depth && samples_lights_at(rec))
+            paths.radiance[p] += throughput * sample_direct(r, rec, world, segments);
+
+        ray scattered;
+        color attenuation;
+        bool alive = rec.mat->scatter(r, rec, attenuation, scattered);
+        if (alive)
         {
-            for (int i = 0; i < image_width; i++)
-            {
-                write_color(std::cout, image_buffer[j][i]);
-            }
+            paths.pdf[p] = float(bounce_pdf(r, rec, scattered));
+            throughput = throughput * attenuation;
+            alive = survive_roulette(depth + 1, throughput);
+            if (!alive)
+                RT_STAT_END(roulette);
+            else if (depth + 1 >= max_depth)
+                RT_STAT_END(max_depth);
         }
+        else
+            RT_STAT_END(absorbed);
+        paths.rng[p] = rng;
 
-        std::clog << "\rDone.                 \n";
+        paths.alive[p] = alive && depth + 1 < max_depth;
+        paths.throughput[p] = throughput;
+        paths.origin[p] = scattered.origin();
+        paths.direction[p] = scattered.direction();
     }
 
     ray get_ray(int i, int j) const
@@ -224,26 +1040,214 @@ private:
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray &r, int depth, const hittable &world) const
+    // bsdf_pdf is the density of the bounce that produced r, 0 for camera rays and mirror-like bounces
+    // (see hit_emission)
+    color ray_color(const ray &r, int depth, const hittable &world, uint64_t &segments, double bsdf_pdf = 0) const
     {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
+        {
+            RT_STAT_END(max_depth);
             return color(0, 0, 0);
+        }
 
+        segments++;
+        RT_STAT_RAY(max_depth - depth);
         hit_record rec;
 
-        if (world.hit(r, interval(0.001, infinity), rec))
+        if (world.hit(r, interval(ray_t_min, infinity), rec))
         {
+            RT_STAT_HIT(rec.mat->kind());
+            // light from the surface itself and, with light sampling, straight from a light (only while
+            // the bounce that would find that light by itself is still within max_depth)
+            color emitted = hit_emission(r, rec, bsdf_pdf);
+            if (depth > 1 && samples_lights_at(rec))
+                emitted += sample_direct(r, rec, world, segments);
+
             ray scattered;
             color attenuation;
             if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, depth - 1, world);
+                return emitted + attenuation * ray_color(scattered, depth - 1, world, segments,
+                                                         bounce_pdf(r, rec, scattered));
+            RT_STAT_END(absorbed);
+            return emitted;
+        }
+
+        RT_STAT_END(escaped);
+        return background(r);
+    }
+
+    // same estimate as ray_color, but as a loop: the attenuations are multiplied into a running
+    // throughput instead of being applied on the way back up the call stack. depth is the number of
+    // bounces already made (with the given throughput) before r.
+    color trace_path(ray r, color throughput, int depth, const hittable &world, uint64_t &segments,
+                     double bsdf_pdf = 0) const
+    {
+        hit_record rec;
+        color radiance(0, 0, 0);
+
+        for (; depth < max_depth; depth++)
+        {
+            segments++;
+            RT_STAT_RAY(depth);
+            if (!world.hit(r, interval(ray_t_min, infinity), rec))
+            {
+                RT_STAT_END(escaped);
+                return radiance + throughput * background(r);
+            }
+            RT_STAT_HIT(rec.mat->kind());
+
+            radiance += throughput * hit_emission(r, rec, bsdf_pdf);
+            if (depth + 1 < max_depth && samples_lights_at(rec))
+                radiance += throughput * sample_direct(r, rec, world, segments);
+
+            ray scattered;
+            color attenuation;
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+            {
+                RT_STAT_END(absorbed);
+                return radiance;
+            }
+            bsdf_pdf = bounce_pdf(r, rec, scattered);
+            throughput = throughput * attenuation;
+            r = scattered;
+
+            if (!survive_roulette(depth + 1, throughput))
+            {
+                RT_STAT_END(roulette);
+                return radiance;
+            }
+        }
+
+        RT_STAT_END(max_depth);
+        return radiance;
+    }
+
+    // once a path has made rr_min_depth bounces it survives each further bounce with probability p
+    // (its brightest throughput channel, capped at 0.95) and is scaled by 1/p when it does, so dark
+    // paths stop early and the expected value stays the same. max_depth still caps the length like
+    // the recursive integrator.
+    bool survive_roulette(int bounces, color &throughput) const
+    {
+        if (bounces < rr_min_depth)
+            return true;
+        double p = std::min(0.95, double(std::max(throughput.x(), std::max(throughput.y(), throughput.z()))));
+        if (random_double() >= p)
+            return false;
+        throughput /= real(p);
+        return true;
+    }
+
+    // the rest of a path whose camera ray r was already traced (by a packet), for either integrator.
+    // gives the same result as tracing r from scratch.
+    color continue_path(const ray &r, bool hit, const hit_record &rec, const hittable &world,
+                        uint64_t &segments) const
+    {
+        if (max_depth <= 0)
+        {
+            RT_STAT_END(max_depth);
             return color(0, 0, 0);
         }
 
+        segments++;
+        RT_STAT_RAY(0);
+        if (!hit)
+        {
+            RT_STAT_END(escaped);
+            return background(r);
+        }
+        RT_STAT_HIT(rec.mat->kind());
+
+        color emitted = rec.mat->emitted(r, rec);
+        if (max_depth > 1 && samples_lights_at(rec))
+            emitted += sample_direct(r, rec, world, segments);
+
+        ray scattered;
+        color attenuation;
+        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        {
+            RT_STAT_END(absorbed);
+            return emitted;
+        }
+        double pdf = bounce_pdf(r, rec, scattered);
+
+        if (integrator != integrator_type::recursive)
+        {
+            color throughput = attenuation;
+            if (!survive_roulette(1, throughput))
+            {
+                RT_STAT_END(roulette);
+                return emitted;
+            }
+            return emitted + trace_path(scattered, throughput, 1, world, segments, pdf);
+        }
+        return emitted + attenuation * ray_color(scattered, max_depth - 1, world, segments, pdf);
+    }
+
+    bool sampling_lights() const { return direct_light != light_sampling::off && !lights.empty(); }
+
+    // light sampling needs a density to weigh against, mirror-like materials only bounce
+    bool samples_lights_at(const hit_record &rec) const { return sampling_lights() && rec.mat->has_pdf(); }
+
+    // density of the bounce from r at rec into scattered, 0 when no light sampling would compete with it
+    double bounce_pdf(const ray &r, const hit_record &rec, const ray &scattered) const
+    {
+        return samples_lights_at(rec) ? rec.mat->scattering_pdf(r, rec, scattered.direction()) : 0.0;
+    }
+
+    // a / (a + b) on squared densities: the power heuristic
+    static double power_heuristic(double a, double b)
+    {
+        a *= a;
+        b *= b;
+        return a + b > 0 ? a / (a + b) : 0.0;
+    }
+
+    // emission of the surface r hit. when the bounce that made r (density bsdf_pdf) could also have been
+    // a light sample at the previous hit, that sample already counted part of this light: with mis the
+    // two share it by their densities, with next_event the light sample counted all of it.
+    color hit_emission(const ray &r, const hit_record &rec, double bsdf_pdf) const
+    {
+        color emitted = rec.mat->emitted(r, rec);
+        if (bsdf_pdf <= 0 || (emitted.x() == 0 && emitted.y() == 0 && emitted.z() == 0))
+            return emitted;
+        double light_pdf = lights.pdf(r, rec);
+        if (light_pdf <= 0) // an emitter light sampling does not know about
+            return emitted;
+        if (direct_light == light_sampling::next_event)
+            return color(0, 0, 0);
+        return real(power_heuristic(bsdf_pdf, light_pdf)) * emitted;
+    }
+
+    // next event estimation at a hit: a random point on a light, one shadow ray, and the light it sends
+    // through the surface towards r's origin
+    color sample_direct(const ray &r, const hit_record &rec, const hittable &world, uint64_t &segments) const
+    {
+        light_sample s;
+        if (!lights.sample(rec.p, s))
+            return color(0, 0, 0);
+        color f = rec.mat->evaluate(r, rec, s.direction);
+        if ((f.x() == 0 && f.y() == 0 && f.z() == 0) || (s.emission.x() == 0 && s.emission.y() == 0 && s.emission.z() == 0))
+            return color(0, 0, 0);
+
+        // anything between the surface and the light point blocks it, the light itself stops just short
+        segments++;
+        RT_STAT(shadow_rays);
+        hit_record blocker;
+        if (world.hit(ray(rec.p, s.direction), interval(ray_t_min, s.distance * (1 - 1e-3)), blocker))
+            return color(0, 0, 0);
+
+        double weight = direct_light == light_sampling::mis
+                            ? power_heuristic(s.pdf, rec.mat->scattering_pdf(r, rec, s.direction))
+                            : 1.0;
+        return real(weight / s.pdf) * f * s.emission;
+    }
+
+    color background(const ray &r) const
+    {
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5 * (unit_direction.y() + 1.0);
-        return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+        return real(sky_brightness) * ((1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0));
     }
 };
 
@@ -15,11 +15,17 @@ inline double linear_to_gamma(double linear_component)
 
     return 0;
 }
+// relative luminance (Rec. 709 weights) of a linear color
+inline double luminance(const color &c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 void write_color(std::ostream &out, const color &pixel_color)
 {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+    double r = pixel_color.x();
+    double g = pixel_color.y();
+    double b = pixel_color.z();
 
     // Apply gamma correction
     r = linear_to_gamma(r);
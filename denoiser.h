@@ -0,0 +1,258 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+// edge-avoiding à-trous wavelet denoiser (Dammertz et al. 2010) for a finished, noisy image. every
+// iteration is a 5x5 B3 spline blur whose taps are spread 1, 2, 4, 8... pixels apart, so a few
+// iterations cover a wide footprint for 25 taps each. a tap's weight falls off with how different
+// the neighbour is from the centre in color and in the first hit's albedo, normal and depth, so the
+// blur stays inside one surface and stops at silhouettes and material edges.
+//
+// with a variance buffer (the progressive renderer's per pixel sample moments) color differences are
+// judged against the centre's own noise, and the variance is filtered along with the color so later
+// iterations see how much noise is left (the SVGF variant, Schied et al. 2017).
+//
+// the filter runs on the image divided by the albedo (the light arriving at the surface), which is
+// smooth across a surface's color changes, and multiplies the albedo back in at the end.
+// rows go to the thread_pool and the taps run 8 pixels at a time with vfloat (SSE or AVX).
+
+#include "color.h"
+#include "simd_leaf.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+// first hit features of every pixel, averaged over a few camera rays (see camera::feature_samples)
+struct feature_buffers
+{
+    std::vector<color> albedo; // surface_albedo() of the material hit, the background color for misses
+    std::vector<vec3> normal;  // shading normal, zero for misses
+    std::vector<float> depth;  // distance along the camera ray, zero for misses
+    std::vector<float> variance; // variance of each pixel's mean luminance, may be left empty
+};
+
+struct denoise_options
+{
+    int iterations = 4;           // tap spacing doubles every iteration: 1, 2, 4, 8
+    float sigma_color = 4.0f;     // color difference a weight tolerates, in standard deviations of the centre's noise
+    float sigma_brightness = 0.6f; // the same without a variance buffer, relative to the centre's brightness and
+                                   // halved every iteration as the image gets smoother
+    float sigma_normal = 0.3f;    // normal difference (length of n_p - n_q)
+    float sigma_depth = 0.05f;    // depth difference, relative to the centre's depth and per pixel of tap distance
+    float sigma_albedo = 0.2f;    // albedo difference
+    thread_pool *pool = nullptr;
+};
+
+namespace denoise_detail
+{
+    constexpr int lanes = 8;
+    constexpr int pad = 48; // columns of edge copies left and right: the widest tap (2 * 16 at 5 iterations) plus a vector
+
+    // e^-x for x >= 0, close enough for a weight and much cheaper: 1 / (1 + x + x^2/2 + x^3/6)
+    template <typename V>
+    inline V weight_falloff(V x)
+    {
+        const V one = V::set1(1.0f);
+        return one / (one + x * (one + x * (V::set1(0.5f) + x * V::set1(1.0f / 6))));
+    }
+
+    // a float image with pad columns on both sides, rows stride apart
+    struct plane
+    {
+        int width = 0, height = 0, stride = 0;
+        std::vector<float> data;
+
+        void resize(int w, int h)
+        {
+            width = w;
+            height = h;
+            stride = w + 2 * pad;
+            data.assign(size_t(stride) * h, 0.0f);
+        }
+        float *row(int j) { return data.data() + size_t(j) * stride + pad; }
+        const float *row(int j) const { return data.data() + size_t(j) * stride + pad; }
+
+        // copy the first and last pixel of row j into its pad columns (clamp to edge)
+        void fill_pad(int j)
+        {
+            float *r = row(j);
+            for (int k = 1; k <= pad; k++)
+            {
+                r[-k] = r[0];
+                r[width - 1 + k] = r[width - 1];
+            }
+        }
+    };
+
+    template <typename F>
+    void for_rows(thread_pool *pool, int height, F &&fn)
+    {
+        if (!pool || pool->size() <= 1)
+        {
+            for (int j = 0; j < height; j++)
+                fn(j);
+            return;
+        }
+        pool->parallel_for(size_t(height), [&](size_t j, unsigned int)
+                           { fn(int(j)); });
+    }
+}
+
+// the denoised image. features must have one entry per pixel.
+inline std::vector<color> denoise(int width, int height, const std::vector<color> &image,
+                                  const feature_buffers &features, const denoise_options &options = {})
+{
+    using namespace denoise_detail;
+    using vf = vfloat<lanes>;
+    if (options.iterations > 5)
+        throw std::invalid_argument("denoise: at most 5 iterations, the row padding covers taps 32 pixels apart");
+    const float min_albedo = 0.02f;
+
+    // guide planes and the demodulated color, all float
+    const bool guided = !features.variance.empty();
+    plane albedo[3], normal[3], depth, inv_depth, color_in[3], color_out[3], variance_in, variance_out;
+    for (int c = 0; c < 3; c++)
+    {
+        albedo[c].resize(width, height);
+        normal[c].resize(width, height);
+        color_in[c].resize(width, height);
+        color_out[c].resize(width, height);
+    }
+    depth.resize(width, height);
+    inv_depth.resize(width, height);
+    if (guided)
+    {
+        variance_in.resize(width, height);
+        variance_out.resize(width, height);
+    }
+
+    for_rows(options.pool, height, [&](int j)
+             {
+        for (int i = 0; i < width; i++)
+        {
+            size_t p = size_t(j) * width + i;
+            float z = features.depth[p] > 0 ? features.depth[p] : 1e6f; // misses are far behind everything
+            depth.row(j)[i] = z;
+            inv_depth.row(j)[i] = 1.0f / z;
+            for (int c = 0; c < 3; c++)
+            {
+                float a = std::max(float(features.albedo[p][c]), min_albedo);
+                albedo[c].row(j)[i] = float(features.albedo[p][c]);
+                normal[c].row(j)[i] = float(features.normal[p][c]);
+                color_in[c].row(j)[i] = float(image[p][c]) / a;
+            }
+            if (guided)
+            {
+                // in the demodulated image the luminance is divided by (about) the albedo's luminance
+                float a = std::max(float(luminance(features.albedo[p])), min_albedo);
+                variance_in.row(j)[i] = features.variance[p] / (a * a);
+            }
+        }
+        if (guided)
+            variance_in.fill_pad(j);
+        for (int c = 0; c < 3; c++)
+        {
+            albedo[c].fill_pad(j);
+            normal[c].fill_pad(j);
+            color_in[c].fill_pad(j);
+        }
+        depth.fill_pad(j);
+        inv_depth.fill_pad(j); });
+
+    static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+    for (int iteration = 0; iteration < options.iterations; iteration++)
+    {
+        const int step = 1 << iteration;
+        const float sigma_c = guided ? options.sigma_color : options.sigma_brightness / float(1 << iteration);
+        const vf inv_color = vf::set1(1.0f / (sigma_c * sigma_c));
+        const vf inv_normal = vf::set1(1.0f / (options.sigma_normal * options.sigma_normal));
+        const vf inv_albedo = vf::set1(1.0f / (options.sigma_albedo * options.sigma_albedo));
+        const float sz = options.sigma_depth * step;
+        const vf inv_depth2 = vf::set1(1.0f / (sz * sz));
+        const vf bright_floor = vf::set1(0.01f), variance_floor = vf::set1(1e-5f);
+
+        for_rows(options.pool, height, [&](int j)
+                 {
+            // the pad holds at least one vector past the last pixel, so the last block may overhang
+            for (int x = 0; x < width; x += lanes)
+            {
+                vf cr = vf::loadu(color_in[0].row(j) + x), cg = vf::loadu(color_in[1].row(j) + x),
+                   cb = vf::loadu(color_in[2].row(j) + x);
+                vf nx = vf::loadu(normal[0].row(j) + x), ny = vf::loadu(normal[1].row(j) + x),
+                   nz = vf::loadu(normal[2].row(j) + x);
+                vf ar = vf::loadu(albedo[0].row(j) + x), ag = vf::loadu(albedo[1].row(j) + x),
+                   ab = vf::loadu(albedo[2].row(j) + x);
+                vf z = vf::loadu(depth.row(j) + x), iz = vf::loadu(inv_depth.row(j) + x);
+                // color differences are measured against the centre's noise: its variance when there is
+                // one (differences within the noise get blurred, bigger ones are edges), otherwise its
+                // brightness, so the same sigma fits dark and bright parts of the image
+                vf inv_c = guided ? inv_color / (vf::set1(3.0f) * (vf::loadu(variance_in.row(j) + x) + variance_floor))
+                                  : inv_color / (cr + cg + cb + bright_floor);
+
+                vf sum_r = vf::set1(0), sum_g = vf::set1(0), sum_b = vf::set1(0), sum_w = vf::set1(0);
+                vf sum_v = vf::set1(0);
+                for (int dy = -2; dy <= 2; dy++)
+                {
+                    int y = std::clamp(j + dy * step, 0, height - 1);
+                    const float *qr = color_in[0].row(y) + x, *qg = color_in[1].row(y) + x, *qb = color_in[2].row(y) + x;
+                    const float *qnx = normal[0].row(y) + x, *qny = normal[1].row(y) + x, *qnz = normal[2].row(y) + x;
+                    const float *qar = albedo[0].row(y) + x, *qag = albedo[1].row(y) + x, *qab = albedo[2].row(y) + x;
+                    const float *qz = depth.row(y) + x;
+                    const float *qv = guided ? variance_in.row(y) + x : nullptr;
+                    for (int dx = -2; dx <= 2; dx++)
+                    {
+                        int o = dx * step;
+                        vf r = vf::loadu(qr + o), g = vf::loadu(qg + o), b = vf::loadu(qb + o);
+                        vf d_r = r - cr, d_g = g - cg, d_b = b - cb;
+                        vf d_nx = vf::loadu(qnx + o) - nx, d_ny = vf::loadu(qny + o) - ny, d_nz = vf::loadu(qnz + o) - nz;
+                        vf d_ar = vf::loadu(qar + o) - ar, d_ag = vf::loadu(qag + o) - ag, d_ab = vf::loadu(qab + o) - ab;
+                        vf d_z = (vf::loadu(qz + o) - z) * iz;
+
+                        vf distance = (d_r * d_r + d_g * d_g + d_b * d_b) * inv_c +
+                                      (d_nx * d_nx + d_ny * d_ny + d_nz * d_nz) * inv_normal +
+                                      (d_ar * d_ar + d_ag * d_ag + d_ab * d_ab) * inv_albedo + d_z * d_z * inv_depth2;
+                        vf w = vf::set1(kernel[dy + 2] * kernel[dx + 2]) * weight_falloff(distance);
+                        sum_r = sum_r + w * r;
+                        sum_g = sum_g + w * g;
+                        sum_b = sum_b + w * b;
+                        sum_w = sum_w + w;
+                        if (guided)
+                            sum_v = sum_v + w * w * vf::loadu(qv + o);
+                    }
+                }
+                // sum_w includes the centre tap with weight (3/8)^2, never zero
+                (sum_r / sum_w).storeu(color_out[0].row(j) + x);
+                (sum_g / sum_w).storeu(color_out[1].row(j) + x);
+                (sum_b / sum_w).storeu(color_out[2].row(j) + x);
+                // the variance of a weighted mean, the next iteration judges against that
+                if (guided)
+                    (sum_v / (sum_w * sum_w)).storeu(variance_out.row(j) + x);
+            }
+            for (int c = 0; c < 3; c++)
+                color_out[c].fill_pad(j);
+            if (guided)
+                variance_out.fill_pad(j); });
+
+        for (int c = 0; c < 3; c++)
+            std::swap(color_in[c], color_out[c]);
+        std::swap(variance_in, variance_out);
+    }
+
+    // multiply the albedo back in
+    std::vector<color> result(image.size());
+    for_rows(options.pool, height, [&](int j)
+             {
+        for (int i = 0; i < width; i++)
+        {
+            size_t p = size_t(j) * width + i;
+            color out;
+            for (int c = 0; c < 3; c++)
+                out[c] = real(color_in[c].row(j)[i] * std::max(float(features.albedo[p][c]), min_albedo));
+            result[p] = out;
+        } });
+    return result;
+}
+
+#endif
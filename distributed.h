@@ -0,0 +1,730 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// distributed rendering over sockets. a coordinator cuts the frame into jobs (a tile and a range of
+// samples per pixel), hands them to worker processes that connected to it and adds the samples they
+// send back into one accumulation buffer. every worker builds the same scene with the same camera and
+// seed itself, only jobs and results go over the wire. a worker that disconnects (crashed, killed) or
+// takes longer than job_timeout for a job is dropped and its job goes back on the queue for the next
+// free worker. a job's samples only depend on the job (see camera::render_job), so the image does not
+// depend on which worker rendered what or on how many failed; with one job per tile covering all the
+// samples it is the same as a local render.
+//
+// addresses are "tcp:host:port" (or just "host:port") and "unix:/path/to/socket". a tcp port of 0
+// lets the system pick one, render_coordinator::address() tells which.
+//
+// messages are a message_header followed by its payload, in the machine's own byte order: the
+// coordinator checks the worker's hello (version, endianness, precision, camera fingerprint and scene)
+// and turns away workers that would render something else.
+//   hello   worker -> coordinator   hello_message
+//   job     coordinator -> worker   job_message
+//   result  worker -> coordinator   result_message, then double[3][n] sums, uint32_t[n] sample counts
+//                                   and double[2][n] luminance moments of the job's n pixels, row by row
+//   done    coordinator -> worker   no payload, the frame is finished
+//   reject  coordinator -> worker   the reason as text
+
+#include "camera.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "progressive.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t distributed_version = 1;
+constexpr uint32_t distributed_endian_tag = 0x01020304;
+
+struct distributed_options
+{
+    int tile_size = 64;      // Edge of the square tiles the jobs cover
+    int job_samples = 0;     // Samples per pixel per job, 0 = all of them (one job per tile)
+    double job_timeout = 0;  // Seconds a worker may spend on one job before it counts as dead, 0 = no limit
+    bool progress = true;    // Print jobs remaining and a line per worker at the end
+};
+
+struct distributed_stats
+{
+    size_t jobs = 0;           // the frame was cut into
+    size_t requeued = 0;       // jobs handed out again after their worker died or timed out
+    size_t workers = 0;        // that connected and were accepted
+    size_t rejected = 0;       // workers turned away (different scene, camera, build)
+    uint64_t segments = 0;     // traced by the workers, for path_stats
+    double seconds = 0;        // from the first job handed out to the last result in
+    double worker_seconds = 0; // the workers' own time on the jobs they finished
+};
+
+namespace distributed_detail
+{
+#ifdef _WIN32
+    using socket_handle = SOCKET;
+    const socket_handle no_socket = INVALID_SOCKET;
+    inline void close_socket(socket_handle s) { closesocket(s); }
+    inline int poll_sockets(pollfd *fds, size_t n, int timeout_ms) { return WSAPoll(fds, ULONG(n), timeout_ms); }
+    inline void startup()
+    {
+        struct winsock
+        {
+            winsock()
+            {
+                WSADATA data;
+                WSAStartup(MAKEWORD(2, 2), &data);
+            }
+            ~winsock() { WSACleanup(); }
+        };
+        static winsock instance;
+    }
+    constexpr int send_flags = 0;
+#else
+    using socket_handle = int;
+    constexpr socket_handle no_socket = -1;
+    inline void close_socket(socket_handle s) { ::close(s); }
+    inline int poll_sockets(pollfd *fds, size_t n, int timeout_ms) { return ::poll(fds, nfds_t(n), timeout_ms); }
+    inline void startup() {}
+#ifdef MSG_NOSIGNAL
+    constexpr int send_flags = MSG_NOSIGNAL; // a dead peer is an error return, not SIGPIPE
+#else
+    constexpr int send_flags = 0;
+#endif
+#endif
+
+    enum message_type : uint32_t
+    {
+        message_hello = 1,
+        message_job = 2,
+        message_result = 3,
+        message_done = 4,
+        message_reject = 5
+    };
+
+    struct message_header
+    {
+        uint32_t type;
+        uint32_t job;   // job index for job and result messages
+        uint64_t bytes; // of the payload that follows
+    };
+
+    struct hello_message
+    {
+        char magic[8];         // "RTWORK\0\0"
+        uint32_t version;      // distributed_version
+        uint32_t endian_tag;   // distributed_endian_tag as the worker sees it
+        uint32_t scalar_bytes; // sizeof(real)
+        uint32_t threads;      // the worker renders with
+        uint64_t fingerprint;  // camera::render_fingerprint
+        uint64_t scene;        // scene_key
+    };
+
+    struct job_message
+    {
+        int32_t x0, y0, x1, y1;
+        int32_t sample_begin, sample_end;
+    };
+
+    struct result_message
+    {
+        uint64_t segments;
+        double seconds; // the worker spent on the job
+    };
+
+    // a parsed address
+    struct endpoint
+    {
+        bool local = false; // unix domain socket at path
+        std::string host, port, path;
+    };
+
+    inline endpoint parse_address(const std::string &address)
+    {
+        endpoint e;
+        if (address.rfind("unix:", 0) == 0)
+        {
+            e.local = true;
+            e.path = address.substr(5);
+            if (e.path.empty())
+                throw std::runtime_error("address '" + address + "': unix socket path missing");
+#ifdef _WIN32
+            throw std::runtime_error("address '" + address + "': unix sockets need a POSIX system, use tcp:host:port");
+#endif
+            return e;
+        }
+        std::string rest = address.rfind("tcp:", 0) == 0 ? address.substr(4) : address;
+        size_t colon = rest.rfind(':');
+        if (colon == std::string::npos || colon + 1 == rest.size())
+            throw std::runtime_error("address '" + address + "': expected tcp:host:port or unix:/path");
+        e.host = rest.substr(0, colon);
+        e.port = rest.substr(colon + 1);
+        if (e.host.size() >= 2 && e.host.front() == '[' && e.host.back() == ']')
+            e.host = e.host.substr(1, e.host.size() - 2);
+        return e;
+    }
+
+    // a connected socket, closed with the object
+    class connection
+    {
+    public:
+        connection() = default;
+        explicit connection(socket_handle s) : s(s) {}
+        connection(const connection &) = delete;
+        connection &operator=(const connection &) = delete;
+        connection(connection &&other) noexcept : s(other.s) { other.s = no_socket; }
+        connection &operator=(connection &&other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                s = other.s;
+                other.s = no_socket;
+            }
+            return *this;
+        }
+        ~connection() { close(); }
+
+        bool is_open() const { return s != no_socket; }
+        socket_handle handle() const { return s; }
+
+        void close()
+        {
+            if (s != no_socket)
+                close_socket(s);
+            s = no_socket;
+        }
+
+        // false when the peer is gone
+        bool send_all(const void *data, size_t n)
+        {
+            const char *p = static_cast<const char *>(data);
+            while (n > 0)
+            {
+                auto sent = ::send(s, p, int(std::min<size_t>(n, 1 << 30)), send_flags);
+                if (sent <= 0)
+                    return false;
+                p += sent;
+                n -= size_t(sent);
+            }
+            return true;
+        }
+
+        // false when the peer closed the connection or the receive timed out
+        bool receive_all(void *data, size_t n)
+        {
+            char *p = static_cast<char *>(data);
+            while (n > 0)
+            {
+                auto got = ::recv(s, p, int(std::min<size_t>(n, 1 << 30)), 0);
+                if (got <= 0)
+                    return false;
+                p += got;
+                n -= size_t(got);
+            }
+            return true;
+        }
+
+        bool send_message(message_type type, uint32_t job, const void *payload, size_t bytes)
+        {
+            message_header header{type, job, bytes};
+            return send_all(&header, sizeof(header)) && (bytes == 0 || send_all(payload, bytes));
+        }
+
+        // payloads above max_bytes are a broken or hostile peer, not something to allocate
+        bool receive_message(message_header &header, std::vector<unsigned char> &payload, size_t max_bytes)
+        {
+            if (!receive_all(&header, sizeof(header)) || header.bytes > max_bytes)
+                return false;
+            payload.resize(size_t(header.bytes));
+            return header.bytes == 0 || receive_all(payload.data(), payload.size());
+        }
+
+        // blocking receives give up after this long, so a peer stuck half way through a message
+        // cannot hang the other side
+        void set_receive_timeout(double seconds)
+        {
+#ifdef _WIN32
+            DWORD ms = DWORD(seconds * 1000);
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&ms), sizeof(ms));
+#else
+            timeval tv{};
+            tv.tv_sec = time_t(seconds);
+            tv.tv_usec = suseconds_t((seconds - double(tv.tv_sec)) * 1e6);
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+        }
+
+        void set_options(bool tcp)
+        {
+            int one = 1;
+            if (tcp)
+                setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&one), sizeof(one));
+#if defined(SO_NOSIGPIPE)
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        }
+
+    private:
+        socket_handle s = no_socket;
+    };
+
+    inline connection connect_to(const endpoint &e)
+    {
+        startup();
+#ifndef _WIN32
+        if (e.local)
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (e.path.size() >= sizeof(addr.sun_path))
+                throw std::runtime_error(e.path + ": unix socket path too long");
+            std::memcpy(addr.sun_path, e.path.c_str(), e.path.size() + 1);
+            connection c(::socket(AF_UNIX, SOCK_STREAM, 0));
+            if (!c.is_open() || ::connect(c.handle(), reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+                return connection();
+            c.set_options(false);
+            return c;
+        }
+#endif
+        addrinfo hints{}, *found = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        std::string host = e.host.empty() ? "localhost" : e.host;
+        if (getaddrinfo(host.c_str(), e.port.c_str(), &hints, &found) != 0)
+            throw std::runtime_error(host + ":" + e.port + ": cannot resolve address");
+        connection c;
+        for (addrinfo *a = found; a && !c.is_open(); a = a->ai_next)
+        {
+            connection attempt(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            if (attempt.is_open() && ::connect(attempt.handle(), a->ai_addr, int(a->ai_addrlen)) == 0)
+                c = std::move(attempt);
+        }
+        freeaddrinfo(found);
+        if (c.is_open())
+            c.set_options(true);
+        return c;
+    }
+
+    // identifies the scene's geometry beyond the bounds camera::fingerprint already covers: the size and
+    // cost of its BVH, which two differently built scenes are unlikely to share
+    inline uint64_t scene_key(const hittable &world)
+    {
+        uint64_t h = 0x5CE7E5u;
+        if (auto bvh = dynamic_cast<const linear_bvh *>(&world))
+        {
+            double cost = bvh->stats().sah_cost;
+            uint64_t bits;
+            std::memcpy(&bits, &cost, sizeof(bits));
+            h = mix_seed(mix_seed(mix_seed(h, bvh->object_count()), bvh->acceleration().nodes.size()), bits);
+        }
+        return h;
+    }
+}
+
+class render_coordinator
+{
+public:
+    // listens on address right away, so workers may connect before render() is called
+    explicit render_coordinator(const std::string &address)
+    {
+        using namespace distributed_detail;
+        startup();
+        endpoint e = parse_address(address);
+        tcp = !e.local;
+#ifndef _WIN32
+        if (e.local)
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (e.path.size() >= sizeof(addr.sun_path))
+                throw std::runtime_error(e.path + ": unix socket path too long");
+            std::memcpy(addr.sun_path, e.path.c_str(), e.path.size() + 1);
+            ::unlink(e.path.c_str()); // a socket file left behind by an earlier coordinator
+            listener = connection(::socket(AF_UNIX, SOCK_STREAM, 0));
+            if (!listener.is_open() || ::bind(listener.handle(), reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+                ::listen(listener.handle(), 64) != 0)
+                throw std::runtime_error(address + ": cannot listen");
+            socket_path = e.path;
+            bound = "unix:" + e.path;
+            return;
+        }
+#endif
+        addrinfo hints{}, *found = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(e.host.empty() ? nullptr : e.host.c_str(), e.port.c_str(), &hints, &found) != 0)
+            throw std::runtime_error(address + ": cannot resolve address");
+        for (addrinfo *a = found; a && !listener.is_open(); a = a->ai_next)
+        {
+            connection attempt(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            int one = 1;
+            if (attempt.is_open())
+                setsockopt(attempt.handle(), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one));
+            if (attempt.is_open() && ::bind(attempt.handle(), a->ai_addr, int(a->ai_addrlen)) == 0 &&
+                ::listen(attempt.handle(), 64) == 0)
+                listener = std::move(attempt);
+        }
+        freeaddrinfo(found);
+        if (!listener.is_open())
+            throw std::runtime_error(address + ": cannot listen");
+
+        sockaddr_storage addr{};
+        socklen_t length = sizeof(addr);
+        getsockname(listener.handle(), reinterpret_cast<sockaddr *>(&addr), &length);
+        char port[16] = {};
+        getnameinfo(reinterpret_cast<sockaddr *>(&addr), length, nullptr, 0, port, sizeof(port), NI_NUMERICSERV);
+        std::string host = e.host.empty() ? "localhost" : e.host;
+        bound = "tcp:" + (host.find(':') != std::string::npos ? "[" + host + "]" : host) + ":" + port;
+    }
+
+    render_coordinator(const render_coordinator &) = delete;
+    render_coordinator &operator=(const render_coordinator &) = delete;
+
+    ~render_coordinator()
+    {
+        listener.close();
+#ifndef _WIN32
+        if (!socket_path.empty())
+            ::unlink(socket_path.c_str());
+#endif
+    }
+
+    // where workers connect, with the port the system picked for a tcp port of 0
+    const std::string &address() const { return bound; }
+
+    // the camera's frame rendered by the workers, all samples_per_pixel of every pixel. workers may
+    // connect at any time, render() waits for the first one. pass the result to camera::render_from.
+    accumulation_buffer render(camera &cam, const hittable &world, const distributed_options &options = {},
+                               distributed_stats *stats_out = nullptr)
+    {
+        using namespace distributed_detail;
+        using clock = std::chrono::steady_clock;
+
+        if (cam.pass_samples > 0 || cam.time_budget > 0 || !cam.checkpoint_path.empty() || cam.adaptive_threshold > 0)
+            std::clog << "Distributed renders run every job in one go, progressive options ignored" << std::endl;
+
+        const uint64_t fingerprint = cam.render_fingerprint(world);
+        const uint64_t scene = scene_key(world);
+        const int width = cam.image_width, height = cam.height(), spp = std::max(1, cam.samples_per_pixel);
+
+        // sample ranges outside, tiles inside: every tile gets its first samples before any gets more
+        std::vector<job_message> jobs;
+        const int ts = std::max(1, options.tile_size);
+        const int per_job = options.job_samples > 0 ? std::min(options.job_samples, spp) : spp;
+        for (int s = 0; s < spp; s += per_job)
+            for (int y = 0; y < height; y += ts)
+                for (int x = 0; x < width; x += ts)
+                    jobs.push_back({x, y, std::min(width, x + ts), std::min(height, y + ts), s, std::min(spp, s + per_job)});
+
+        accumulation_buffer result;
+        result.reset(width, height, cam.seed);
+        result.samples = spp;
+
+        distributed_stats stats;
+        stats.jobs = jobs.size();
+        std::deque<size_t> pending;
+        for (size_t i = 0; i < jobs.size(); i++)
+            pending.push_back(i);
+        std::vector<char> finished(jobs.size(), 0);
+        size_t remaining = jobs.size();
+
+        struct worker
+        {
+            connection link;
+            bool accepted = false; // sent a matching hello
+            long job = -1;         // the job it is rendering, -1 when idle
+            clock::time_point started;
+            size_t jobs_done = 0;
+            double busy = 0;
+            unsigned int threads = 0;
+        };
+        std::vector<worker> workers;
+        std::vector<unsigned char> payload;
+        std::vector<double> doubles;
+        bool started = false;
+        clock::time_point start_time = clock::now();
+
+        auto drop = [&](worker &w, const char *why)
+        {
+            if (w.job >= 0 && !finished[size_t(w.job)])
+            {
+                pending.push_front(size_t(w.job));
+                stats.requeued++;
+            }
+            if (options.progress && w.accepted)
+                std::clog << "\rWorker dropped (" << why << ")" << (w.job >= 0 ? ", its job is queued again" : "")
+                          << std::endl;
+            w.job = -1;
+            w.link.close();
+        };
+
+        auto hand_out = [&](worker &w)
+        {
+            if (pending.empty() || w.job >= 0)
+                return;
+            size_t j = pending.front();
+            pending.pop_front();
+            w.job = long(j);
+            w.started = clock::now();
+            if (!started)
+            {
+                started = true;
+                start_time = w.started;
+            }
+            if (!w.link.send_message(message_job, uint32_t(j), &jobs[j], sizeof(job_message)))
+                drop(w, "connection lost");
+        };
+
+        auto receive = [&](worker &w)
+        {
+            message_header header;
+            // the biggest message is a result of a whole tile
+            size_t max_bytes = sizeof(result_message) + size_t(ts) * ts * (6 * sizeof(double) + sizeof(uint32_t));
+            if (!w.link.receive_message(header, payload, std::max(max_bytes, sizeof(hello_message))))
+                return drop(w, "connection lost");
+
+            if (header.type == message_hello && !w.accepted)
+            {
+                hello_message hello;
+                std::string reason;
+                if (payload.size() != sizeof(hello))
+                    reason = "not a render worker";
+                else
+                {
+                    std::memcpy(&hello, payload.data(), sizeof(hello));
+                    if (std::memcmp(hello.magic, "RTWORK\0\0", 8) != 0)
+                        reason = "not a render worker";
+                    else if (hello.version != distributed_version)
+                        reason = "protocol version " + std::to_string(hello.version) + ", the coordinator speaks " +
+                                 std::to_string(distributed_version);
+                    else if (hello.endian_tag != distributed_endian_tag || hello.scalar_bytes != sizeof(real))
+                        reason = "a build with different endianness or precision";
+                    else if (hello.fingerprint != fingerprint || hello.scene != scene)
+                        reason = "a different scene, camera or integrator";
+                }
+                if (!reason.empty())
+                {
+                    std::clog << "\rWorker rejected: " << reason << std::endl;
+                    w.link.send_message(message_reject, 0, reason.data(), reason.size());
+                    stats.rejected++;
+                    w.link.close();
+                    return;
+                }
+                w.accepted = true;
+                w.threads = hello.threads;
+                stats.workers++;
+                return hand_out(w);
+            }
+
+            if (header.type != message_result || !w.accepted || w.job < 0 || header.job != uint32_t(w.job))
+                return drop(w, "unexpected message");
+
+            const job_message &job = jobs[size_t(w.job)];
+            accumulation_region region;
+            region.x0 = job.x0, region.y0 = job.y0, region.x1 = job.x1, region.y1 = job.y1;
+            const size_t n = region.size();
+            if (payload.size() != sizeof(result_message) + n * (5 * sizeof(double) + sizeof(uint32_t)))
+                return drop(w, "malformed result");
+
+            result_message summary;
+            const unsigned char *p = payload.data();
+            std::memcpy(&summary, p, sizeof(summary));
+            p += sizeof(summary);
+            doubles.resize(3 * n);
+            std::memcpy(doubles.data(), p, 3 * n * sizeof(double));
+            p += 3 * n * sizeof(double);
+            region.sum.resize(n);
+            for (size_t k = 0; k < n; k++)
+                region.sum[k] = color(real(doubles[3 * k]), real(doubles[3 * k + 1]), real(doubles[3 * k + 2]));
+            region.count.resize(n);
+            std::memcpy(region.count.data(), p, n * sizeof(uint32_t));
+            p += n * sizeof(uint32_t);
+            region.moments.resize(2 * n);
+            std::memcpy(region.moments.data(), p, 2 * n * sizeof(double));
+
+            // drop() closes the link, so a worker that timed out never delivers its job late and each
+            // job comes back at most once; the check only keeps a job from ever being counted twice
+            if (!finished[size_t(w.job)])
+            {
+                result.add(region);
+                finished[size_t(w.job)] = 1;
+                remaining--;
+                stats.segments += summary.segments;
+                stats.worker_seconds += summary.seconds;
+            }
+            w.jobs_done++;
+            w.busy += summary.seconds;
+            w.job = -1;
+            hand_out(w);
+        };
+
+        size_t shown = size_t(-1);
+        while (remaining > 0)
+        {
+            if (options.progress && remaining != shown)
+            {
+                std::clog << "\rJobs remaining: " << remaining << ", workers: " << stats.workers << "    " << std::flush;
+                shown = remaining;
+            }
+
+            std::vector<pollfd> fds(1 + workers.size());
+            fds[0] = {listener.handle(), POLLIN, 0};
+            for (size_t i = 0; i < workers.size(); i++)
+                fds[1 + i] = {workers[i].link.handle(), POLLIN, 0};
+            if (poll_sockets(fds.data(), fds.size(), 200) < 0)
+                continue; // interrupted by a signal
+
+            for (size_t i = 0; i < workers.size(); i++)
+                if (fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR))
+                    receive(workers[i]);
+
+            if (fds[0].revents & POLLIN)
+            {
+                connection link(::accept(listener.handle(), nullptr, nullptr));
+                if (link.is_open())
+                {
+                    link.set_options(tcp);
+                    link.set_receive_timeout(30);
+                    workers.push_back(worker());
+                    workers.back().link = std::move(link);
+                }
+            }
+
+            if (options.job_timeout > 0)
+                for (worker &w : workers)
+                    if (w.job >= 0 && std::chrono::duration<double>(clock::now() - w.started).count() > options.job_timeout)
+                        drop(w, "job timed out");
+
+            workers.erase(std::remove_if(workers.begin(), workers.end(), [](const worker &w)
+                                         { return !w.link.is_open(); }),
+                          workers.end());
+            for (worker &w : workers)
+                if (w.accepted)
+                    hand_out(w);
+        }
+        stats.seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+
+        for (worker &w : workers)
+            w.link.send_message(message_done, 0, nullptr, 0);
+
+        if (options.progress)
+        {
+            std::clog << "\rDone: " << stats.jobs << " jobs on " << stats.workers << " workers in " << stats.seconds
+                      << " s";
+            if (stats.requeued)
+                std::clog << ", " << stats.requeued << " handed out again";
+            std::clog << std::endl;
+            for (size_t i = 0; i < workers.size(); i++)
+                std::clog << "  worker " << i << ": " << workers[i].jobs_done << " jobs, " << workers[i].busy
+                          << " s busy, " << workers[i].threads << " threads" << std::endl;
+        }
+        if (stats_out)
+            *stats_out = stats;
+        return result;
+    }
+
+private:
+    distributed_detail::connection listener;
+    std::string bound, socket_path;
+    bool tcp = true;
+};
+
+// renders jobs for the coordinator at address until it says the frame is done. cam and world must be
+// set up exactly like the coordinator's. retries the connection for connect_timeout seconds, so workers
+// may start before the coordinator. throws when the coordinator turns the worker away.
+inline void run_render_worker(const std::string &address, camera &cam, const hittable &world,
+                              double connect_timeout = 10)
+{
+    using namespace distributed_detail;
+    endpoint e = parse_address(address);
+
+    connection link;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(connect_timeout);
+    while (!(link = connect_to(e)).is_open())
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error(address + ": cannot connect to the coordinator");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    hello_message hello{};
+    std::memcpy(hello.magic, "RTWORK\0\0", 8);
+    hello.version = distributed_version;
+    hello.endian_tag = distributed_endian_tag;
+    hello.scalar_bytes = sizeof(real);
+    hello.fingerprint = cam.render_fingerprint(world);
+    hello.scene = scene_key(world);
+    cam.begin_jobs(world);
+    hello.threads = cam.use_multithreading && cam.pool ? cam.pool->size() : 1;
+    if (!link.send_message(message_hello, 0, &hello, sizeof(hello)))
+        throw std::runtime_error(address + ": connection to the coordinator lost");
+
+    message_header header;
+    std::vector<unsigned char> payload, out;
+    accumulation_region region;
+    size_t jobs_done = 0;
+    for (;;)
+    {
+        if (!link.receive_message(header, payload, 1 << 16))
+            throw std::runtime_error(address + ": connection to the coordinator lost");
+        if (header.type == message_done)
+            break;
+        if (header.type == message_reject)
+            throw std::runtime_error("coordinator rejected this worker: " + std::string(payload.begin(), payload.end()));
+        if (header.type != message_job || payload.size() != sizeof(job_message))
+            throw std::runtime_error(address + ": unexpected message from the coordinator");
+
+        job_message job;
+        std::memcpy(&job, payload.data(), sizeof(job));
+        if (job.x0 < 0 || job.y0 < 0 || job.x1 > cam.image_width || job.y1 > cam.height() || job.x0 >= job.x1 ||
+            job.y0 >= job.y1 || job.sample_begin < 0 || job.sample_end <= job.sample_begin)
+            throw std::runtime_error(address + ": job outside the image");
+
+        auto start_time = std::chrono::steady_clock::now();
+        region.x0 = job.x0, region.y0 = job.y0, region.x1 = job.x1, region.y1 = job.y1;
+        result_message summary;
+        summary.segments = cam.render_job(world, job.sample_begin, job.sample_end, region);
+        summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        const size_t n = region.size();
+        out.resize(sizeof(summary) + n * (5 * sizeof(double) + sizeof(uint32_t)));
+        unsigned char *p = out.data();
+        std::memcpy(p, &summary, sizeof(summary));
+        p += sizeof(summary);
+        for (size_t k = 0; k < n; k++, p += 3 * sizeof(double))
+        {
+            double rgb[3] = {double(region.sum[k].x()), double(region.sum[k].y()), double(region.sum[k].z())};
+            std::memcpy(p, rgb, sizeof(rgb));
+        }
+        std::memcpy(p, region.count.data(), n * sizeof(uint32_t));
+        p += n * sizeof(uint32_t);
+        std::memcpy(p, region.moments.data(), 2 * n * sizeof(double));
+        if (!link.send_message(message_result, header.job, out.data(), out.size()))
+            throw std::runtime_error(address + ": connection to the coordinator lost");
+        jobs_done++;
+    }
+    std::clog << "Frame done, " << jobs_done << " jobs rendered" << std::endl;
+}
+
+#endif
@@ -11,8 +11,9 @@ class hit_record
 public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t;
+    const material *mat; // points into the scene's material_table, copying a hit never touches a refcount
+    real t;
+    real u, v; // surface coordinates, set by primitives that have them (meshes)
     bool front_face;
 
     void set_face_normal(const ray &r, const vec3 &outward_normal)
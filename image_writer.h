@@ -0,0 +1,319 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+// framebuffer output. the whole file is encoded into one memory buffer and handed to the stream with
+// a single write, instead of formatting every channel through std::ostream like write_color does.
+//   p3   ASCII PPM, byte for byte what write_color produces
+//   p6   binary PPM, same pixels in a third of the space
+//   pfm  float PFM, the linear colors before gamma and clamping (for HDR tools and image diffs)
+//   png  8 bit RGB PNG with stored (uncompressed) deflate blocks, so no zlib is needed
+// 8 bit formats get gamma and quantisation from a table instead of a sqrt per channel.
+
+#include "color.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class image_format
+{
+    p3,
+    p6,
+    pfm,
+    png
+};
+
+// format from a file name's extension (.ppm is written binary), p3 when there is none it knows
+inline image_format image_format_for_path(const std::string &path)
+{
+    auto ends_with = [&](const char *suffix)
+    {
+        size_t n = std::strlen(suffix);
+        return path.size() >= n && path.compare(path.size() - n, n, suffix) == 0;
+    };
+    if (ends_with(".png"))
+        return image_format::png;
+    if (ends_with(".pfm"))
+        return image_format::pfm;
+    if (ends_with(".ppm"))
+        return image_format::p6;
+    return image_format::p3;
+}
+
+// linear color channel to the byte write_color gives it: int(256 * clamp(sqrt(x), 0, 0.999)).
+// byte b covers linear values from (b/256)^2 up to ((b+1)/256)^2, so those 256 thresholds are the
+// whole mapping. a 65536 entry table over [0, 1) gives the byte at the start of each cell; byte ranges
+// are wider than a cell everywhere past byte 0, so at most one threshold falls inside a cell and one
+// comparison finishes the lookup, without a sqrt or a branch.
+class gamma_quantiser
+{
+public:
+    gamma_quantiser()
+    {
+        for (int b = 0; b < 256; b++)
+            threshold[b] = lowest_linear(b);
+        threshold[256] = 2.0; // never reached, values at or above threshold[255] return early
+
+        int b = 0;
+        for (int i = 0; i < cells; i++)
+        {
+            double x = double(i) / cells;
+            while (b < 255 && threshold[b + 1] <= x)
+                b++;
+            cell_byte[i] = uint8_t(b);
+        }
+    }
+
+    uint8_t operator()(double linear) const
+    {
+        if (!(linear > 0)) // also NaN
+            return 0;
+        if (linear >= threshold[255])
+            return 255;
+        int b = cell_byte[int(linear * cells)];
+        return uint8_t(b + (linear >= threshold[b + 1]));
+    }
+
+    static const gamma_quantiser &instance()
+    {
+        static const gamma_quantiser table;
+        return table;
+    }
+
+private:
+    static constexpr int cells = 65536;
+    double threshold[257];
+    uint8_t cell_byte[cells];
+
+    // smallest linear value that write_color turns into byte b, found by bisection on the same
+    // arithmetic so the two can never disagree
+    static double lowest_linear(int b)
+    {
+        if (b == 0)
+            return 0.0;
+        auto byte_of = [](double x)
+        { return int(256 * std::max(0.0, std::min(0.999, linear_to_gamma(x)))); };
+        double lo = 0.0, hi = 1.0;
+        for (int i = 0; i < 100; i++)
+        {
+            double mid = 0.5 * (lo + hi);
+            if (byte_of(mid) >= b)
+                hi = mid;
+            else
+                lo = mid;
+        }
+        return hi;
+    }
+};
+
+namespace image_detail
+{
+    inline void put_u32_be(std::string &out, uint32_t v)
+    {
+        out.push_back(char(v >> 24));
+        out.push_back(char(v >> 16));
+        out.push_back(char(v >> 8));
+        out.push_back(char(v));
+    }
+
+    inline uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0)
+    {
+        static const auto table = []()
+        {
+            std::vector<uint32_t> t(256);
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    inline uint32_t adler32(const unsigned char *data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            size_t n = std::min<size_t>(size, 5552); // the most bytes before the sums can overflow
+            for (size_t i = 0; i < n; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += n;
+            size -= n;
+        }
+        return (b << 16) | a;
+    }
+
+    inline void png_chunk(std::string &out, const char *type, const std::string &data)
+    {
+        put_u32_be(out, uint32_t(data.size()));
+        size_t start = out.size();
+        out.append(type, 4);
+        out += data;
+        put_u32_be(out, crc32(reinterpret_cast<const unsigned char *>(out.data() + start), out.size() - start));
+    }
+}
+
+// encode a framebuffer of linear colors, row by row from the top, into a complete file
+inline std::string encode_image(image_format format, int width, int height, const color *pixels)
+{
+    const gamma_quantiser &quantise = gamma_quantiser::instance();
+    const size_t count = size_t(width) * height;
+    std::string out;
+
+    switch (format)
+    {
+    case image_format::p3:
+    {
+        out = "P3\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+        size_t header = out.size();
+        out.resize(header + 12 * count); // "255 255 255\n" at most, trimmed below
+
+        // every byte value's decimal digits, so a channel is a copy instead of a formatted write
+        char digits[256][4];
+        for (int v = 0; v < 256; v++)
+            std::snprintf(digits[v], 4, "%d", v);
+
+        char *dst = &out[header];
+        for (size_t i = 0; i < count; i++)
+            for (int c = 0; c < 3; c++)
+            {
+                const char *d = digits[quantise(pixels[i][c])];
+                *dst++ = d[0];
+                if (d[1])
+                {
+                    *dst++ = d[1];
+                    if (d[2])
+                        *dst++ = d[2];
+                }
+                *dst++ = c < 2 ? ' ' : '\n';
+            }
+        out.resize(size_t(dst - out.data()));
+        break;
+    }
+    case image_format::p6:
+    {
+        out = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+        size_t header = out.size();
+        out.resize(header + 3 * count);
+        for (size_t i = 0; i < count; i++)
+            for (int c = 0; c < 3; c++)
+                out[header + 3 * i + c] = char(quantise(pixels[i][c]));
+        break;
+    }
+    case image_format::pfm:
+    {
+        // negative scale = little endian, rows go bottom to top
+        out = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+        size_t header = out.size();
+        out.resize(header + 12 * count);
+        char *dst = &out[header];
+        for (int j = height - 1; j >= 0; j--)
+            for (int i = 0; i < width; i++)
+                for (int c = 0; c < 3; c++)
+                {
+                    // little endian whatever the host is
+                    float value = float(pixels[size_t(j) * width + i][c]);
+                    uint32_t bits;
+                    std::memcpy(&bits, &value, 4);
+                    for (int k = 0; k < 4; k++)
+                        *dst++ = char((bits >> (8 * k)) & 0xff);
+                }
+        break;
+    }
+    case image_format::png:
+    {
+        using namespace image_detail;
+
+        // raw scanlines, each behind filter type 0 (none)
+        const size_t row_bytes = 1 + 3 * size_t(width);
+        std::string raw(row_bytes * height, '\0');
+        for (int j = 0; j < height; j++)
+        {
+            char *row = &raw[row_bytes * j];
+            for (int i = 0; i < width; i++)
+                for (int c = 0; c < 3; c++)
+                    row[1 + 3 * i + c] = char(quantise(pixels[size_t(j) * width + i][c]));
+        }
+
+        // zlib stream of stored deflate blocks: 2 byte header, blocks of at most 65535 bytes, adler32
+        std::string zlib = "\x78\x01";
+        zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        for (size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535)
+        {
+            size_t n = std::min<size_t>(65535, raw.size() - pos);
+            bool last = pos + n >= raw.size();
+            zlib.push_back(char(last ? 1 : 0));
+            zlib.push_back(char(n & 0xff));
+            zlib.push_back(char(n >> 8));
+            zlib.push_back(char(~n & 0xff));
+            zlib.push_back(char((~n >> 8) & 0xff));
+            zlib.append(raw, pos, n);
+            if (last)
+                break;
+        }
+        put_u32_be(zlib, adler32(reinterpret_cast<const unsigned char *>(raw.data()), raw.size()));
+
+        std::string ihdr;
+        put_u32_be(ihdr, uint32_t(width));
+        put_u32_be(ihdr, uint32_t(height));
+        ihdr += std::string("\x08\x02\x00\x00\x00", 5); // 8 bit, RGB, deflate, no filter method, no interlace
+
+        out = "\x89PNG\r\n\x1a\n";
+        png_chunk(out, "IHDR", ihdr);
+        png_chunk(out, "IDAT", zlib);
+        png_chunk(out, "IEND", "");
+        break;
+    }
+    }
+    return out;
+}
+
+// encode and write with one call. binary formats on stdout switch it to binary mode first on Windows,
+// where text mode would turn every 0x0a byte into 0x0d 0x0a.
+inline void write_image(std::ostream &out, image_format format, int width, int height, const color *pixels)
+{
+    std::string file = encode_image(format, width, height, pixels);
+#ifdef _WIN32
+    if (&out == &std::cout && format != image_format::p3)
+    {
+        std::cout.flush();
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+    out.write(file.data(), std::streamsize(file.size()));
+    out.flush();
+}
+
+inline void write_image(const std::string &path, image_format format, int width, int height, const color *pixels)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error(path + ": cannot open for writing");
+    write_image(file, format, width, height, pixels);
+    if (!file)
+        throw std::runtime_error(path + ": write failed");
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// geometry instancing. an instance is a shared bottom level structure (a triangle_mesh, or a linear_bvh
+// over any hittables) placed in the scene with an affine transform, so a thousand copies of a mesh
+// cost a thousand small instance objects instead of a thousand copies of its triangles and BVH.
+// instances are ordinary hittables: a linear_bvh over a hittable_list of them is the top level BVH,
+// and a ray that reaches one is taken into the object's space, traced through the shared BVH there
+// and the hit is brought back out.
+
+#include "hittable.h"
+#include "rtweekend.h"
+#include "aabb.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+// x -> linear * x + offset, kept together with its inverse. a transform that squashes space flat (a zero
+// scale, a zero rotation axis) has none and throws std::invalid_argument.
+class affine_transform
+{
+public:
+    affine_transform() : affine_transform(mat3{{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}}, vec3(0, 0, 0)) {}
+
+    static affine_transform translate(const vec3 &offset)
+    {
+        return affine_transform(mat3{{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}}, offset);
+    }
+
+    static affine_transform scale(double sx, double sy, double sz)
+    {
+        return affine_transform(mat3{{{sx, 0, 0}, {0, sy, 0}, {0, 0, sz}}}, vec3(0, 0, 0));
+    }
+
+    static affine_transform scale(double s) { return scale(s, s, s); }
+
+    // counterclockwise about 'axis' (looking down it towards the origin)
+    static affine_transform rotate(const vec3 &axis, double degrees)
+    {
+        vec3 a = unit_vector(axis);
+        double x = a.x(), y = a.y(), z = a.z();
+        double c = std::cos(degrees_to_radians(degrees)), s = std::sin(degrees_to_radians(degrees)), t = 1 - c;
+        return affine_transform(mat3{{{t * x * x + c, t * x * y - s * z, t * x * z + s * y},
+                                  {t * x * y + s * z, t * y * y + c, t * y * z - s * x},
+                                  {t * x * z - s * y, t * y * z + s * x, t * z * z + c}}},
+                                vec3(0, 0, 0));
+    }
+
+    // first 'second', then this
+    affine_transform operator*(const affine_transform &second) const
+    {
+        mat3 product{};
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 3; k++)
+                    product.m[i][j] += linear.m[i][k] * second.linear.m[k][j];
+        return affine_transform(product, apply(linear, second.offset) + offset);
+    }
+
+    point3 point(const point3 &p) const { return apply(linear, p) + offset; }
+    vec3 vector(const vec3 &v) const { return apply(linear, v); }
+    point3 inverse_point(const point3 &p) const { return apply(inverse, p - offset); }
+    vec3 inverse_vector(const vec3 &v) const { return apply(inverse, v); }
+
+    // normals go through the inverse transpose, so they stay perpendicular under non-uniform scale
+    vec3 normal(const vec3 &n) const
+    {
+        const auto &m = inverse.m;
+        return unit_vector(vec3(real(m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z()),
+                                real(m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z()),
+                                real(m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z())));
+    }
+
+    // smallest box around the transformed corners of 'box'
+    aabb bounds(const aabb &box) const
+    {
+        point3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            point3 p = point(point3(corner & 1 ? box.x.max : box.x.min, corner & 2 ? box.y.max : box.y.min,
+                                    corner & 4 ? box.z.max : box.z.min));
+            lo = point3(std::min(lo.x(), p.x()), std::min(lo.y(), p.y()), std::min(lo.z(), p.z()));
+            hi = point3(std::max(hi.x(), p.x()), std::max(hi.y(), p.y()), std::max(hi.z(), p.z()));
+        }
+        return aabb(lo, hi);
+    }
+
+private:
+    struct mat3
+    {
+        double m[3][3];
+    };
+
+    mat3 linear, inverse;
+    vec3 offset;
+
+    affine_transform(const mat3 &l, const vec3 &offset) : linear(l), offset(offset)
+    {
+        // adjugate over determinant
+        const auto &m = l.m;
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                     m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                     m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        if (!(det != 0) || !std::isfinite(det))
+            throw std::invalid_argument("singular transform (a zero scale or rotation axis)");
+        double inv = 1.0 / det;
+        auto &r = inverse.m;
+        r[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv;
+        r[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+        r[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+        r[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv;
+        r[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+        r[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+        r[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv;
+        r[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+        r[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+    }
+
+    static vec3 apply(const mat3 &t, const vec3 &v)
+    {
+        const auto &m = t.m;
+        return vec3(real(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z()),
+                    real(m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z()),
+                    real(m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z()));
+    }
+};
+
+class instance : public hittable
+{
+public:
+    // 'object' is shared between instances and has to be finished (meshes built) before this
+    instance(shared_ptr<const hittable> object, const affine_transform &to_world)
+        : object(std::move(object)), to_world(to_world), bbox(to_world.bounds(this->object->bounding_box())) {}
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        // the object space direction is not normalised, so t means the same on both sides
+        ray local(to_world.inverse_point(r.origin()), to_world.inverse_vector(r.direction()));
+        if (!object->hit(local, ray_t, rec))
+            return false;
+
+        // the normal was turned against the local ray, the transform keeps it turned against r
+        rec.p = r.at(rec.t);
+        rec.normal = to_world.normal(rec.normal);
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // move the instance (animation.h does between frames). not while rays are being traced through it.
+    void set_transform(const affine_transform &t)
+    {
+        to_world = t;
+        bbox = to_world.bounds(object->bounding_box());
+    }
+
+    const hittable &shared_object() const { return *object; }
+    const affine_transform &transform() const { return to_world; }
+
+private:
+    shared_ptr<const hittable> object;
+    affine_transform to_world;
+    aabb bbox;
+};
+
+#endif
@@ -1,36 +1,38 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 
+#include "real.h"
 #include <limits>
 
-class interval
+template <typename T>
+class interval_t
 {
 private:
-    static constexpr double infinity = std::numeric_limits<double>::infinity();
+    static constexpr T infinity = std::numeric_limits<T>::infinity();
 
 public:
-    double min, max;
+    T min, max;
 
-    interval() : min(+infinity), max(-infinity) {} // Default interval is empty
+    interval_t() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double min, double max) : min(min), max(max) {}
+    interval_t(T min, T max) : min(min), max(max) {}
 
-    double size() const
+    T size() const
     {
         return max - min;
     }
 
-    bool contains(double x) const
+    bool contains(T x) const
     {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const
+    bool surrounds(T x) const
     {
         return min < x && x < max;
     }
 
-    double clamp(double x) const
+    T clamp(T x) const
     {
         if (x < min)
             return min;
@@ -39,10 +41,14 @@ public:
         return x;
     }
 
-    static const interval empty, universe;
+    static const interval_t empty, universe;
 };
 
-const interval interval::empty = interval(+interval::infinity, -interval::infinity);
-const interval interval::universe = interval(-interval::infinity, +interval::infinity);
+template <typename T>
+const interval_t<T> interval_t<T>::empty = interval_t<T>(+interval_t<T>::infinity, -interval_t<T>::infinity);
+template <typename T>
+const interval_t<T> interval_t<T>::universe = interval_t<T>(-interval_t<T>::infinity, +interval_t<T>::infinity);
+
+using interval = interval_t<real>;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,261 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+// the scene's emitters, gathered from the world so the integrators can aim shadow rays at them (next
+// event estimation) instead of waiting for a random bounce to find a small light.
+//
+// a light is picked with probability proportional to its power (area times mean emitted radiance)
+// and a point on it uniformly by area. every light with the same material then has the same density
+// per unit area, power(material) / total power, so pdf() only needs the material of a hit, not which
+// primitive it was. spheres are sampled over their whole surface, the half facing away from the
+// shading point just gives samples that carry nothing.
+//
+// the density per material only holds if every emitter with that material is in the list, otherwise
+// one the list cannot pick would still get a light pdf and lose its share of the MIS weight. so the
+// gatherer follows instances into their shared objects, and a material on an emitter it cannot sample
+// (a sphere under a non-uniform scale is an ellipsoid) is left out of the list altogether: its
+// emission is then only found by bounces, everywhere.
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// one shadow ray's worth of light: where it comes from and what it carries
+struct light_sample
+{
+    vec3 direction;   // unit vector from the shading point to the light
+    double distance;  // to the sampled point
+    double pdf;       // of direction, per solid angle
+    color emission;   // emitted radiance towards the shading point
+};
+
+class light_list
+{
+public:
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    void add_sphere(const point3 &center, double radius, const material *mat)
+    {
+        add({shape_sphere, center, vec3(radius, 0, 0), vec3(0, 0, 0), 4 * pi * radius * radius, mat});
+    }
+
+    void add_triangle(const point3 &v0, const point3 &v1, const point3 &v2, const material *mat)
+    {
+        vec3 edge1 = v1 - v0, edge2 = v2 - v0;
+        add({shape_triangle, v0, edge1, edge2, 0.5 * double(cross(edge1, edge2).length()), mat});
+    }
+
+    // every primitive of the world with an emissive material (spheres, triangles and mesh triangles,
+    // in nested lists, linear_bvhs and instances too). other hittables are skipped: their emission is
+    // still found by bounces.
+    static light_list collect(const hittable &world)
+    {
+        light_list gathered;
+        gathered.gather(world, nullptr);
+        if (gathered.unsampled.empty())
+            return gathered;
+
+        light_list result;
+        for (const emitter &e : gathered.lights)
+            if (!gathered.unsampled.count(e.mat))
+                result.add(e);
+        return result;
+    }
+
+    // a direction from p towards a random point on a random light. false when there are no lights or
+    // the point is seen edge on.
+    bool sample(const point3 &p, light_sample &s) const
+    {
+        if (lights.empty())
+            return false;
+
+        size_t index = std::upper_bound(cdf.begin(), cdf.end(), random_double() * total_power) - cdf.begin();
+        const emitter &e = lights[std::min(index, lights.size() - 1)];
+
+        point3 y;
+        vec3 normal;
+        if (e.shape == shape_sphere)
+        {
+            normal = random_unit_vector();
+            y = e.origin + real(e.a.x()) * normal;
+        }
+        else
+        {
+            // uniform on the triangle: fold the unit square's upper half back onto the lower one
+            double u = random_double(), v = random_double();
+            if (u + v > 1)
+                u = 1 - u, v = 1 - v;
+            y = e.origin + real(u) * e.a + real(v) * e.b;
+            normal = unit_vector(cross(e.a, e.b));
+        }
+
+        vec3 to_light = y - p;
+        double distance_squared = to_light.length_squared();
+        if (distance_squared <= 0)
+            return false;
+        s.distance = std::sqrt(distance_squared);
+        s.direction = to_light / real(s.distance);
+        double cosine = std::fabs(double(dot(s.direction, normal)));
+        if (cosine < 1e-8)
+            return false;
+
+        hit_record rec;
+        rec.p = y;
+        rec.mat = e.mat;
+        rec.set_face_normal(ray(p, s.direction), normal);
+        s.emission = e.mat->emitted(ray(p, s.direction), rec);
+        s.pdf = density(e.mat) * distance_squared / cosine;
+        return true;
+    }
+
+    // density sample() gives the direction of r, which hit an emitter at rec (per solid angle). 0 for
+    // emitters it does not know, which bounces alone have to find.
+    double pdf(const ray &r, const hit_record &rec) const
+    {
+        double per_area = density(rec.mat);
+        if (per_area == 0)
+            return 0;
+        double length = r.direction().length();
+        double distance = double(rec.t) * length;
+        double cosine = std::fabs(double(dot(r.direction(), rec.normal))) / length;
+        return cosine > 1e-8 ? per_area * distance * distance / cosine : 0.0;
+    }
+
+private:
+    enum shape_type
+    {
+        shape_sphere,
+        shape_triangle
+    };
+
+    struct emitter
+    {
+        shape_type shape;
+        point3 origin; // sphere center or first vertex
+        vec3 a, b;     // sphere: radius in a.x, triangle: the two edges
+        double area;
+        const material *mat;
+    };
+
+    std::vector<emitter> lights;
+    std::vector<double> cdf; // running sum of the lights' power
+    double total_power = 0;
+    std::unordered_map<const material *, double> power_per_area; // mean emitted radiance of each material
+    std::unordered_set<const material *> unsampled;               // on an emitter gather() could not add
+
+    // radiance a material gives off its front face, averaged over the channels
+    static double radiance_of(const material *mat)
+    {
+        hit_record rec;
+        rec.p = point3(0, 0, 0);
+        rec.mat = mat;
+        rec.front_face = true;
+        rec.normal = vec3(0, 0, 1);
+        color e = mat->emitted(ray(point3(0, 0, 1), vec3(0, 0, -1)), rec);
+        return (double(e.x()) + double(e.y()) + double(e.z())) / 3;
+    }
+
+    void add(const emitter &e)
+    {
+        if (!e.mat || e.area <= 0)
+            return;
+        auto found = power_per_area.find(e.mat);
+        double radiance = found != power_per_area.end() ? found->second : radiance_of(e.mat);
+        if (radiance <= 0)
+            return;
+        power_per_area[e.mat] = radiance;
+
+        lights.push_back(e);
+        total_power += radiance * e.area;
+        cdf.push_back(total_power);
+    }
+
+    // probability per unit area of a point on a light with this material
+    double density(const material *mat) const
+    {
+        auto found = power_per_area.find(mat);
+        return found != power_per_area.end() ? found->second / total_power : 0.0;
+    }
+
+    // 'to_world' places the object when it sits inside instances, nullptr for world space
+    void gather(const hittable &object, const affine_transform *to_world)
+    {
+        auto place = [&](const point3 &p)
+        { return to_world ? to_world->point(p) : p; };
+        // a mirroring transform turns the triangle's winding around, swapping two corners turns it back
+        // so the emitting side stays the side the instance's hits call front
+        bool mirrored = false;
+        if (to_world)
+            mirrored = dot(to_world->vector(vec3(1, 0, 0)),
+                           cross(to_world->vector(vec3(0, 1, 0)), to_world->vector(vec3(0, 0, 1)))) < 0;
+        auto triangle_at = [&](const point3 &v0, const point3 &v1, const point3 &v2, const material *mat)
+        {
+            if (mirrored)
+                add_triangle(place(v0), place(v2), place(v1), mat);
+            else
+                add_triangle(place(v0), place(v1), place(v2), mat);
+        };
+
+        if (auto s = dynamic_cast<const sphere *>(&object))
+        {
+            double scale = 1;
+            if (to_world && !uniform_scale(*to_world, scale))
+            {
+                if (radiance_of(s->get_material()) > 0)
+                    unsampled.insert(s->get_material());
+                return;
+            }
+            add_sphere(place(s->get_center()), scale * double(s->get_radius()), s->get_material());
+        }
+        else if (auto t = dynamic_cast<const triangle *>(&object))
+            triangle_at(t->vertex(0), t->vertex(1), t->vertex(2), t->get_material());
+        else if (auto m = dynamic_cast<const triangle_mesh *>(&object))
+        {
+            if (m->mat && radiance_of(m->mat) > 0)
+                for (size_t tri = 0; tri < m->triangle_count(); tri++)
+                    triangle_at(m->vertex(m->indices[3 * tri]), m->vertex(m->indices[3 * tri + 1]),
+                                m->vertex(m->indices[3 * tri + 2]), m->mat);
+        }
+        else if (auto list = dynamic_cast<const hittable_list *>(&object))
+        {
+            for (const auto &child : list->objects)
+                gather(*child, to_world);
+        }
+        else if (auto bvh = dynamic_cast<const linear_bvh *>(&object))
+        {
+            for (size_t slot = 0; slot < bvh->object_count(); slot++)
+                gather(bvh->object(slot), to_world);
+        }
+        else if (auto inst = dynamic_cast<const instance *>(&object))
+        {
+            affine_transform placed = to_world ? *to_world * inst->transform() : inst->transform();
+            gather(inst->shared_object(), &placed);
+        }
+    }
+
+    // true when t scales every direction by the same factor (rotations and mirrors allowed), so a
+    // sphere stays a sphere
+    static bool uniform_scale(const affine_transform &t, double &scale)
+    {
+        vec3 x = t.vector(vec3(1, 0, 0)), y = t.vector(vec3(0, 1, 0)), z = t.vector(vec3(0, 0, 1));
+        double lx = x.length(), ly = y.length(), lz = z.length();
+        double tolerance = 1e-6 * lx;
+        scale = lx;
+        return std::fabs(ly - lx) <= tolerance && std::fabs(lz - lx) <= tolerance &&
+               std::fabs(double(dot(x, y))) <= tolerance * lx && std::fabs(double(dot(y, z))) <= tolerance * lx &&
+               std::fabs(double(dot(x, z))) <= tolerance * lx;
+    }
+};
+
+#endif
@@ -0,0 +1,808 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+// flattened BVH: instead of a tree of shared_ptr nodes with a virtual hit() per level, all nodes live
+// in one contiguous array in depth-first order. an interior node's first child is the next node in the
+// array and only the second child's index is stored. leaves hold a run of primitives.
+// traversal is a loop with a small explicit stack, no recursion and no virtual calls until a leaf.
+//
+// builds can run on a thread_pool: the SAH and median builders hand big subtrees to other workers,
+// and the LBVH builder sorts Morton codes with a parallel radix sort and emits the hierarchy from the
+// sorted codes, which is much faster to build but gives somewhat worse trees.
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "aabb.h"
+#include "thread_pool.h"
+#include "trace_stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 32 bytes, two nodes per cache line. bounds are floats rounded outwards so they still enclose
+// the double precision primitives.
+struct linear_bvh_node
+{
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;     // leaf: first primitive slot, interior: index of the second child
+    uint16_t prim_count; // 0 for interior nodes
+    uint8_t axis;        // split axis of interior nodes, used to visit the nearer child first
+    uint8_t pad;
+};
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should stay 32 bytes");
+
+enum class bvh_split_method
+{
+    median, // split the centroids in half along the longest axis
+    sah,    // binned surface area heuristic
+    lbvh    // linear BVH: radix sorted Morton codes split at their highest differing bit
+};
+
+struct bvh_build_options
+{
+    bvh_split_method split_method = bvh_split_method::sah;
+    int max_leaf_size = 4;          // leaves never hold more than this (SAH may stop earlier), at most 65535
+    int sah_bins = 16;              // buckets per axis for the binned SAH sweep
+    double traversal_cost = 1.0;    // relative cost of visiting one interior node
+    double intersection_cost = 1.0; // relative cost of testing one primitive
+
+    thread_pool *pool = nullptr;     // build in parallel on this pool, nullptr builds on the calling thread
+    size_t parallel_threshold = 4096; // subtrees smaller than this are built serially inside one task
+};
+
+struct bvh_build_stats
+{
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    int max_depth = 0;
+    double build_ms = 0.0;
+    double sah_cost = 0.0; // expected cost of a random ray hitting the root box, lower is better
+};
+
+// the acceleration structure on its own, knows nothing about what the primitives are.
+// build() takes one box per primitive; traverse() hands the caller primitive slots to test.
+class bvh_tree
+{
+public:
+    std::vector<linear_bvh_node> nodes;
+    // prim_indices[slot] = index of the primitive (in the array given to build) stored at that leaf slot.
+    // owners are expected to reorder their primitives to slot order so leaves read memory linearly.
+    std::vector<uint32_t> prim_indices;
+
+    // the SAH and LBVH splits stop at max_split_depth. deeper than that a range bigger than a leaf is only
+    // halved at the median, which takes at most 32 more levels for 2^32 primitives, so no tree is deeper
+    // than max_depth and traversal stacks of that size always suffice
+    static constexpr int max_split_depth = 64;
+    static constexpr int max_depth = max_split_depth + 32;
+    static constexpr int max_leaf_limit = 65535; // linear_bvh_node::prim_count is 16 bits
+
+    void build(const std::vector<aabb> &prim_bounds, const bvh_build_options &options = {})
+    {
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        nodes.clear();
+        prim_indices.clear();
+        build_stats = bvh_build_stats();
+
+        std::vector<build_prim> prims(prim_bounds.size());
+        for (size_t i = 0; i < prim_bounds.size(); i++)
+            prims[i] = build_prim{prim_bounds[i], prim_bounds[i].center(), uint32_t(i)};
+
+        if (!prims.empty())
+        {
+            std::unique_ptr<build_node> root;
+            auto build_root = [&]()
+            {
+                if (options.split_method == bvh_split_method::lbvh)
+                    root = build_lbvh(prims, options);
+                else
+                    root = build_recursive(prims, 0, prims.size(), 0, options);
+            };
+
+            if (options.pool)
+            {
+                // run the build itself as a pool job, so nested subtree tasks land on worker deques
+                // and every thread (including the one waiting on a subtree) keeps building
+                thread_pool::task_group group;
+                options.pool->submit(group, [&](unsigned int)
+                                     { build_root(); });
+                options.pool->wait(group);
+            }
+            else
+            {
+                build_root();
+            }
+
+            nodes.reserve(2 * prims.size());
+            flatten(*root, 1);
+            nodes.shrink_to_fit();
+        }
+
+        prim_indices.resize(prims.size());
+        for (size_t i = 0; i < prims.size(); i++)
+            prim_indices[i] = prims[i].index;
+
+        build_stats.sah_cost = sah_cost(options);
+        build_stats.build_ms = std::chrono::duration<double, std::milli>(
+                                   std::chrono::high_resolution_clock::now() - start_time)
+                                   .count();
+    }
+
+    const bvh_build_stats &stats() const { return build_stats; }
+
+    // move the boxes to new primitive bounds (indexed like the ones given to build) and keep the
+    // topology: the same primitives share a leaf, the same nodes are siblings. children always come
+    // after their parent in the array, so one sweep from the back sees both children of a node before
+    // the node itself. much cheaper than a build, but the tree gets worse the further primitives move
+    // from where the build grouped them; compare sah_cost() to the build's to tell when to rebuild.
+    // stats() keeps describing the last build.
+    void refit(const std::vector<aabb> &prim_bounds)
+    {
+        for (size_t n = nodes.size(); n-- > 0;)
+        {
+            linear_bvh_node &node = nodes[n];
+            aabb box;
+            if (node.prim_count > 0)
+                for (uint32_t slot = node.offset; slot < node.offset + node.prim_count; slot++)
+                    box = aabb::surrounding_box(box, prim_bounds[prim_indices[slot]]);
+            else
+                box = aabb::surrounding_box(node_bounds(nodes[n + 1]), node_bounds(nodes[node.offset]));
+            set_node_bounds(node, box);
+        }
+    }
+
+    // walk the tree front to back. leaf(slot, ray_t) tests one primitive and on a hit must shrink
+    // ray_t.max to the hit distance (and return true), which prunes everything further away.
+    template <typename LeafFn>
+    bool traverse(const ray &r, interval ray_t, LeafFn &&leaf) const
+    {
+        return traverse_nodes(nodes.data(), nodes.size(), r, ray_t, leaf);
+    }
+
+    // the traversal loop itself, over any node array in the flattened layout (e.g. a memory mapped one)
+    template <typename LeafFn>
+    static bool traverse_nodes(const linear_bvh_node *nodes, size_t node_count, const ray &r, interval ray_t,
+                               LeafFn &&leaf)
+    {
+        if (node_count == 0)
+            return false;
+        return traverse_from(nodes, 0, r, ray_t, leaf);
+    }
+
+    // the same loop over just the subtree under node 'root' (the whole tree for root 0)
+    template <typename LeafFn>
+    static bool traverse_from(const linear_bvh_node *nodes, uint32_t root, const ray &r, interval ray_t,
+                              LeafFn &&leaf)
+    {
+        return traverse_leaves(nodes, root, r, ray_t, [&](uint32_t first, uint32_t count, interval &t)
+                               {
+            bool hit_anything = false;
+            for (uint32_t i = 0; i < count; i++)
+                if (leaf(first + i, t))
+                    hit_anything = true;
+            return hit_anything; });
+    }
+
+    // traversal that hands over whole leaves: leaf(first_slot, count, ray_t), for callers that test
+    // all primitives of a leaf at once
+    template <typename LeafFn>
+    static bool traverse_leaves(const linear_bvh_node *nodes, uint32_t root, const ray &r, interval ray_t,
+                                LeafFn &&leaf)
+    {
+        const double org[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+        const double inv_dir[3] = {1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()};
+        const int dir_is_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = root;
+        bool hit_anything = false;
+
+        while (true)
+        {
+            const linear_bvh_node &node = nodes[current];
+            RT_STAT(nodes_visited);
+            RT_STAT(box_tests);
+            if (node_hit(node, org, inv_dir, dir_is_neg, ray_t))
+            {
+                if (node.prim_count > 0)
+                {
+                    if (leaf(node.offset, uint32_t(node.prim_count), ray_t))
+                        hit_anything = true;
+
+                    if (stack_size == 0)
+                        break;
+                    current = stack[--stack_size];
+                }
+                else if (dir_is_neg[node.axis])
+                {
+                    // ray goes towards -axis, so the second (upper) child is nearer
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // SAH cost of the finished tree: every node weighted by the chance that a ray through the root box
+    // also crosses its box (the surface area ratio), interior nodes cost a traversal step, leaves a
+    // primitive test per primitive
+    double sah_cost(const bvh_build_options &options = {}) const
+    {
+        if (nodes.empty())
+            return 0.0;
+
+        double root_area = surface_area(node_bounds(nodes[0]));
+        if (root_area <= 0)
+            return options.intersection_cost * nodes[0].prim_count;
+
+        double cost = 0.0;
+        for (const auto &node : nodes)
+        {
+            double p = surface_area(node_bounds(node)) / root_area;
+            if (node.prim_count > 0)
+                cost += p * options.intersection_cost * node.prim_count;
+            else
+                cost += p * options.traversal_cost;
+        }
+        return cost;
+    }
+
+    static double surface_area(const aabb &box)
+    {
+        double dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0.0; // empty box
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    aabb bounds() const
+    {
+        if (nodes.empty())
+            return aabb();
+        return node_bounds(nodes[0]);
+    }
+
+    static aabb node_bounds(const linear_bvh_node &node)
+    {
+        return aabb(interval(node.bounds_min[0], node.bounds_max[0]),
+                    interval(node.bounds_min[1], node.bounds_max[1]),
+                    interval(node.bounds_min[2], node.bounds_max[2]));
+    }
+
+protected:
+    struct build_prim
+    {
+        aabb bounds;
+        point3 centroid;
+        uint32_t index;
+    };
+
+    struct build_node
+    {
+        aabb bounds;
+        std::unique_ptr<build_node> children[2];
+        uint32_t first = 0, count = 0; // leaf range in the prims array, count 0 for interior nodes
+        int axis = 0;
+    };
+
+    bvh_build_stats build_stats;
+
+    static inline bool node_hit(const linear_bvh_node &node, const double org[3], const double inv_dir[3],
+                                const int dir_is_neg[3], const interval &ray_t)
+    {
+        // slab test without the swaps: the sign of the direction picks which plane is entered first
+        const float *lo_hi[2] = {node.bounds_min, node.bounds_max};
+
+        double tmin = (lo_hi[dir_is_neg[0]][0] - org[0]) * inv_dir[0];
+        double tmax = (lo_hi[1 - dir_is_neg[0]][0] - org[0]) * inv_dir[0];
+        double tymin = (lo_hi[dir_is_neg[1]][1] - org[1]) * inv_dir[1];
+        double tymax = (lo_hi[1 - dir_is_neg[1]][1] - org[1]) * inv_dir[1];
+        tmin = std::max(tmin, tymin);
+        tmax = std::min(tmax, tymax);
+        double tzmin = (lo_hi[dir_is_neg[2]][2] - org[2]) * inv_dir[2];
+        double tzmax = (lo_hi[1 - dir_is_neg[2]][2] - org[2]) * inv_dir[2];
+        tmin = std::max(tmin, tzmin);
+        tmax = std::min(tmax, tzmax);
+
+        return std::max(tmin, double(ray_t.min)) <= std::min(tmax, double(ray_t.max));
+    }
+
+    build_node *make_leaf(build_node *node, size_t start, size_t end)
+    {
+        node->first = uint32_t(start);
+        node->count = uint32_t(end - start);
+        return node;
+    }
+
+    // call fn(begin, end) over [0, n) in chunks, on the pool when there is one and n is big enough
+    template <typename F>
+    static void for_chunks(thread_pool *pool, size_t n, size_t min_chunk, F &&fn)
+    {
+        if (!pool || n < 2 * min_chunk)
+        {
+            fn(size_t(0), n);
+            return;
+        }
+
+        size_t chunks = std::min(n / min_chunk, size_t(pool->size()) * 4);
+        pool->parallel_for(chunks, [&](size_t c, unsigned int)
+                           { fn(n * c / chunks, n * (c + 1) / chunks); });
+    }
+
+    // bounds of the primitives and of their centroids over a range, split into chunks for big ranges
+    static void range_bounds(const std::vector<build_prim> &prims, size_t start, size_t end,
+                             const bvh_build_options &options, aabb &bounds, aabb &centroid_bounds)
+    {
+        const size_t chunk = 16384;
+        size_t n = end - start;
+        size_t chunks = (options.pool && n >= 4 * chunk) ? std::min(n / chunk, size_t(options.pool->size()) * 4) : 1;
+        std::vector<aabb> partial(chunks), partial_centroids(chunks);
+
+        for_chunks(chunks > 1 ? options.pool : nullptr, chunks, 1, [&](size_t c0, size_t c1)
+                   {
+            for (size_t c = c0; c < c1; c++)
+                for (size_t i = start + n * c / chunks; i < start + n * (c + 1) / chunks; i++)
+                {
+                    partial[c] = aabb::surrounding_box(partial[c], prims[i].bounds);
+                    partial_centroids[c] = aabb::surrounding_box(partial_centroids[c], aabb(prims[i].centroid, prims[i].centroid));
+                } });
+
+        bounds = aabb();
+        centroid_bounds = aabb();
+        for (size_t c = 0; c < chunks; c++)
+        {
+            bounds = aabb::surrounding_box(bounds, partial[c]);
+            centroid_bounds = aabb::surrounding_box(centroid_bounds, partial_centroids[c]);
+        }
+    }
+
+    // build both children of node, the first one as a separate pool task when the range is big
+    template <typename Build>
+    static void build_children(build_node *node, size_t count, const bvh_build_options &options, Build &&build)
+    {
+        if (options.pool && count >= options.parallel_threshold)
+        {
+            thread_pool::task_group group;
+            options.pool->submit(group, [&](unsigned int)
+                                 { node->children[0] = build(0); });
+            // the task refers to this frame, so it is waited for even when the second child throws
+            std::exception_ptr error;
+            try
+            {
+                node->children[1] = build(1);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            options.pool->wait(group);
+            if (error)
+                std::rethrow_exception(error);
+        }
+        else
+        {
+            node->children[0] = build(0);
+            node->children[1] = build(1);
+        }
+    }
+
+    std::unique_ptr<build_node> build_recursive(std::vector<build_prim> &prims, size_t start, size_t end,
+                                                int depth, const bvh_build_options &options)
+    {
+        auto node = std::make_unique<build_node>();
+
+        aabb centroid_bounds;
+        range_bounds(prims, start, end, options, node->bounds, centroid_bounds);
+
+        size_t count = end - start;
+        size_t max_leaf = leaf_size(options);
+        if (count <= 1)
+        {
+            make_leaf(node.get(), start, end);
+            return node;
+        }
+
+        int axis = centroid_bounds.longest_axis();
+        size_t mid = start + count / 2;
+
+        if (options.split_method == bvh_split_method::sah && depth < max_split_depth)
+        {
+            sah_split split = find_sah_split(prims, start, end, node->bounds, centroid_bounds, options);
+
+            // a leaf is cheaper than the best split and allowed here, stop
+            double leaf_cost = options.intersection_cost * double(count);
+            if (count <= max_leaf && split.cost >= leaf_cost)
+            {
+                make_leaf(node.get(), start, end);
+                return node;
+            }
+
+            if (split.axis >= 0)
+            {
+                axis = split.axis;
+                mid = partition_by_bin(prims, start, end, centroid_bounds, split, options.sah_bins);
+            }
+            else
+            {
+                // every centroid in the same spot, binning can't separate them, fall back to the median
+                split_at_median(prims, start, mid, end, axis);
+            }
+        }
+        else
+        {
+            if (count <= max_leaf)
+            {
+                make_leaf(node.get(), start, end);
+                return node;
+            }
+            split_at_median(prims, start, mid, end, axis);
+        }
+
+        node->axis = axis;
+        build_children(node.get(), count, options, [&](int child)
+                       { return child == 0 ? build_recursive(prims, start, mid, depth + 1, options)
+                                           : build_recursive(prims, mid, end, depth + 1, options); });
+        return node;
+    }
+
+    struct morton_prim
+    {
+        uint32_t code;
+        uint32_t index;
+    };
+
+    // spread the low 10 bits of v out to every third bit
+    static uint32_t expand_bits(uint32_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // 30 bit Morton code of a point inside [0,1]^3, x in the highest bit of each triple
+    static uint32_t morton_code(double x, double y, double z)
+    {
+        auto quantise = [](double v)
+        { return uint32_t(std::min(std::max(v * 1024.0, 0.0), 1023.0)); };
+        return (expand_bits(quantise(x)) << 2) | (expand_bits(quantise(y)) << 1) | expand_bits(quantise(z));
+    }
+
+    // LSD radix sort on the 30 bit codes, three passes of 10 bits. every pass histograms chunks in
+    // parallel, prefix-sums the per chunk counts and scatters each chunk to its own slots in parallel.
+    static void radix_sort(std::vector<morton_prim> &items, thread_pool *pool)
+    {
+        const int bits_per_pass = 10;
+        const size_t buckets = size_t(1) << bits_per_pass;
+        size_t n = items.size();
+        size_t chunks = (pool && n >= 65536) ? std::min(n / 16384, size_t(pool->size()) * 4) : 1;
+
+        std::vector<morton_prim> scratch(n);
+        std::vector<size_t> offsets(chunks * buckets);
+
+        for (int shift = 0; shift < 30; shift += bits_per_pass)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            for_chunks(chunks > 1 ? pool : nullptr, chunks, 1, [&](size_t c0, size_t c1)
+                       {
+                for (size_t c = c0; c < c1; c++)
+                    for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+                        offsets[c * buckets + ((items[i].code >> shift) & (buckets - 1))]++; });
+
+            // exclusive prefix sum in bucket-major order, so chunk c's slice of a bucket follows chunk c-1's
+            size_t sum = 0;
+            for (size_t b = 0; b < buckets; b++)
+                for (size_t c = 0; c < chunks; c++)
+                {
+                    size_t count = offsets[c * buckets + b];
+                    offsets[c * buckets + b] = sum;
+                    sum += count;
+                }
+
+            for_chunks(chunks > 1 ? pool : nullptr, chunks, 1, [&](size_t c0, size_t c1)
+                       {
+                for (size_t c = c0; c < c1; c++)
+                    for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+                        scratch[offsets[c * buckets + ((items[i].code >> shift) & (buckets - 1))]++] = items[i]; });
+
+            items.swap(scratch);
+        }
+    }
+
+    std::unique_ptr<build_node> build_lbvh(std::vector<build_prim> &prims, const bvh_build_options &options)
+    {
+        size_t n = prims.size();
+        aabb bounds, centroid_bounds;
+        range_bounds(prims, 0, n, options, bounds, centroid_bounds);
+
+        // one scale for all axes so the Morton grid cells stay cubes, stretching a flat axis to the
+        // full 10 bits makes the cells (and the resulting boxes) very thin slabs
+        double extent = std::max({centroid_bounds.x.size(), centroid_bounds.y.size(), centroid_bounds.z.size()});
+        double scale = extent > 0 ? 1.0 / extent : 0.0;
+
+        std::vector<morton_prim> morton(n);
+        for_chunks(options.pool, n, 16384, [&](size_t begin, size_t end)
+                   {
+            for (size_t i = begin; i < end; i++)
+            {
+                double q[3];
+                for (int a = 0; a < 3; a++)
+                    q[a] = (prims[i].centroid[a] - centroid_bounds.axis_interval(a).min) * scale;
+                morton[i] = morton_prim{morton_code(q[0], q[1], q[2]), uint32_t(i)};
+            } });
+
+        radix_sort(morton, options.pool);
+
+        std::vector<build_prim> sorted(n);
+        std::vector<uint32_t> codes(n);
+        for_chunks(options.pool, n, 16384, [&](size_t begin, size_t end)
+                   {
+            for (size_t i = begin; i < end; i++)
+            {
+                sorted[i] = prims[morton[i].index];
+                codes[i] = morton[i].code;
+            } });
+        prims.swap(sorted);
+
+        return emit_lbvh(prims, codes, 0, n, 29, 0, options);
+    }
+
+    // split a run of sorted codes where their highest differing bit flips; runs of identical codes
+    // are halved. node bounds are assembled bottom-up from the children, no per-level sweeps.
+    std::unique_ptr<build_node> emit_lbvh(const std::vector<build_prim> &prims, const std::vector<uint32_t> &codes,
+                                          size_t start, size_t end, int bit, int depth,
+                                          const bvh_build_options &options)
+    {
+        auto node = std::make_unique<build_node>();
+        size_t count = end - start;
+
+        if (count <= leaf_size(options))
+        {
+            for (size_t i = start; i < end; i++)
+                node->bounds = aabb::surrounding_box(node->bounds, prims[i].bounds);
+            make_leaf(node.get(), start, end);
+            return node;
+        }
+
+        // the codes are sorted, so a bit where the first and last code agree is the same for the whole run
+        while (bit >= 0 && ((codes[start] >> bit) & 1) == ((codes[end - 1] >> bit) & 1))
+            bit--;
+
+        size_t mid;
+        if (bit < 0 || depth >= max_split_depth)
+        {
+            mid = start + count / 2;
+            node->axis = 0;
+        }
+        else
+        {
+            auto first_set = std::partition_point(codes.begin() + start, codes.begin() + end, [bit](uint32_t code)
+                                                  { return ((code >> bit) & 1) == 0; });
+            mid = size_t(first_set - codes.begin());
+            node->axis = 2 - bit % 3; // x sits in the highest bit of each triple
+        }
+
+        build_children(node.get(), count, options, [&](int child)
+                       { return child == 0 ? emit_lbvh(prims, codes, start, mid, bit - 1, depth + 1, options)
+                                           : emit_lbvh(prims, codes, mid, end, bit - 1, depth + 1, options); });
+        node->bounds = aabb::surrounding_box(node->children[0]->bounds, node->children[1]->bounds);
+        return node;
+    }
+
+    static size_t leaf_size(const bvh_build_options &options)
+    {
+        return size_t(std::min(std::max(1, options.max_leaf_size), max_leaf_limit));
+    }
+
+    // median split of the centroids along an axis, nth_element keeps the whole build O(n log n)
+    static void split_at_median(std::vector<build_prim> &prims, size_t start, size_t mid, size_t end, int axis)
+    {
+        std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+                         [axis](const build_prim &a, const build_prim &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    struct sah_split
+    {
+        int axis = -1; // -1 when no axis had any centroid extent
+        int bin = 0;   // primitives in bins [0, bin] go left
+        double cost = infinity;
+    };
+
+    static int bin_index(const build_prim &p, const aabb &centroid_bounds, int axis, int bins)
+    {
+        const interval &iv = centroid_bounds.axis_interval(axis);
+        int b = int(bins * ((p.centroid[axis] - iv.min) / iv.size()));
+        return std::min(std::max(b, 0), bins - 1);
+    }
+
+    // binned SAH: drop the centroids into a fixed number of buckets per axis, then sweep the bucket
+    // boundaries from both sides to evaluate every candidate plane in O(bins) instead of sorting
+    static sah_split find_sah_split(const std::vector<build_prim> &prims, size_t start, size_t end,
+                                    const aabb &bounds, const aabb &centroid_bounds,
+                                    const bvh_build_options &options)
+    {
+        const int bins = std::max(2, options.sah_bins);
+        double parent_area = surface_area(bounds);
+        sah_split best;
+
+        std::vector<aabb> bin_bounds(bins);
+        std::vector<size_t> bin_counts(bins);
+        std::vector<double> right_area(bins);
+        std::vector<size_t> right_count(bins);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (centroid_bounds.axis_interval(axis).size() <= 0)
+                continue;
+
+            std::fill(bin_bounds.begin(), bin_bounds.end(), aabb());
+            std::fill(bin_counts.begin(), bin_counts.end(), 0);
+            for (size_t i = start; i < end; i++)
+            {
+                int b = bin_index(prims[i], centroid_bounds, axis, bins);
+                bin_counts[b]++;
+                bin_bounds[b] = aabb::surrounding_box(bin_bounds[b], prims[i].bounds);
+            }
+
+            // right_*[i] describes bins i+1 .. bins-1
+            aabb acc;
+            size_t acc_count = 0;
+            for (int b = bins - 1; b > 0; b--)
+            {
+                acc = aabb::surrounding_box(acc, bin_bounds[b]);
+                acc_count += bin_counts[b];
+                right_area[b - 1] = surface_area(acc);
+                right_count[b - 1] = acc_count;
+            }
+
+            acc = aabb();
+            acc_count = 0;
+            for (int b = 0; b < bins - 1; b++)
+            {
+                acc = aabb::surrounding_box(acc, bin_bounds[b]);
+                acc_count += bin_counts[b];
+                if (acc_count == 0 || right_count[b] == 0)
+                    continue;
+
+                double cost = options.traversal_cost +
+                              options.intersection_cost *
+                                  (surface_area(acc) * acc_count + right_area[b] * right_count[b]) /
+                                  (parent_area > 0 ? parent_area : 1.0);
+                if (cost < best.cost)
+                {
+                    best.axis = axis;
+                    best.bin = b;
+                    best.cost = cost;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    static size_t partition_by_bin(std::vector<build_prim> &prims, size_t start, size_t end,
+                                   const aabb &centroid_bounds, const sah_split &split, int bins)
+    {
+        bins = std::max(2, bins);
+        auto mid = std::partition(prims.begin() + start, prims.begin() + end, [&](const build_prim &p)
+                                  { return bin_index(p, centroid_bounds, split.axis, bins) <= split.bin; });
+        return size_t(mid - prims.begin());
+    }
+
+    // depth-first layout: the node itself, its whole first subtree, then the second subtree
+    uint32_t flatten(const build_node &node, int depth)
+    {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.push_back(linear_bvh_node());
+        set_node_bounds(nodes[index], node.bounds);
+
+        build_stats.node_count++;
+        build_stats.max_depth = std::max(build_stats.max_depth, depth);
+
+        if (node.count > 0)
+        {
+            if (node.count > size_t(max_leaf_limit))
+                throw std::length_error("bvh leaf of " + std::to_string(node.count) + " primitives");
+            nodes[index].offset = node.first;
+            nodes[index].prim_count = uint16_t(node.count);
+            build_stats.leaf_count++;
+        }
+        else
+        {
+            nodes[index].axis = uint8_t(node.axis);
+            flatten(*node.children[0], depth + 1);
+            uint32_t second = flatten(*node.children[1], depth + 1);
+            nodes[index].offset = second;
+        }
+        return index;
+    }
+
+    static void set_node_bounds(linear_bvh_node &node, const aabb &box)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            const interval &iv = box.axis_interval(a);
+            node.bounds_min[a] = round_down(iv.min);
+            node.bounds_max[a] = round_up(iv.max);
+        }
+    }
+
+    static float round_down(double x)
+    {
+        float f = float(x);
+        return (double(f) > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x)
+    {
+        float f = float(x);
+        return (double(f) < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
+// a hittable wrapping bvh_tree over the objects of a hittable_list, the flat replacement for bvh_node
+class linear_bvh : public hittable
+{
+public:
+    linear_bvh(const hittable_list &list, const bvh_build_options &options = {})
+    {
+        std::vector<aabb> bounds;
+        bounds.reserve(list.objects.size());
+        for (const auto &object : list.objects)
+            bounds.push_back(object->bounding_box());
+
+        tree.build(bounds, options);
+
+        // store the objects in leaf order, so slot i is objects[i]
+        objects.reserve(list.objects.size());
+        for (uint32_t index : tree.prim_indices)
+            objects.push_back(list.objects[index]);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval &t)
+                             {
+            if (!objects[slot]->hit(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true; });
+    }
+
+    aabb bounding_box() const override { return tree.bounds(); }
+
+    const bvh_build_stats &stats() const { return tree.stats(); }
+    const bvh_tree &acceleration() const { return tree; }
+    size_t object_count() const { return objects.size(); }
+    const hittable &object(size_t slot) const { return *objects[slot]; } // objects are in slot order
+
+private:
+    std::vector<shared_ptr<hittable>> objects;
+    bvh_tree tree;
+};
+
+#endif
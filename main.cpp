@@ -5,89 +5,260 @@
 #include "sphere.h"
 #include "triangle.h"
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "scene_snapshot.h"
+#include "scenes.h"
+#include "distributed.h"
+#include "animation.h"
+#include "scene_loader.h"
 #include <chrono>
+#include <cstdlib>
+#include <string>
 
-void create_impressive_scene(hittable_list &world)
+int main(int argc, char **argv)
 {
-    // Ground
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-    // final render for now! we will make a lot of random spheres and render theem
-    for (int a = -11; a < 11; a++)
+    // command line: --save-snapshot <file> writes the scene + BVH (built once) and renders from that file,
+    // --snapshot <file> skips building and traces a saved snapshot instead,
+    // --integrator recursive|iterative|wavefront picks the path integrator, --rr-min-depth <n> the bounces an
+    // iterative path makes before Russian roulette starts, --packet 4|8|16 traces camera rays in packets,
+    // --output <file> writes the image there (format from the extension: .ppm binary, .pfm, .png) instead
+    // of stdout, --format p3|p6|pfm|png overrides the format.
+    // progressive: --samples <n> samples per pixel, added --pass-samples <n> at a time, --time-budget <s>
+    // stops early, --preview-interval <s> rewrites the --output file between passes, --checkpoint <file>
+    // saves the accumulated samples and --resume continues from them.
+    // --adaptive <threshold> only keeps sampling noisy pixels (--samples is then the cap), after
+    // --adaptive-min <n> samples each, --sample-map <file> writes a heat map of the samples per pixel.
+    // --denoise runs the a-trous filter on the result, --features <prefix> writes the albedo, normal and
+    // depth buffers it is guided by (<prefix>_albedo.pfm etc.), --feature-samples <n> rays per pixel for them.
+    // --scene impressive|cornell picks the scene (and view, also for a --snapshot of it), --lights
+    // off|nee|mis how paths reach its emitters: bounces only, shadow rays, or both combined (the default)
+    // --scene-file <file> loads the scene and its camera from a text file instead (see scene_loader.h),
+    // --samples still wins over the file's
+    // distributed: --coordinator <address> hands the frame out as jobs to the processes started with
+    // --worker <address> (tcp:host:port or unix:/path, every one with the same scene options) and writes
+    // the image; --job-tile <n> pixels per job edge, --job-samples <n> samples per job (0 = all),
+    // --job-timeout <s> before a silent worker's job goes to another one
+    // --cost-map <file> writes a heat map of the box and primitive tests per pixel (builds with -DRT_STATS)
+    // animation: --frames <n> renders n frames of the impressive scene in motion at --fps <f> (24), to
+    // <output>_0000.png and so on; the BVH is refitted between frames and rebuilt when its SAH cost got
+    // worse than --rebuild-threshold <x> (1.3) times the last build's
+    std::string snapshot_in, snapshot_out, output_path, format_name, checkpoint_path;
+    int samples_per_pixel = 50, pass_samples = 0;
+    bool samples_given = false;
+    std::string scene_file;
+    double time_budget = 0, preview_interval = 0, adaptive_threshold = 0;
+    int adaptive_min_samples = 16;
+    std::string sample_map_path, cost_map_path, feature_prefix;
+    int feature_samples = 8;
+    bool resume = false, use_denoiser = false;
+    std::string scene_name = "impressive";
+    light_sampling direct_light = light_sampling::mis;
+    integrator_type integrator = integrator_type::recursive;
+    int rr_min_depth = 3;
+    int packet_size = 1;
+    std::string coordinator_address, worker_address;
+    distributed_options distributed;
+    int frames = 0;
+    double fps = 24;
+    animation_options animation;
+    for (int i = 1; i < argc; i++)
     {
-        for (int b = -11; b < 11; b++)
+        std::string arg = argv[i];
+        if (arg == "--snapshot" && i + 1 < argc)
+            snapshot_in = argv[++i];
+        else if (arg == "--save-snapshot" && i + 1 < argc)
+            snapshot_out = argv[++i];
+        else if (arg == "--integrator" && i + 1 < argc && std::string(argv[i + 1]) == "recursive")
+            integrator = integrator_type::recursive, i++;
+        else if (arg == "--integrator" && i + 1 < argc && std::string(argv[i + 1]) == "iterative")
+            integrator = integrator_type::iterative, i++;
+        else if (arg == "--integrator" && i + 1 < argc && std::string(argv[i + 1]) == "wavefront")
+            integrator = integrator_type::wavefront, i++;
+        else if (arg == "--rr-min-depth" && i + 1 < argc)
+            rr_min_depth = std::atoi(argv[++i]);
+        else if (arg == "--packet" && i + 1 < argc)
+            packet_size = std::atoi(argv[++i]);
+        else if (arg == "--output" && i + 1 < argc)
+            output_path = argv[++i];
+        else if (arg == "--format" && i + 1 < argc &&
+                 (std::string(argv[i + 1]) == "p3" || std::string(argv[i + 1]) == "p6" ||
+                  std::string(argv[i + 1]) == "pfm" || std::string(argv[i + 1]) == "png"))
+            format_name = argv[++i];
+        else if (arg == "--samples" && i + 1 < argc)
+            samples_per_pixel = std::atoi(argv[++i]), samples_given = true;
+        else if (arg == "--pass-samples" && i + 1 < argc)
+            pass_samples = std::atoi(argv[++i]);
+        else if (arg == "--time-budget" && i + 1 < argc)
+            time_budget = std::atof(argv[++i]);
+        else if (arg == "--preview-interval" && i + 1 < argc)
+            preview_interval = std::atof(argv[++i]);
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else if (arg == "--resume")
+            resume = true;
+        else if (arg == "--adaptive" && i + 1 < argc)
+            adaptive_threshold = std::atof(argv[++i]);
+        else if (arg == "--adaptive-min" && i + 1 < argc)
+            adaptive_min_samples = std::atoi(argv[++i]);
+        else if (arg == "--sample-map" && i + 1 < argc)
+            sample_map_path = argv[++i];
+        else if (arg == "--cost-map" && i + 1 < argc)
+            cost_map_path = argv[++i];
+        else if (arg == "--denoise")
+            use_denoiser = true;
+        else if (arg == "--features" && i + 1 < argc)
+            feature_prefix = argv[++i];
+        else if (arg == "--feature-samples" && i + 1 < argc)
+            feature_samples = std::atoi(argv[++i]);
+        else if (arg == "--scene" && i + 1 < argc &&
+                 (std::string(argv[i + 1]) == "impressive" || std::string(argv[i + 1]) == "cornell"))
+            scene_name = argv[++i];
+        else if (arg == "--scene-file" && i + 1 < argc)
+            scene_file = argv[++i];
+        else if (arg == "--lights" && i + 1 < argc && std::string(argv[i + 1]) == "off")
+            direct_light = light_sampling::off, i++;
+        else if (arg == "--lights" && i + 1 < argc && std::string(argv[i + 1]) == "nee")
+            direct_light = light_sampling::next_event, i++;
+        else if (arg == "--lights" && i + 1 < argc && std::string(argv[i + 1]) == "mis")
+            direct_light = light_sampling::mis, i++;
+        else if (arg == "--coordinator" && i + 1 < argc)
+            coordinator_address = argv[++i];
+        else if (arg == "--worker" && i + 1 < argc)
+            worker_address = argv[++i];
+        else if (arg == "--job-tile" && i + 1 < argc)
+            distributed.tile_size = std::atoi(argv[++i]);
+        else if (arg == "--job-samples" && i + 1 < argc)
+            distributed.job_samples = std::atoi(argv[++i]);
+        else if (arg == "--job-timeout" && i + 1 < argc)
+            distributed.job_timeout = std::atof(argv[++i]);
+        else if (arg == "--frames" && i + 1 < argc)
+            frames = std::atoi(argv[++i]);
+        else if (arg == "--fps" && i + 1 < argc)
+            fps = std::atof(argv[++i]);
+        else if (arg == "--rebuild-threshold" && i + 1 < argc)
+            animation.rebuild_threshold = std::atof(argv[++i]);
+        else
         {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
-            {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz); // aside from color, add fuzziness paameter to the metals
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+            std::cerr << "usage: " << argv[0] << " [--snapshot file] [--save-snapshot file]"
+                      << " [--integrator recursive|iterative|wavefront] [--rr-min-depth n] [--packet 4|8|16]"
+                      << " [--output file] [--format p3|p6|pfm|png] [--samples n] [--pass-samples n] [--time-budget s]"
+                      << " [--preview-interval s] [--checkpoint file] [--resume] [--adaptive threshold] [--adaptive-min n]"
+                      << " [--sample-map file] [--cost-map file] [--denoise] [--features prefix] [--feature-samples n]"
+                      << " [--scene impressive|cornell | --scene-file file] [--lights off|nee|mis] [--coordinator address | --worker address]"
+                      << " [--job-tile n] [--job-samples n] [--job-timeout s]"
+                      << " [--frames n --output file [--fps f] [--rebuild-threshold x]] > image.ppm" << std::endl;
+            return 1;
         }
     }
+    if (frames > 0 && (output_path.empty() || scene_name != "impressive" || !scene_file.empty() || !snapshot_in.empty() ||
+                       !snapshot_out.empty() || !checkpoint_path.empty() || !coordinator_address.empty() ||
+                       !worker_address.empty()))
+    {
+        std::cerr << "--frames animates the impressive scene into numbered --output files, without snapshots,"
+                  << " checkpoints or distributed rendering" << std::endl;
+        return 1;
+    }
 
-    // three hero spheres
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    // add in trianglse because why not
-    auto triangle_material = make_shared<metal>(color(0.8, 0.3, 0.3), 0.1);
+    image_format output_format = image_format_for_path(output_path);
+    if (format_name == "p3")
+        output_format = image_format::p3;
+    else if (format_name == "p6")
+        output_format = image_format::p6;
+    else if (format_name == "pfm")
+        output_format = image_format::pfm;
+    else if (format_name == "png")
+        output_format = image_format::png;
 
-    // a few triangular "sails" or "fins"
-    world.add(make_shared<triangle>(
-        point3(2, 0, 2), point3(3, 2, 2), point3(2, 2, 3), triangle_material));
-    world.add(make_shared<triangle>(
-        point3(-2, 0, 2), point3(-3, 2, 2), point3(-2, 2, 3), triangle_material));
-}
+    // one pool for everything: the BVH build runs on the same workers that render afterwards
+    auto pool = thread_pool::global();
+    material_table materials; // owns every material of the scene, declared before (so destroyed after) the world
+    shared_ptr<hittable> bvh_world;
+    shared_ptr<animated_scene> animated; // set with --frames, then also bvh_world
+    light_list lights;
+    scene_view file_view; // the --scene-file's camera settings
 
-int main()
-{
-    // World
-    hittable_list world;
+    try
+    {
+        if (!snapshot_in.empty())
+        {
+            auto snapshot = make_shared<scene_snapshot>(snapshot_in);
+            std::cerr << "Snapshot " << snapshot_in << " mapped in " << snapshot->load_milliseconds() << " ms ("
+                      << snapshot->primitive_count() << " primitives)" << std::endl;
+            lights = snapshot->lights();
+            bvh_world = snapshot;
+        }
+        else
+        {
+            // World
+            hittable_list world;
 
-    // create an impressive scene with many objects
-    create_impressive_scene(world);
+            // create an impressive scene with many objects, or the Cornell box lit by its emitters, or
+            // whatever the scene file describes
+            if (!scene_file.empty())
+            {
+                scene_load_options load_options;
+                load_options.pool = pool.get();
+                scene_load_stats load_stats;
+                file_view = load_scene(scene_file, world, materials, load_options, &load_stats);
+                std::cerr << "Scene file " << scene_file << " loaded in " << load_stats.seconds * 1e3 << " ms ("
+                          << load_stats.primitives() << " primitives parsed at "
+                          << load_stats.primitives_per_second() / 1e6 << " M/s, " << load_stats.instances
+                          << " instances of " << load_stats.meshes << " meshes)" << std::endl;
+            }
+            else if (scene_name == "cornell")
+                create_cornell_scene(world, materials);
+            else
+                create_impressive_scene(world, materials);
+            lights = light_list::collect(world);
 
-    std::cerr << "Scene created with " << world.objects.size() << " objects" << std::endl;
+            std::cerr << "Scene created with " << world.objects.size() << " objects" << std::endl;
 
-    // Build BVH
-    std::cerr << "Building BVH..." << std::endl;
-    auto start_time = std::chrono::high_resolution_clock::now();
+            if (frames > 0)
+            {
+                animated = make_shared<animated_scene>();
+                animate_impressive_scene(world, *animated);
+                animated->options = animation;
+                animated->options.build.pool = pool.get();
+                animated->options.compare_rebuild = true;
+                std::cerr << animated->moving_count() << " of them move" << std::endl;
+                bvh_world = animated;
+            }
+            else if (!snapshot_out.empty())
+            {
+                // the snapshot's build is the only one: the render traces the file it wrote, so what
+                // was saved is exactly what was rendered
+                bvh_build_options build_options;
+                build_options.pool = pool.get();
+                bvh_build_stats built = save_scene_snapshot(snapshot_out, world, build_options);
+                std::cerr << "BVH built in " << built.build_ms << " ms (" << built.node_count << " nodes, SAH cost "
+                          << built.sah_cost << "), snapshot saved to " << snapshot_out << std::endl;
+                auto snapshot = make_shared<scene_snapshot>(snapshot_out);
+                lights = snapshot->lights();
+                bvh_world = snapshot;
+            }
+            else
+            {
+                // Build BVH
+                std::cerr << "Building BVH..." << std::endl;
+                auto start_time = std::chrono::high_resolution_clock::now();
 
-    auto bvh_world = make_shared<bvh_node>(world);
+                bvh_build_options build_options;
+                build_options.pool = pool.get();
+                auto bvh = make_shared<linear_bvh>(world, build_options);
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    std::cerr << "BVH built in " << duration.count() << " ms" << std::endl;
+                auto end_time = std::chrono::high_resolution_clock::now();
+                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+                std::cerr << "BVH built in " << duration.count() << " ms (" << bvh->stats().node_count
+                          << " nodes, SAH cost " << bvh->stats().sah_cost << ")" << std::endl;
+                bvh_world = bvh;
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
 
     // Camera
     camera cam;
@@ -105,7 +276,7 @@ int main()
     // cam.focus_dist = 3.4;
     cam.aspect_ratio = 16.0 / 9.0;
     cam.image_width = 800;      // Higher resolution
-    cam.samples_per_pixel = 50; // change samples per pixel to larger numbr for mor accurate image, but for runtime purposes and my laptop not dying, let's go with this for now
+    cam.samples_per_pixel = samples_per_pixel; // 50 by default, change samples per pixel to larger numbr for mor accurate image, but for runtime purposes and my laptop not dying, let's go with this for now
     cam.max_depth = 50;
 
     cam.vfov = 20;
@@ -115,15 +286,95 @@ int main()
 
     cam.defocus_angle = 0.6; // Add depth of field
     cam.focus_dist = 10.0;
+    if (scene_name == "cornell")
+    {
+        cam.aspect_ratio = 1.0;
+        cam.image_width = 600;
+        cam.vfov = 40;
+        cam.lookfrom = point3(278, 278, -800);
+        cam.lookat = point3(278, 278, 0);
+        cam.defocus_angle = 0;
+        cam.sky_brightness = 0;
+    }
+    file_view.apply(cam);
+    if (samples_given)
+        cam.samples_per_pixel = samples_per_pixel;
+    cam.lights = lights;
+    cam.direct_light = direct_light;
+    cam.pool = pool;
+    cam.integrator = integrator;
+    cam.rr_min_depth = rr_min_depth;
+    cam.packet_size = packet_size;
+    cam.output_format = output_format;
+    cam.output_path = output_path;
+    cam.pass_samples = pass_samples;
+    cam.time_budget = time_budget;
+    cam.preview_interval = preview_interval;
+    cam.checkpoint_path = checkpoint_path;
+    cam.resume = resume;
+    cam.adaptive_threshold = adaptive_threshold;
+    cam.adaptive_min_samples = adaptive_min_samples;
+    cam.sample_map_path = sample_map_path;
+    cam.cost_map_path = cost_map_path;
+    cam.use_denoiser = use_denoiser;
+    cam.feature_prefix = feature_prefix;
+    cam.feature_samples = feature_samples;
 
     std::cerr << "Starting render..." << std::endl;
-    start_time = std::chrono::high_resolution_clock::now();
+    auto start_time = std::chrono::high_resolution_clock::now();
 
     // Render with BVH
-    cam.render(*bvh_world);
+    try
+    {
+        if (!worker_address.empty())
+        {
+            run_render_worker(worker_address, cam, *bvh_world);
+            return 0;
+        }
+        if (!coordinator_address.empty())
+        {
+            render_coordinator coordinator(coordinator_address);
+            std::cerr << "Waiting for workers on " << coordinator.address() << std::endl;
+            distributed_stats run;
+            accumulation_buffer samples = coordinator.render(cam, *bvh_world, distributed, &run);
+            path_stats stats;
+            stats.samples = samples.total_samples();
+            stats.segments = run.segments;
+            stats.seconds = run.seconds;
+            cam.render_from(*bvh_world, samples, stats);
+        }
+        else if (animated)
+        {
+            // per frame: move, refit (or rebuild), render. the full build every frame would have cost is
+            // timed alongside, so the two can be compared
+            double update_ms = 0, rebuild_ms = 0;
+            for (int frame = 0; frame < frames; frame++)
+            {
+                frame_update update = animated->set_time(frame / fps);
+                std::cerr << "Frame " << frame << ": " << (update.rebuilt ? "rebuilt" : "refitted") << ", move "
+                          << update.move_ms << " ms, refit " << update.refit_ms << " ms (SAH cost "
+                          << update.refit_sah << "), full build " << update.rebuild_ms << " ms (SAH cost "
+                          << update.rebuild_sah << ")" << std::endl;
+                update_ms += update.move_ms + update.refit_ms + (update.rebuilt ? update.rebuild_ms : 0);
+                rebuild_ms += update.rebuild_ms;
 
-    end_time = std::chrono::high_resolution_clock::now();
-    auto render_duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+                cam.output_path = frame_output_path(output_path, frame);
+                cam.render(*bvh_world);
+            }
+            std::cerr << frames << " frames, " << animated->rebuild_count() << " builds: BVH updates took "
+                      << update_ms << " ms in all, a full build every frame " << rebuild_ms << " ms" << std::endl;
+        }
+        else
+            cam.render(*bvh_world);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> render_duration = end_time - start_time;
     std::cerr << "Render completed in " << render_duration.count() << " seconds" << std::endl;
 
     return 0;
@@ -3,6 +3,8 @@
 
 #include "hittable.h"
 #include "color.h"
+#include <utility>
+#include <vector>
 
 // if we want diff objects to have diff materials, we can
 //  1) produce scatered ray
@@ -20,6 +22,28 @@ public:
     {
         return false;
     }
+
+    // small number per material class, below max_kinds. the wavefront renderer groups hits by it so
+    // a whole run of paths goes through the same scatter() code
+    virtual int kind() const { return 0; }
+    static constexpr int max_kinds = 16;
+
+    // the surface's own color for the denoiser's albedo buffer, white for materials without one
+    virtual color surface_albedo() const { return color(1, 1, 1); }
+
+    // light the surface gives off towards r_in's origin, black for everything but emitters
+    virtual color emitted(const ray &r_in, const hit_record &rec) const { return color(0, 0, 0); }
+
+    // light sampling (camera.h, lights.h) needs the BSDF as a function, not only as scatter(). materials
+    // with has_pdf() draw scatter()'s direction with density scattering_pdf() (per solid angle) and
+    // evaluate() gives the BSDF times the cosine for any direction. mirror-like materials have no usable
+    // density, their bounces skip light sampling and count the emission they hit in full.
+    virtual bool has_pdf() const { return false; }
+    virtual double scattering_pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const { return 0; }
+    virtual color evaluate(const ray &r_in, const hit_record &rec, const vec3 &direction) const
+    {
+        return color(0, 0, 0);
+    }
 };
 
 class lambertian : public material
@@ -40,6 +64,23 @@ public:
         return true;
     };
 
+    int kind() const override { return 1; }
+    color surface_albedo() const override { return albedo; }
+
+    // normal + a random unit vector is cosine distributed around the normal: cos / pi
+    bool has_pdf() const override { return true; }
+    double scattering_pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const override
+    {
+        double cosine = dot(rec.normal, unit_vector(direction));
+        return cosine > 0 ? cosine / pi : 0.0;
+    }
+    color evaluate(const ray &r_in, const hit_record &rec, const vec3 &direction) const override
+    {
+        return real(scattering_pdf(r_in, rec, direction)) * albedo;
+    }
+
+    const color &get_albedo() const { return albedo; }
+
 private:
     color albedo;
 };
@@ -63,6 +104,12 @@ public:
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    int kind() const override { return 2; }
+    color surface_albedo() const override { return albedo; }
+
+    const color &get_albedo() const { return albedo; }
+    double get_fuzz() const { return fuzz; }
+
 private:
     color albedo;
     double fuzz;
@@ -101,6 +148,10 @@ public:
         return true;
     }
 
+    int kind() const override { return 3; }
+
+    double get_refraction_index() const { return refraction_index; }
+
 private:
     // refractive index in vacuum or air, or the ratio of the material's refractive index over
     // the refractive index of the enclosing media
@@ -114,4 +165,52 @@ private:
         return r0 + (1 - r0) * std::pow((1 - cosine), 5);
     }
 };
+
+// emitter: gives off 'emit' from its front face (the side a sphere's or triangle's outward normal
+// points to) and scatters nothing
+class diffuse_light : public material
+{
+public:
+    diffuse_light(const color &emit) : emit(emit) {}
+
+    color emitted(const ray &r_in, const hit_record &rec) const override
+    {
+        return rec.front_face ? emit : color(0, 0, 0);
+    }
+
+    int kind() const override { return 4; }
+
+    const color &get_emit() const { return emit; }
+
+private:
+    color emit;
+};
+
+// scene-owned storage for materials. the table keeps them alive and everything else (primitives,
+// hit_records) holds plain pointers into it. with shared_ptr copies in every hit, 32 threads were
+// bouncing the same refcount cache lines between cores on every candidate intersection.
+// the table has to outlive the primitives that use it.
+class material_table
+{
+public:
+    template <typename T, typename... Args>
+    const T *make(Args &&...args)
+    {
+        auto m = make_shared<T>(std::forward<Args>(args)...);
+        materials.push_back(m);
+        return m.get();
+    }
+
+    const material *add(shared_ptr<material> m)
+    {
+        materials.push_back(m);
+        return m.get();
+    }
+
+    size_t size() const { return materials.size(); }
+    const material *operator[](size_t id) const { return materials[id].get(); }
+
+private:
+    std::vector<shared_ptr<material>> materials;
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,311 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+// Wavefront OBJ loader filling a triangle_mesh. the file is streamed in large blocks; every block is
+// cut into chunks at line breaks and the chunks are parsed in parallel on a thread_pool (see
+// text_blocks.h). only positions (v), normals (vn), texture coordinates (vt) and faces (f) are read,
+// polygons are fanned into triangles, everything else (groups, materials, smoothing) is skipped.
+// errors throw std::runtime_error with the file name and line number.
+
+#include "text_blocks.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct obj_load_stats
+{
+    double seconds = 0.0;
+    size_t file_bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t mesh_bytes = 0; // triangle_mesh::memory_bytes() after the BVH is built
+};
+
+struct obj_load_options
+{
+    thread_pool *pool = nullptr;            // parse (and build the BVH) in parallel, nullptr = calling thread
+    size_t block_bytes = size_t(64) << 20;  // how much of the file is read at once
+    size_t chunk_bytes = size_t(1) << 20;   // roughly how much text one parse task gets
+    bvh_build_options bvh;                  // options for the mesh BVH (its pool defaults to the one above)
+};
+
+namespace obj_detail
+{
+    // one face corner as written in the file. indices are 1-based, or negative counting back from the
+    // newest element; negative ones are stored relative to the chunk until its base is known.
+    struct corner
+    {
+        int64_t v = 0, vt = 0, vn = 0;
+        uint8_t relative = 0; // bit 0: v, bit 1: vt, bit 2: vn are chunk relative
+    };
+
+    struct chunk_result
+    {
+        std::vector<float> positions, normals, uvs;
+        std::vector<corner> corners; // 3 per triangle, already fanned
+        std::vector<size_t> triangle_lines; // chunk local, 1-based line of each triangle's face
+        size_t lines = 0;
+        bool all_have_uv = true, all_have_normal = true;
+
+        size_t error_line = 0; // chunk local, 1-based, 0 = no error
+        std::string error;
+    };
+
+    inline const char *skip_spaces(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        return p;
+    }
+
+    inline bool parse_float(const char *&p, const char *end, float &out)
+    {
+        p = skip_spaces(p, end);
+        if (p < end && *p == '+')
+            p++;
+        auto result = std::from_chars(p, end, out);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    inline bool parse_int(const char *&p, const char *end, int64_t &out)
+    {
+        auto result = std::from_chars(p, end, out);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // resolve one index. 'count' is how many elements of that kind the chunk had read so far
+    inline bool resolve(int64_t raw, size_t count, int64_t &value, uint8_t &relative, uint8_t bit)
+    {
+        if (raw > 0)
+        {
+            value = raw - 1;
+        }
+        else if (raw < 0)
+        {
+            value = int64_t(count) + raw; // still needs the chunk's base added
+            relative |= bit;
+        }
+        else
+        {
+            return false; // 0 is never a valid OBJ index
+        }
+        return true;
+    }
+
+    inline void parse_chunk(const char *begin, const char *end, chunk_result &out)
+    {
+        const char *p = begin;
+        std::vector<corner> polygon;
+
+        while (p < end)
+        {
+            const char *eol = static_cast<const char *>(std::memchr(p, '\n', size_t(end - p)));
+            if (!eol)
+                eol = end;
+            out.lines++;
+
+            const char *q = skip_spaces(p, eol);
+            auto fail = [&](const char *message)
+            {
+                out.error_line = out.lines;
+                out.error = message;
+            };
+
+            if (q + 1 < eol && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t'))
+            {
+                q += 1;
+                float x, y, z;
+                if (!parse_float(q, eol, x) || !parse_float(q, eol, y) || !parse_float(q, eol, z))
+                    return fail("bad vertex position");
+                out.positions.insert(out.positions.end(), {x, y, z});
+            }
+            else if (q + 2 < eol && q[0] == 'v' && q[1] == 'n')
+            {
+                q += 2;
+                float x, y, z;
+                if (!parse_float(q, eol, x) || !parse_float(q, eol, y) || !parse_float(q, eol, z))
+                    return fail("bad vertex normal");
+                out.normals.insert(out.normals.end(), {x, y, z});
+            }
+            else if (q + 2 < eol && q[0] == 'v' && q[1] == 't')
+            {
+                q += 2;
+                float u, v = 0;
+                if (!parse_float(q, eol, u))
+                    return fail("bad texture coordinate");
+                parse_float(q, eol, v); // v is optional in the spec
+                out.uvs.insert(out.uvs.end(), {u, v});
+            }
+            else if (q + 1 < eol && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t'))
+            {
+                q += 1;
+                polygon.clear();
+                while (true)
+                {
+                    q = skip_spaces(q, eol);
+                    if (q >= eol)
+                        break;
+
+                    corner c;
+                    int64_t raw;
+                    if (!parse_int(q, eol, raw) || !resolve(raw, out.positions.size() / 3, c.v, c.relative, 1))
+                        return fail("bad face vertex index");
+
+                    bool has_uv = false, has_normal = false;
+                    if (q < eol && *q == '/')
+                    {
+                        q++;
+                        if (q < eol && *q != '/')
+                        {
+                            if (!parse_int(q, eol, raw) || !resolve(raw, out.uvs.size() / 2, c.vt, c.relative, 2))
+                                return fail("bad face texture coordinate index");
+                            has_uv = true;
+                        }
+                        if (q < eol && *q == '/')
+                        {
+                            q++;
+                            if (!parse_int(q, eol, raw) || !resolve(raw, out.normals.size() / 3, c.vn, c.relative, 4))
+                                return fail("bad face normal index");
+                            has_normal = true;
+                        }
+                    }
+                    out.all_have_uv &= has_uv;
+                    out.all_have_normal &= has_normal;
+                    polygon.push_back(c);
+                }
+
+                if (polygon.size() < 3)
+                    return fail("face with fewer than 3 vertices");
+
+                // fan triangulation
+                for (size_t k = 1; k + 1 < polygon.size(); k++)
+                {
+                    out.corners.insert(out.corners.end(), {polygon[0], polygon[k], polygon[k + 1]});
+                    out.triangle_lines.push_back(out.lines);
+                }
+            }
+            // anything else (comments, o, g, s, usemtl, mtllib, blank lines) is skipped
+
+            p = eol + 1;
+        }
+    }
+}
+
+// load an OBJ file into a mesh with the given material and build its BVH
+inline shared_ptr<triangle_mesh> load_obj(const std::string &path, const material *mat,
+                                          const obj_load_options &options = {}, obj_load_stats *stats = nullptr)
+{
+    using namespace obj_detail;
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error(path + ": cannot open file");
+
+    auto mesh = make_shared<triangle_mesh>(mat);
+    std::vector<corner> corners;
+    std::vector<size_t> triangle_lines; // file line of each triangle's face, for errors
+    bool all_have_uv = true, all_have_normal = true;
+    size_t lines_before = 0;
+
+    size_t file_bytes = parse_text_blocks<chunk_result>(
+        file, options.block_bytes, options.chunk_bytes, options.pool, parse_chunk,
+        [&](std::vector<chunk_result> &results)
+        {
+            // stitch the chunks together in file order, now that each chunk's base offsets are known
+            for (auto &chunk : results)
+            {
+                if (chunk.error_line)
+                    throw std::runtime_error(path + ":" + std::to_string(lines_before + chunk.error_line) + ": " + chunk.error);
+
+                int64_t v_base = int64_t(mesh->positions.size() / 3);
+                int64_t vt_base = int64_t(mesh->uvs.size() / 2);
+                int64_t vn_base = int64_t(mesh->normals.size() / 3);
+
+                for (corner c : chunk.corners)
+                {
+                    if (c.relative & 1)
+                        c.v += v_base;
+                    if (c.relative & 2)
+                        c.vt += vt_base;
+                    if (c.relative & 4)
+                        c.vn += vn_base;
+                    c.relative = 0;
+                    corners.push_back(c);
+                }
+                for (size_t line : chunk.triangle_lines)
+                    triangle_lines.push_back(lines_before + line);
+
+                mesh->positions.insert(mesh->positions.end(), chunk.positions.begin(), chunk.positions.end());
+                mesh->normals.insert(mesh->normals.end(), chunk.normals.begin(), chunk.normals.end());
+                mesh->uvs.insert(mesh->uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+                all_have_uv &= chunk.all_have_uv;
+                all_have_normal &= chunk.all_have_normal;
+                lines_before += chunk.lines;
+            }
+        });
+
+    // indices can only be checked once every vertex has been read, forward references are legal
+    size_t nv = mesh->positions.size() / 3, nvt = mesh->uvs.size() / 2, nvn = mesh->normals.size() / 3;
+    all_have_uv &= nvt > 0;
+    all_have_normal &= nvn > 0;
+
+    mesh->indices.reserve(corners.size());
+    if (all_have_uv)
+        mesh->uv_indices.reserve(corners.size());
+    if (all_have_normal)
+        mesh->normal_indices.reserve(corners.size());
+
+    for (size_t i = 0; i < corners.size(); i++)
+    {
+        const corner &c = corners[i];
+        if (c.v < 0 || size_t(c.v) >= nv || (all_have_uv && (c.vt < 0 || size_t(c.vt) >= nvt)) ||
+            (all_have_normal && (c.vn < 0 || size_t(c.vn) >= nvn)))
+            throw std::runtime_error(path + ":" + std::to_string(triangle_lines[i / 3]) + ": face index out of range");
+
+        mesh->indices.push_back(uint32_t(c.v));
+        if (all_have_uv)
+            mesh->uv_indices.push_back(uint32_t(c.vt));
+        if (all_have_normal)
+            mesh->normal_indices.push_back(uint32_t(c.vn));
+    }
+    corners = std::vector<corner>();
+    triangle_lines = std::vector<size_t>();
+
+    // data that no face fully uses is dropped rather than half applied
+    if (!all_have_uv)
+        mesh->uvs = std::vector<float>();
+    if (!all_have_normal)
+        mesh->normals = std::vector<float>();
+
+    bvh_build_options bvh = options.bvh;
+    if (!bvh.pool)
+        bvh.pool = options.pool;
+    mesh->build(bvh);
+
+    if (stats)
+    {
+        stats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+        stats->file_bytes = file_bytes;
+        stats->vertices = mesh->vertex_count();
+        stats->triangles = mesh->triangle_count();
+        stats->mesh_bytes = mesh->memory_bytes();
+    }
+
+    return mesh;
+}
+
+#endif
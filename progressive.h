@@ -0,0 +1,294 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+// state of a progressive render: the running sum of every pixel's samples (linear, not yet divided
+// by the sample count) and every pixel's random generator as the last pass left it. a pass adds more
+// samples on top, drawing them from where the generator stopped, so cutting the render into passes,
+// or stopping it and resuming from a checkpoint, adds exactly the same samples in the same order as
+// rendering them all in one go.
+//
+// every pixel also keeps its sample count and the first two moments of its samples' luminance, the
+// variance estimate adaptive sampling uses to decide which pixels still need samples.
+//
+// checkpoint layout (little endian):
+//   checkpoint_header
+//   double[3][width * height]   sums, stored as double whatever real is
+//   xoshiro256[width * height]  generator states
+//   uint32_t[width * height]    sample counts
+//   double[2][width * height]   luminance sum and sum of squares
+
+#include "rng.h"
+#include "color.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+constexpr uint32_t checkpoint_version = 2;
+constexpr uint32_t checkpoint_endian_tag = 0x01020304;
+
+struct checkpoint_header
+{
+    char magic[8];         // "RTCKPT\0\0"
+    uint32_t version;      // checkpoint_version
+    uint32_t endian_tag;   // checkpoint_endian_tag as written by the saving machine
+    uint32_t header_bytes; // sizeof(checkpoint_header)
+    uint32_t scalar_bytes; // sizeof(real) of the renderer that wrote it, the sums only match within one precision
+    uint32_t width, height;
+    uint32_t samples;      // passes so far, in samples per pixel
+    uint32_t pad;
+    uint64_t fingerprint;  // camera settings and scene bounds, see camera::fingerprint
+};
+
+static_assert(std::is_trivially_copyable<xoshiro256>::value && sizeof(xoshiro256) == 32,
+              "checkpoint layout changed, bump checkpoint_version");
+
+// t in [0, 1] on a heat ramp: black through red and yellow to white. the ramp is squared so it survives
+// the image writers' gamma curve.
+inline color heat_color(double t)
+{
+    double r = std::min(1.0, 3 * t), g = std::clamp(3 * t - 1, 0.0, 1.0), b = std::clamp(3 * t - 2, 0.0, 1.0);
+    return color(r * r, g * g, b * b);
+}
+
+// the samples of one rectangle [x0, x1) x [y0, y1) of the image, row by row: what a distributed render
+// job sends back (see distributed.h)
+struct accumulation_region
+{
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    std::vector<color> sum;
+    std::vector<uint32_t> count;
+    std::vector<double> moments; // two per pixel, like accumulation_buffer::moments
+
+    size_t size() const { return size_t(x1 - x0) * size_t(y1 - y0); }
+};
+
+struct accumulation_buffer
+{
+    int width = 0, height = 0;
+    int samples = 0;              // samples per pixel the passes so far added (to every active pixel)
+    std::vector<color> sum;       // per pixel sum of its samples
+    std::vector<xoshiro256> rng;  // per pixel generator, where the next pass continues
+    std::vector<uint32_t> count;  // per pixel samples in the sum, fewer than 'samples' where passes skipped it
+    std::vector<double> moments;  // per pixel sum of the samples' luminance, then of its square
+    std::vector<uint8_t> active;  // pixels the next pass samples, see select()
+
+    // empty sums, every pixel's generator seeded from its index like a one pass render would
+    void reset(int w, int h, uint64_t seed)
+    {
+        width = w;
+        height = h;
+        samples = 0;
+        size_t n = size_t(w) * h;
+        sum.assign(n, color(0, 0, 0));
+        rng.resize(n);
+        for (size_t p = 0; p < n; p++)
+            rng[p].reseed(mix_seed(seed, p));
+        count.assign(n, 0);
+        moments.assign(2 * n, 0.0);
+        active.assign(n, 1);
+    }
+
+    // the average so far into 'image'
+    void resolve(std::vector<color> &image) const
+    {
+        image.resize(sum.size());
+        for (size_t p = 0; p < sum.size(); p++)
+            image[p] = (count[p] > 0 ? 1.0 / count[p] : 0.0) * sum[p];
+    }
+
+    // variance of the pixel's mean luminance, estimated from its samples (0 with fewer than two)
+    double mean_variance(size_t p) const
+    {
+        double n = count[p];
+        if (n < 2)
+            return 0.0;
+        double mean = moments[2 * p] / n;
+        return std::max(0.0, (moments[2 * p + 1] - moments[2 * p] * mean) / (n - 1)) / n;
+    }
+
+    // estimated standard error of the pixel's displayed luminance. the variance of the mean (sample
+    // variance / n) is taken through the derivative of the sqrt gamma curve, so the same threshold
+    // means the same visible noise in dark and bright pixels.
+    double display_error(size_t p) const
+    {
+        if (count[p] < 2)
+            return std::numeric_limits<double>::infinity();
+        double mean = moments[2 * p] / count[p];
+        return std::sqrt(mean_variance(p)) / (2.0 * std::sqrt(std::max(mean, 1e-3)));
+    }
+
+    // mark the pixels the next pass samples: all of them when threshold is 0, otherwise the ones with a
+    // display_error above threshold anywhere in their 3x3 neighbourhood (or too few samples to tell).
+    // a pixel's own estimate is not enough: when a rare path (a small occluder, a caustic) has not shown
+    // up in its samples yet, its variance looks small and it would stop early, biased. the neighbours
+    // most likely did see it. returns how many pixels are marked.
+    size_t select(int min_samples, double threshold)
+    {
+        if (threshold <= 0)
+        {
+            active.assign(sum.size(), 1);
+            return sum.size();
+        }
+
+        std::vector<uint8_t> above(sum.size());
+        for (size_t p = 0; p < sum.size(); p++)
+            above[p] = count[p] < uint32_t(min_samples) || display_error(p) > threshold;
+
+        size_t marked = 0;
+        for (int j = 0; j < height; j++)
+            for (int i = 0; i < width; i++)
+            {
+                uint8_t any = 0;
+                for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); y++)
+                    for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); x++)
+                        any |= above[size_t(y) * width + x];
+                active[size_t(j) * width + i] = any;
+                marked += any;
+            }
+        return marked;
+    }
+
+    // copy the samples of a rectangle out into 'region' (whose bounds say which)
+    void extract(accumulation_region &region) const
+    {
+        region.sum.resize(region.size());
+        region.count.resize(region.size());
+        region.moments.resize(2 * region.size());
+        size_t k = 0;
+        for (int j = region.y0; j < region.y1; j++)
+            for (int i = region.x0; i < region.x1; i++, k++)
+            {
+                size_t p = size_t(j) * width + i;
+                region.sum[k] = sum[p];
+                region.count[k] = count[p];
+                region.moments[2 * k] = moments[2 * p];
+                region.moments[2 * k + 1] = moments[2 * p + 1];
+            }
+    }
+
+    // add a region's samples to the ones already here
+    void add(const accumulation_region &region)
+    {
+        size_t k = 0;
+        for (int j = region.y0; j < region.y1; j++)
+            for (int i = region.x0; i < region.x1; i++, k++)
+            {
+                size_t p = size_t(j) * width + i;
+                sum[p] += region.sum[k];
+                count[p] += region.count[k];
+                moments[2 * p] += region.moments[2 * k];
+                moments[2 * p + 1] += region.moments[2 * k + 1];
+            }
+    }
+
+    uint64_t total_samples() const
+    {
+        uint64_t total = 0;
+        for (uint32_t c : count)
+            total += c;
+        return total;
+    }
+
+    // written to a temporary file next to 'path' and renamed over it, so a run killed mid save still
+    // leaves the previous checkpoint intact
+    void save(const std::string &path, uint64_t fingerprint) const
+    {
+        checkpoint_header header{};
+        std::memcpy(header.magic, "RTCKPT\0\0", 8);
+        header.version = checkpoint_version;
+        header.endian_tag = checkpoint_endian_tag;
+        header.header_bytes = sizeof(checkpoint_header);
+        header.scalar_bytes = sizeof(real);
+        header.width = uint32_t(width);
+        header.height = uint32_t(height);
+        header.samples = uint32_t(samples);
+        header.fingerprint = fingerprint;
+
+        std::vector<double> sums(3 * sum.size());
+        for (size_t p = 0; p < sum.size(); p++)
+            for (int c = 0; c < 3; c++)
+                sums[3 * p + c] = double(sum[p][c]);
+
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out)
+                throw std::runtime_error(temp + ": cannot write checkpoint");
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(sums.data()), std::streamsize(sums.size() * sizeof(double)));
+            out.write(reinterpret_cast<const char *>(rng.data()), std::streamsize(rng.size() * sizeof(xoshiro256)));
+            out.write(reinterpret_cast<const char *>(count.data()), std::streamsize(count.size() * sizeof(uint32_t)));
+            out.write(reinterpret_cast<const char *>(moments.data()), std::streamsize(moments.size() * sizeof(double)));
+            if (!out)
+                throw std::runtime_error(temp + ": error while writing checkpoint");
+        }
+        std::error_code error;
+        std::filesystem::rename(temp, path, error);
+        if (error)
+            throw std::runtime_error(path + ": cannot replace checkpoint (" + error.message() + ")");
+    }
+
+    // replaces this buffer with the checkpoint's, which must come from the same camera and scene
+    void load(const std::string &path, uint64_t fingerprint)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error(path + ": cannot open checkpoint");
+
+        checkpoint_header header{};
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+            throw std::runtime_error(path + ": too small to be a checkpoint");
+        if (std::memcmp(header.magic, "RTCKPT\0\0", 8) != 0)
+            throw std::runtime_error(path + ": not a render checkpoint");
+        if (header.endian_tag != checkpoint_endian_tag)
+            throw std::runtime_error(path + ": checkpoint was written on a machine with different endianness");
+        if (header.version != checkpoint_version)
+            throw std::runtime_error(path + ": checkpoint version " + std::to_string(header.version) +
+                                     ", this build reads version " + std::to_string(checkpoint_version));
+        if (header.header_bytes != sizeof(checkpoint_header) || header.scalar_bytes != sizeof(real))
+            throw std::runtime_error(path + ": checkpoint was written by a build with a different layout or precision");
+        if (header.fingerprint != fingerprint)
+            throw std::runtime_error(path + ": checkpoint belongs to a different scene, camera or integrator");
+
+        size_t n = size_t(header.width) * header.height;
+        std::vector<double> sums(3 * n);
+        rng.resize(n);
+        in.read(reinterpret_cast<char *>(sums.data()), std::streamsize(sums.size() * sizeof(double)));
+        in.read(reinterpret_cast<char *>(rng.data()), std::streamsize(rng.size() * sizeof(xoshiro256)));
+        count.resize(n);
+        moments.resize(2 * n);
+        in.read(reinterpret_cast<char *>(count.data()), std::streamsize(count.size() * sizeof(uint32_t)));
+        in.read(reinterpret_cast<char *>(moments.data()), std::streamsize(moments.size() * sizeof(double)));
+        if (!in || in.peek() != std::char_traits<char>::eof())
+            throw std::runtime_error(path + ": checkpoint is truncated or has trailing data");
+
+        width = int(header.width);
+        height = int(header.height);
+        samples = int(header.samples);
+        sum.resize(n);
+        for (size_t p = 0; p < n; p++)
+            sum[p] = color(real(sums[3 * p]), real(sums[3 * p + 1]), real(sums[3 * p + 2]));
+        active.assign(n, 1);
+    }
+
+    // samples per pixel as a heat map (heat_color), black for none up to white for the most any pixel got
+    void sample_map(std::vector<color> &image) const
+    {
+        uint32_t most = 1;
+        for (uint32_t c : count)
+            most = std::max(most, c);
+        image.resize(count.size());
+        for (size_t p = 0; p < count.size(); p++)
+            image[p] = heat_color(double(count[p]) / most);
+    }
+};
+
+#endif
@@ -3,24 +3,27 @@
 
 #include "vec3.h"
 
-class ray
+template <typename T>
+class ray_t
 {
 public:
-    ray() {}
+    ray_t() {}
 
-    ray(const point3 &origin, const vec3 &direction) : orig(origin), dir(direction) {}
+    ray_t(const vec3_t<T> &origin, const vec3_t<T> &direction) : orig(origin), dir(direction) {}
 
-    const point3 &origin() const { return orig; }
-    const vec3 &direction() const { return dir; }
+    const vec3_t<T> &origin() const { return orig; }
+    const vec3_t<T> &direction() const { return dir; }
 
-    point3 at(double t) const
+    vec3_t<T> at(T t) const
     {
         return orig + t * dir;
     }
 
 private:
-    point3 orig;
-    vec3 dir;
+    vec3_t<T> orig;
+    vec3_t<T> dir;
 };
 
+using ray = ray_t<real>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+// coherent ray packets: 4, 8 or 16 rays (camera rays of neighbouring pixels) walk a linear_bvh
+// together. the packet shares one traversal stack, every node box is tested against all of its
+// active rays at once with SSE/AVX (one ray per lane), and spheres in the leaves get a SIMD
+// discriminant test across the packet before the exact double precision sphere::hit of the rays
+// that may hit. once only a few rays of a packet still want a subtree, the packet has diverged and
+// those rays walk that subtree on their own with the normal single ray traversal.
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "trace_stats.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+template <int N>
+struct ray_packet
+{
+    static_assert(N == 4 || N == 8 || N == 16, "ray packets are 4, 8 or 16 rays");
+
+    // SoA, one lane per ray
+    alignas(32) float org[3][N];
+    alignas(32) float dir[3][N];
+    alignas(32) float inv_dir[3][N];
+    alignas(32) float tmin[N];
+    alignas(32) float tmax[N]; // shrinks as the rays find hits
+};
+
+class packet_tracer
+{
+public:
+    // rays per packet that make the rest walk alone: 1 of 4, 2 of 8, 4 of 16
+    static constexpr int divergence_divisor = 4;
+
+    explicit packet_tracer(const linear_bvh &bvh) : bvh(bvh)
+    {
+        // the sphere test needs the geometry in float, found once here instead of per ray
+        spheres.resize(bvh.object_count());
+        for (size_t slot = 0; slot < bvh.object_count(); slot++)
+        {
+            auto s = dynamic_cast<const sphere *>(&bvh.object(slot));
+            if (s)
+                spheres[slot] = packed_sphere{float(s->get_center().x()), float(s->get_center().y()),
+                                              float(s->get_center().z()), float(s->get_radius())};
+            else
+                spheres[slot] = packed_sphere{0, 0, 0, -1};
+        }
+    }
+
+    // closest hit within ray_t for every ray whose bit is set in 'active'. recs[k] is filled in for
+    // the rays that hit, and those are the bits of the returned mask.
+    template <int N>
+    uint32_t hit(const ray *rays, uint32_t active, const interval &ray_t, hit_record *recs) const
+    {
+        const auto &nodes = bvh.acceleration().nodes;
+        if (nodes.empty() || active == 0)
+            return 0;
+
+        ray_packet<N> packet;
+        interval lane_t[N];
+        for (int k = 0; k < N; k++)
+        {
+            const ray &r = rays[(active & (1u << k)) ? k : first_lane(active)]; // idle lanes copy a live ray
+            for (int a = 0; a < 3; a++)
+            {
+                packet.org[a][k] = float(r.origin()[a]);
+                packet.dir[a][k] = float(r.direction()[a]);
+                packet.inv_dir[a][k] = float(1.0 / r.direction()[a]);
+            }
+            packet.tmin[k] = float(ray_t.min);
+            packet.tmax[k] = float(ray_t.max);
+            lane_t[k] = ray_t;
+        }
+
+        struct entry
+        {
+            uint32_t node;
+            uint32_t mask; // rays that reached this node
+        };
+        entry stack[2 * bvh_tree::max_depth];
+        int sp = 0;
+        stack[sp++] = entry{0, active};
+        uint32_t hits = 0;
+
+        while (sp > 0)
+        {
+            entry e = stack[--sp];
+            const linear_bvh_node &node = nodes[e.node];
+            RT_STAT(nodes_visited);
+            RT_STAT_ADD(box_tests, popcount(e.mask));
+            uint32_t mask = intersect_box<N>(node, packet, e.mask);
+            if (mask == 0)
+                continue;
+
+            if (popcount(mask) * divergence_divisor <= N)
+            {
+                // diverged: the few rays left finish this subtree one at a time
+                for (uint32_t m = mask; m; m &= m - 1)
+                {
+                    int k = first_lane(m);
+                    bool hit_here = bvh_tree::traverse_from(nodes.data(), e.node, rays[k], lane_t[k],
+                                                            [&](uint32_t slot, interval &t)
+                                                            {
+                        if (!bvh.object(slot).hit(rays[k], t, recs[k]))
+                            return false;
+                        t.max = recs[k].t;
+                        return true; });
+                    if (hit_here)
+                        record_hit(k, recs[k].t, packet, lane_t, hits);
+                }
+                continue;
+            }
+
+            if (node.prim_count > 0)
+            {
+                for (uint32_t i = 0; i < node.prim_count; i++)
+                    test_leaf<N>(node.offset + i, mask, rays, packet, lane_t, recs, hits);
+                continue;
+            }
+
+            // nearer child first, going by the direction of the first live ray
+            bool neg = packet.dir[node.axis][first_lane(mask)] < 0;
+            uint32_t near_child = neg ? node.offset : e.node + 1;
+            uint32_t far_child = neg ? e.node + 1 : node.offset;
+            stack[sp++] = entry{far_child, mask};
+            stack[sp++] = entry{near_child, mask};
+        }
+
+        return hits;
+    }
+
+private:
+    struct packed_sphere
+    {
+        float cx, cy, cz, radius; // radius < 0: the object is not a sphere
+    };
+
+    const linear_bvh &bvh;
+    std::vector<packed_sphere> spheres; // by slot
+
+    // same margin as wide_bvh: float rounding must not make a ray miss a box it touches
+    static constexpr float far_scale = 1.00001f;
+
+    static int first_lane(uint32_t mask)
+    {
+        int k = 0;
+        while (!(mask & (1u << k)))
+            k++;
+        return k;
+    }
+
+    static int popcount(uint32_t mask)
+    {
+        int count = 0;
+        for (; mask; mask &= mask - 1)
+            count++;
+        return count;
+    }
+
+    template <int N>
+    static void record_hit(int k, double t, ray_packet<N> &packet, interval *lane_t, uint32_t &hits)
+    {
+        lane_t[k].max = t;
+        packet.tmax[k] = float(t);
+        hits |= 1u << k;
+    }
+
+    // slab test of one box against every ray in 'mask', returns the rays that enter it. the slabs are
+    // ordered per lane with min/max because rays in a packet need not share direction signs.
+    template <int N>
+    static uint32_t intersect_box(const linear_bvh_node &node, const ray_packet<N> &p, uint32_t mask)
+    {
+        uint32_t result = 0;
+        int g = 0;
+#if defined(__AVX__)
+        for (; g + 8 <= N; g += 8)
+        {
+            if (((mask >> g) & 0xff) == 0)
+                continue;
+            __m256 tn = _mm256_load_ps(p.tmin + g);
+            __m256 tf = _mm256_load_ps(p.tmax + g);
+            for (int a = 0; a < 3; a++)
+            {
+                __m256 o = _mm256_load_ps(p.org[a] + g);
+                __m256 inv = _mm256_load_ps(p.inv_dir[a] + g);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds_min[a]), o), inv);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds_max[a]), o), inv);
+                tn = _mm256_max_ps(_mm256_min_ps(t0, t1), tn); // NaN slabs (0 * inf) leave the running value alone
+                tf = _mm256_min_ps(_mm256_max_ps(t0, t1), tf);
+            }
+            __m256 hit = _mm256_cmp_ps(tn, _mm256_mul_ps(tf, _mm256_set1_ps(far_scale)), _CMP_LE_OQ);
+            result |= uint32_t(_mm256_movemask_ps(hit)) << g;
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; g + 4 <= N; g += 4)
+        {
+            if (((mask >> g) & 0xf) == 0)
+                continue;
+            __m128 tn = _mm_load_ps(p.tmin + g);
+            __m128 tf = _mm_load_ps(p.tmax + g);
+            for (int a = 0; a < 3; a++)
+            {
+                __m128 o = _mm_load_ps(p.org[a] + g);
+                __m128 inv = _mm_load_ps(p.inv_dir[a] + g);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_min[a]), o), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bounds_max[a]), o), inv);
+                tn = _mm_max_ps(_mm_min_ps(t0, t1), tn);
+                tf = _mm_min_ps(_mm_max_ps(t0, t1), tf);
+            }
+            __m128 hit = _mm_cmple_ps(tn, _mm_mul_ps(tf, _mm_set1_ps(far_scale)));
+            result |= uint32_t(_mm_movemask_ps(hit)) << g;
+        }
+#endif
+        for (; g < N; g++)
+        {
+            float tn = p.tmin[g], tf = p.tmax[g];
+            for (int a = 0; a < 3; a++)
+            {
+                float t0 = (node.bounds_min[a] - p.org[a][g]) * p.inv_dir[a][g];
+                float t1 = (node.bounds_max[a] - p.org[a][g]) * p.inv_dir[a][g];
+                float near_t = t0 < t1 ? t0 : t1, far_t = t0 < t1 ? t1 : t0;
+                tn = near_t > tn ? near_t : tn;
+                tf = far_t < tf ? far_t : tf;
+            }
+            if (tn <= tf * far_scale)
+                result |= 1u << g;
+        }
+        return result & mask;
+    }
+
+    // rays of 'mask' whose line might touch the sphere: the discriminant of the float quadratic,
+    // with a generous tolerance since only the double precision hit afterwards is trusted
+    template <int N>
+    static uint32_t sphere_candidates(const packed_sphere &s, const ray_packet<N> &p, uint32_t mask)
+    {
+        uint32_t result = 0;
+        int g = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128 r2 = _mm_set1_ps(s.radius * s.radius);
+        const __m128 tolerance = _mm_set1_ps(1e-5f);
+        for (; g + 4 <= N; g += 4)
+        {
+            if (((mask >> g) & 0xf) == 0)
+                continue;
+            __m128 ocx = _mm_sub_ps(_mm_set1_ps(s.cx), _mm_load_ps(p.org[0] + g));
+            __m128 ocy = _mm_sub_ps(_mm_set1_ps(s.cy), _mm_load_ps(p.org[1] + g));
+            __m128 ocz = _mm_sub_ps(_mm_set1_ps(s.cz), _mm_load_ps(p.org[2] + g));
+            __m128 dx = _mm_load_ps(p.dir[0] + g), dy = _mm_load_ps(p.dir[1] + g), dz = _mm_load_ps(p.dir[2] + g);
+
+            __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+            __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+            __m128 c = _mm_sub_ps(oc2, r2);
+
+            __m128 hh = _mm_mul_ps(h, h);
+            __m128 disc = _mm_sub_ps(hh, _mm_mul_ps(a, c));
+            __m128 slack = _mm_mul_ps(tolerance, _mm_add_ps(hh, _mm_mul_ps(a, _mm_add_ps(oc2, r2))));
+            __m128 maybe = _mm_cmpge_ps(_mm_add_ps(disc, slack), _mm_setzero_ps());
+            result |= uint32_t(_mm_movemask_ps(maybe)) << g;
+        }
+#endif
+        for (; g < N; g++)
+        {
+            float ocx = s.cx - p.org[0][g], ocy = s.cy - p.org[1][g], ocz = s.cz - p.org[2][g];
+            float dx = p.dir[0][g], dy = p.dir[1][g], dz = p.dir[2][g];
+            float a = dx * dx + dy * dy + dz * dz;
+            float h = dx * ocx + dy * ocy + dz * ocz;
+            float oc2 = ocx * ocx + ocy * ocy + ocz * ocz;
+            float r2 = s.radius * s.radius;
+            float disc = h * h - a * (oc2 - r2);
+            if (disc + 1e-5f * (h * h + a * (oc2 + r2)) >= 0)
+                result |= 1u << g;
+        }
+        return result & mask;
+    }
+
+    template <int N>
+    void test_leaf(uint32_t slot, uint32_t mask, const ray *rays, ray_packet<N> &packet, interval *lane_t,
+                   hit_record *recs, uint32_t &hits) const
+    {
+        const packed_sphere &s = spheres[slot];
+        uint32_t candidates = s.radius >= 0 ? sphere_candidates<N>(s, packet, mask) : mask;
+        // lanes the packed test ruled out; the candidates are counted by the hit() that confirms them
+        RT_STAT_ADD(primitive_tests, popcount(mask & ~candidates));
+        const hittable &object = bvh.object(slot);
+
+        for (uint32_t m = candidates; m; m &= m - 1)
+        {
+            int k = first_lane(m);
+            if (object.hit(rays[k], lane_t[k], recs[k]))
+                record_hit(k, recs[k].t, packet, lane_t, hits);
+        }
+    }
+};
+
+#endif
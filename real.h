@@ -0,0 +1,41 @@
+#ifndef REAL_H
+#define REAL_H
+
+// scalar type of the geometry: vectors, rays, intervals, boxes and the primitives built on them.
+// double by default, build with -DRT_USE_FLOAT for a float renderer (half the memory per vertex,
+// sphere and hit, twice the SIMD width), e.g. g++ -O2 -DRT_USE_FLOAT -o main main.cpp
+#ifdef RT_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+// tolerances that have to follow the scalar type
+template <typename T>
+struct scalar_traits;
+
+template <>
+struct scalar_traits<double>
+{
+    static constexpr const char *name = "double";
+    static constexpr double ray_t_min = 0.001;        // closest hit a bounce may find, keeps it off its own surface
+    static constexpr double parallel_epsilon = 1e-8;  // triangle determinant below which a ray counts as parallel
+    static constexpr double near_zero = 1e-8;         // vec3::near_zero component threshold
+    static constexpr double min_length_squared = 1e-160; // random_unit_vector rejects shorter samples (underflow)
+};
+
+template <>
+struct scalar_traits<float>
+{
+    // float hit points are off by about 1e-7 of their distance from the origin, so a scene a few hundred
+    // units across needs a bigger step before a bounce may hit again. the triangle determinant of a
+    // unit sized triangle is only good to about 1e-7 in float, so 1e-8 would let near parallel rays
+    // through with garbage barycentrics.
+    static constexpr const char *name = "float";
+    static constexpr float ray_t_min = 0.002f;
+    static constexpr float parallel_epsilon = 1e-6f;
+    static constexpr float near_zero = 1e-6f;
+    static constexpr float min_length_squared = 1e-30f;
+};
+
+#endif
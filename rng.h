@@ -0,0 +1,83 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <atomic>
+#include <cstdint>
+
+// xoshiro256+ (Blackman & Vigna), a tiny and fast generator with 256 bits of state.
+// std::rand() keeps one hidden global state for the whole process, so every worker thread ends up
+// fighting over it. instead every thread owns one of these and never touches anyone else's.
+class xoshiro256
+{
+public:
+    explicit xoshiro256(uint64_t seed = 0) { reseed(seed); }
+
+    // expand a 64 bit seed into the full state with splitmix64, as recommended by the authors
+    void reseed(uint64_t seed)
+    {
+        for (auto &word : s)
+            word = splitmix64(seed);
+    }
+
+    uint64_t next()
+    {
+        const uint64_t result = s[0] + s[3];
+        const uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+    // uniform double in [0,1), the upper 53 bits are the good ones for the + variant
+    double next_double()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+
+    static uint64_t splitmix64(uint64_t &x)
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+// derive an independent stream seed from a base seed and a stream id (thread, tile, pixel...)
+inline uint64_t mix_seed(uint64_t base, uint64_t stream)
+{
+    uint64_t x = base ^ (stream * 0xD1B54A32D192ED03ull);
+    return xoshiro256::splitmix64(x);
+}
+
+// the generator of the calling thread. threads that never call seed_random() still get distinct
+// streams: the first thread to ask (normally main) gets stream 0, the next one stream 1, and so on.
+inline xoshiro256 &thread_rng()
+{
+    static std::atomic<uint64_t> next_stream{0};
+    thread_local xoshiro256 rng(mix_seed(0x5EEDull, next_stream++));
+    return rng;
+}
+
+// reseed the calling thread's generator, renders call this so images don't depend on scheduling
+inline void seed_random(uint64_t seed)
+{
+    thread_rng().reseed(seed);
+}
+
+#endif
@@ -9,6 +9,9 @@
 
 #include <chrono>
 
+#include "real.h"
+#include "rng.h"
+
 // C++ Std Usings
 using std::make_shared;
 using std::shared_ptr;
@@ -16,6 +19,7 @@ using std::shared_ptr;
 // Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
+const real ray_t_min = scalar_traits<real>::ray_t_min; // rays only hit things further away than this
 
 // Utility Functions
 inline double degrees_to_radians(double degrees)
@@ -26,7 +30,8 @@ inline double degrees_to_radians(double degrees)
 inline double random_double()
 {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    // uses the calling thread's own generator (see rng.h), so worker threads never contend on std::rand()
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max)
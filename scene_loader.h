@@ -0,0 +1,586 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+// plain text scene files, one statement per line, '#' starts a comment:
+//
+//   camera lookfrom 278 278 -800 lookat 278 278 0 vup 0 1 0 vfov 40
+//   camera aspect 1 width 600 samples 64 depth 50 defocus 0 focus 10 sky 0
+//   material white lambertian 0.73 0.73 0.73      albedo
+//   material chrome metal 0.8 0.85 0.9 0.05       albedo, fuzz
+//   material glass dielectric 1.5                 refraction index
+//   material panel light 15 15 15                 emitted radiance
+//   sphere 190 90 190 90 glass                    center, radius, material
+//   triangle 0 0 0  555 0 0  0 0 555 white        three corners, material
+//   mesh bunny models/bunny.obj white             an OBJ file (relative to the scene file), only placed by instances
+//   instance bunny scale 2 rotate 0 1 0 45 translate 100 0 100   transforms apply in the order written
+//
+// names are single words looked up in the whole file, so a material can be defined after the
+// primitives that use it, but only once. camera settings the file leaves out keep the camera's own.
+//
+// spheres and triangles, the statements a big scene has millions of, are parsed in parallel chunks
+// (text_blocks.h). every other statement is kept with its line number and carried out once the whole
+// file is read, in file order. the triangles of one material go into one triangle_mesh (float
+// vertices, like an OBJ mesh). errors throw std::runtime_error with the file name and line number.
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "sphere.h"
+#include "text_blocks.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct scene_load_options
+{
+    thread_pool *pool = nullptr;           // parse, load meshes and build their BVHs in parallel, nullptr = calling thread
+    size_t block_bytes = size_t(64) << 20; // how much of the file is read at once
+    size_t chunk_bytes = size_t(1) << 20;  // roughly how much text one parse task gets
+    bvh_build_options bvh;                 // options for the mesh BVHs (their pool defaults to the one above)
+};
+
+struct scene_load_stats
+{
+    double seconds = 0.0;       // the whole load, mesh files and BVH builds included
+    double parse_seconds = 0.0; // reading and parsing the scene file itself
+    size_t file_bytes = 0;
+    size_t lines = 0;
+    size_t materials = 0, spheres = 0, triangles = 0, meshes = 0, instances = 0;
+
+    size_t primitives() const { return spheres + triangles; }
+    double primitives_per_second() const { return parse_seconds > 0 ? primitives() / parse_seconds : 0.0; }
+};
+
+// the camera statements of a scene file, applied over a camera's own settings
+struct scene_view
+{
+    std::optional<point3> lookfrom, lookat;
+    std::optional<vec3> vup;
+    std::optional<double> vfov, aspect_ratio, defocus_angle, focus_dist, sky_brightness;
+    std::optional<int> image_width, samples_per_pixel, max_depth;
+
+    void apply(camera &cam) const
+    {
+        if (lookfrom)
+            cam.lookfrom = *lookfrom;
+        if (lookat)
+            cam.lookat = *lookat;
+        if (vup)
+            cam.vup = *vup;
+        if (vfov)
+            cam.vfov = *vfov;
+        if (aspect_ratio)
+            cam.aspect_ratio = *aspect_ratio;
+        if (defocus_angle)
+            cam.defocus_angle = *defocus_angle;
+        if (focus_dist)
+            cam.focus_dist = *focus_dist;
+        if (sky_brightness)
+            cam.sky_brightness = *sky_brightness;
+        if (image_width)
+            cam.image_width = *image_width;
+        if (samples_per_pixel)
+            cam.samples_per_pixel = *samples_per_pixel;
+        if (max_depth)
+            cam.max_depth = *max_depth;
+    }
+};
+
+namespace scene_detail
+{
+    struct sphere_record
+    {
+        double center[3];
+        double radius;
+        uint32_t name; // index into the chunk's names, after stitching into the file's
+    };
+
+    struct triangle_record
+    {
+        float corners[9];
+        uint32_t name;
+    };
+
+    // a statement carried out after parsing, with its line (chunk local until stitched)
+    struct statement
+    {
+        size_t line;
+        std::string text;
+    };
+
+    struct chunk_result
+    {
+        std::vector<sphere_record> spheres;
+        std::vector<triangle_record> triangles;
+        std::vector<std::string> names;  // material names the primitives use
+        std::vector<size_t> name_lines;  // where each of them is first used
+        std::vector<statement> statements;
+        size_t lines = 0;
+
+        size_t error_line = 0; // chunk local, 1-based, 0 = no error
+        std::string error;
+    };
+
+    inline const char *skip_spaces(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        return p;
+    }
+
+    inline std::string_view next_word(const char *&p, const char *end)
+    {
+        p = skip_spaces(p, end);
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        return std::string_view(start, size_t(p - start));
+    }
+
+    template <typename T>
+    inline bool parse_number(const char *&p, const char *end, T &out)
+    {
+        p = skip_spaces(p, end);
+        if (p < end && *p == '+')
+            p++;
+        auto result = std::from_chars(p, end, out);
+        if (result.ec != std::errc() || (result.ptr < end && *result.ptr != ' ' && *result.ptr != '\t' && *result.ptr != '\r'))
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    inline void parse_chunk(const char *begin, const char *end, chunk_result &out)
+    {
+        const char *p = begin;
+        std::unordered_map<std::string, uint32_t> ids;
+        std::string_view last_name;
+        uint32_t last_id = 0;
+
+        // material names repeat in long runs, the last one is checked before the map
+        auto name_id = [&](std::string_view name)
+        {
+            if (!out.names.empty() && name == last_name)
+                return last_id;
+            auto it = ids.emplace(std::string(name), uint32_t(out.names.size())).first;
+            if (it->second == out.names.size())
+            {
+                out.names.emplace_back(name);
+                out.name_lines.push_back(out.lines);
+            }
+            last_name = name;
+            last_id = it->second;
+            return last_id;
+        };
+
+        while (p < end)
+        {
+            const char *eol = static_cast<const char *>(std::memchr(p, '\n', size_t(end - p)));
+            if (!eol)
+                eol = end;
+            out.lines++;
+            const char *comment = static_cast<const char *>(std::memchr(p, '#', size_t(eol - p)));
+            const char *stop = comment ? comment : eol;
+
+            auto fail = [&](const std::string &message)
+            {
+                out.error_line = out.lines;
+                out.error = message;
+            };
+
+            const char *q = p;
+            std::string_view word = next_word(q, stop);
+            if (word == "sphere")
+            {
+                sphere_record s;
+                if (!parse_number(q, stop, s.center[0]) || !parse_number(q, stop, s.center[1]) ||
+                    !parse_number(q, stop, s.center[2]) || !parse_number(q, stop, s.radius))
+                    return fail("sphere needs a center and a radius");
+                std::string_view name = next_word(q, stop);
+                if (name.empty())
+                    return fail("sphere needs a material");
+                if (!next_word(q, stop).empty())
+                    return fail("unexpected text after sphere");
+                s.name = name_id(name);
+                out.spheres.push_back(s);
+            }
+            else if (word == "triangle")
+            {
+                triangle_record t;
+                for (float &c : t.corners)
+                    if (!parse_number(q, stop, c))
+                        return fail("triangle needs three corners");
+                std::string_view name = next_word(q, stop);
+                if (name.empty())
+                    return fail("triangle needs a material");
+                if (!next_word(q, stop).empty())
+                    return fail("unexpected text after triangle");
+                t.name = name_id(name);
+                out.triangles.push_back(t);
+            }
+            else if (word == "camera" || word == "material" || word == "mesh" || word == "instance")
+            {
+                out.statements.push_back({out.lines, std::string(word.data(), size_t(stop - word.data()))});
+            }
+            else if (!word.empty())
+            {
+                return fail("unknown statement '" + std::string(word) + "'");
+            }
+
+            p = eol + 1;
+        }
+    }
+
+    // the words of one of the statements carried out after parsing, errors tagged with its line
+    class statement_reader
+    {
+    public:
+        statement_reader(const std::string &path, const statement &s)
+            : path(path), line(s.line), p(s.text.data()), end(s.text.data() + s.text.size()) {}
+
+        bool at_end() { return skip_spaces(p, end) == end; }
+
+        std::string word(const char *what)
+        {
+            std::string_view w = next_word(p, end);
+            if (w.empty())
+                fail(std::string("expected ") + what);
+            return std::string(w);
+        }
+
+        double number(const char *what)
+        {
+            double value;
+            if (!parse_number(p, end, value))
+                fail(std::string("expected ") + what);
+            return value;
+        }
+
+        // true (and the number in 'value') when the next word is a number, nothing read otherwise
+        bool maybe_number(double &value)
+        {
+            const char *saved = p;
+            if (parse_number(p, end, value))
+                return true;
+            p = saved;
+            return false;
+        }
+
+        vec3 vector(const char *what)
+        {
+            double x = number(what), y = number(what), z = number(what);
+            return vec3(real(x), real(y), real(z));
+        }
+
+        [[noreturn]] void fail(const std::string &message) const
+        {
+            throw std::runtime_error(path + ":" + std::to_string(line) + ": " + message);
+        }
+
+    private:
+        const std::string &path;
+        size_t line;
+        const char *p, *end;
+    };
+}
+
+// load a scene file into 'world' (its materials into 'materials') and return its camera settings
+inline scene_view load_scene(const std::string &path, hittable_list &world, material_table &materials,
+                             const scene_load_options &options = {}, scene_load_stats *stats = nullptr)
+{
+    using namespace scene_detail;
+    using clock = std::chrono::high_resolution_clock;
+    auto start_time = clock::now();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error(path + ": cannot open file");
+
+    // the chunks are kept, with their names renumbered into the file's
+    std::vector<chunk_result> chunks;
+    std::vector<statement> statements;
+    std::unordered_map<std::string, uint32_t> name_ids;
+    std::vector<std::string> names;
+    std::vector<size_t> name_lines;
+    size_t lines_before = 0;
+
+    size_t file_bytes = parse_text_blocks<chunk_result>(
+        file, options.block_bytes, options.chunk_bytes, options.pool, parse_chunk,
+        [&](std::vector<chunk_result> &results)
+        {
+            for (auto &chunk : results)
+            {
+                if (chunk.error_line)
+                    throw std::runtime_error(path + ":" + std::to_string(lines_before + chunk.error_line) + ": " + chunk.error);
+
+                std::vector<uint32_t> remap(chunk.names.size());
+                for (size_t n = 0; n < chunk.names.size(); n++)
+                {
+                    auto it = name_ids.emplace(chunk.names[n], uint32_t(names.size())).first;
+                    if (it->second == names.size())
+                    {
+                        names.push_back(chunk.names[n]);
+                        name_lines.push_back(lines_before + chunk.name_lines[n]);
+                    }
+                    remap[n] = it->second;
+                }
+                for (auto &s : chunk.spheres)
+                    s.name = remap[s.name];
+                for (auto &t : chunk.triangles)
+                    t.name = remap[t.name];
+                for (auto &s : chunk.statements)
+                    statements.push_back({lines_before + s.line, std::move(s.text)});
+
+                lines_before += chunk.lines;
+                chunk.names = std::vector<std::string>();
+                chunk.statements = std::vector<statement>();
+                chunks.push_back(std::move(chunk));
+            }
+        });
+    double parse_seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+
+    // the other statements, in file order. meshes and instances are only noted here, they need every
+    // material and mesh name first
+    scene_view view;
+    std::unordered_map<std::string, const material *> defined;
+    struct mesh_statement
+    {
+        const statement *s;
+        std::string file, material;
+    };
+    std::unordered_map<std::string, mesh_statement> mesh_statements;
+    std::vector<const statement *> instance_statements;
+
+    for (const statement &s : statements)
+    {
+        statement_reader in(path, s);
+        std::string keyword = in.word("a statement");
+        if (keyword == "camera")
+        {
+            if (in.at_end())
+                in.fail("camera needs a setting");
+            while (!in.at_end())
+            {
+                std::string key = in.word("a camera setting");
+                if (key == "lookfrom")
+                    view.lookfrom = in.vector("lookfrom x y z");
+                else if (key == "lookat")
+                    view.lookat = in.vector("lookat x y z");
+                else if (key == "vup")
+                    view.vup = in.vector("vup x y z");
+                else if (key == "vfov")
+                    view.vfov = in.number("vfov degrees");
+                else if (key == "aspect")
+                    view.aspect_ratio = in.number("aspect ratio");
+                else if (key == "defocus")
+                    view.defocus_angle = in.number("defocus angle");
+                else if (key == "focus")
+                    view.focus_dist = in.number("focus distance");
+                else if (key == "sky")
+                    view.sky_brightness = in.number("sky brightness");
+                else if (key == "width")
+                    view.image_width = int(in.number("image width"));
+                else if (key == "samples")
+                    view.samples_per_pixel = int(in.number("samples per pixel"));
+                else if (key == "depth")
+                    view.max_depth = int(in.number("maximum depth"));
+                else
+                    in.fail("unknown camera setting '" + key + "'");
+            }
+        }
+        else if (keyword == "material")
+        {
+            std::string name = in.word("a material name");
+            std::string type = in.word("a material type");
+            const material *mat;
+            if (type == "lambertian")
+            {
+                vec3 albedo = in.vector("albedo r g b");
+                mat = materials.make<lambertian>(albedo);
+            }
+            else if (type == "metal")
+            {
+                vec3 albedo = in.vector("albedo r g b");
+                mat = materials.make<metal>(albedo, in.number("fuzz"));
+            }
+            else if (type == "dielectric")
+                mat = materials.make<dielectric>(in.number("refraction index"));
+            else if (type == "light")
+                mat = materials.make<diffuse_light>(in.vector("radiance r g b"));
+            else
+                in.fail("unknown material type '" + type + "'");
+            if (!in.at_end())
+                in.fail("unexpected text after material");
+            if (!defined.emplace(name, mat).second)
+                in.fail("material '" + name + "' defined twice");
+        }
+        else if (keyword == "mesh")
+        {
+            std::string name = in.word("a mesh name");
+            mesh_statement m{&s, in.word("an OBJ file"), in.word("a material")};
+            if (!in.at_end())
+                in.fail("unexpected text after mesh");
+            if (!mesh_statements.emplace(name, m).second)
+                in.fail("mesh '" + name + "' defined twice");
+        }
+        else
+        {
+            instance_statements.push_back(&s);
+        }
+    }
+
+    // primitives' material names
+    std::vector<const material *> name_materials(names.size());
+    for (size_t n = 0; n < names.size(); n++)
+    {
+        auto it = defined.find(names[n]);
+        if (it == defined.end())
+            throw std::runtime_error(path + ":" + std::to_string(name_lines[n]) + ": undefined material '" + names[n] + "'");
+        name_materials[n] = it->second;
+    }
+
+    bvh_build_options bvh = options.bvh;
+    if (!bvh.pool)
+        bvh.pool = options.pool;
+
+    // spheres, every chunk's into its own run of world.objects
+    size_t first = world.objects.size(), sphere_count = 0;
+    std::vector<size_t> sphere_base(chunks.size());
+    for (size_t c = 0; c < chunks.size(); c++)
+    {
+        sphere_base[c] = first + sphere_count;
+        sphere_count += chunks[c].spheres.size();
+    }
+    world.objects.resize(first + sphere_count);
+    auto make_spheres = [&](size_t c, unsigned int)
+    {
+        const auto &spheres = chunks[c].spheres;
+        for (size_t i = 0; i < spheres.size(); i++)
+        {
+            const sphere_record &s = spheres[i];
+            world.objects[sphere_base[c] + i] = make_shared<sphere>(
+                point3(real(s.center[0]), real(s.center[1]), real(s.center[2])), real(s.radius), name_materials[s.name]);
+        }
+    };
+    if (options.pool)
+        options.pool->parallel_for(chunks.size(), make_spheres);
+    else
+        for (size_t c = 0; c < chunks.size(); c++)
+            make_spheres(c, 0);
+
+    // triangles, one mesh per material
+    std::vector<shared_ptr<triangle_mesh>> triangle_meshes(names.size());
+    size_t triangle_count = 0;
+    for (auto &chunk : chunks)
+    {
+        for (const triangle_record &t : chunk.triangles)
+        {
+            auto &mesh = triangle_meshes[t.name];
+            if (!mesh)
+                mesh = make_shared<triangle_mesh>(name_materials[t.name]);
+            uint32_t base = uint32_t(mesh->positions.size() / 3);
+            mesh->positions.insert(mesh->positions.end(), t.corners, t.corners + 9);
+            mesh->indices.insert(mesh->indices.end(), {base, base + 1, base + 2});
+        }
+        triangle_count += chunk.triangles.size();
+        chunk = chunk_result();
+    }
+    for (auto &mesh : triangle_meshes)
+        if (mesh)
+        {
+            mesh->build(bvh);
+            world.add(mesh);
+        }
+
+    // meshes that instances use, loaded once each
+    std::unordered_map<std::string, shared_ptr<triangle_mesh>> meshes;
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    size_t instance_count = 0;
+    for (const statement *s : instance_statements)
+    {
+        statement_reader in(path, *s);
+        in.word("instance");
+        std::string name = in.word("a mesh name");
+        auto loaded = meshes.find(name);
+        if (loaded == meshes.end())
+        {
+            auto it = mesh_statements.find(name);
+            if (it == mesh_statements.end())
+                in.fail("undefined mesh '" + name + "'");
+            const mesh_statement &m = it->second;
+            auto mat = defined.find(m.material);
+            if (mat == defined.end())
+                statement_reader(path, *m.s).fail("undefined material '" + m.material + "'");
+
+            std::filesystem::path file_path(m.file);
+            if (file_path.is_relative())
+                file_path = directory / file_path;
+            obj_load_options obj;
+            obj.pool = options.pool;
+            obj.bvh = bvh;
+            loaded = meshes.emplace(name, load_obj(file_path.string(), mat->second, obj)).first;
+        }
+
+        try
+        {
+            affine_transform to_world;
+            while (!in.at_end())
+            {
+                std::string op = in.word("a transform");
+                if (op == "translate")
+                    to_world = affine_transform::translate(in.vector("translate x y z")) * to_world;
+                else if (op == "rotate")
+                {
+                    vec3 axis = in.vector("rotation axis x y z");
+                    to_world = affine_transform::rotate(axis, in.number("rotation degrees")) * to_world;
+                }
+                else if (op == "scale")
+                {
+                    double sx = in.number("scale"), sy, sz;
+                    if (in.maybe_number(sy))
+                        sz = in.number("scale x y z");
+                    else
+                        sy = sz = sx;
+                    to_world = affine_transform::scale(sx, sy, sz) * to_world;
+                }
+                else
+                    in.fail("unknown transform '" + op + "'");
+            }
+            world.add(make_shared<instance>(loaded->second, to_world));
+        }
+        catch (const std::invalid_argument &e)
+        {
+            in.fail(e.what());
+        }
+        instance_count++;
+    }
+
+    if (stats)
+    {
+        stats->seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+        stats->parse_seconds = parse_seconds;
+        stats->file_bytes = file_bytes;
+        stats->lines = lines_before;
+        stats->materials = defined.size();
+        stats->spheres = sphere_count;
+        stats->triangles = triangle_count;
+        stats->meshes = meshes.size();
+        stats->instances = instance_count;
+    }
+    return view;
+}
+
+#endif
@@ -0,0 +1,645 @@
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+
+// binary scene snapshots: the flattened primitives, their materials and the built BVH written to one
+// file, so a later run can skip building the scene and the BVH altogether. the file is memory mapped
+// and traced straight out of the mapping (no parsing, no copies), pages come in as rays touch them.
+//
+// layout (little endian, every section 64 byte aligned):
+//   snapshot_header
+//   snapshot_material[material_count]
+//   snapshot_sphere[sphere_count]
+//   snapshot_triangle[triangle_count]
+//   linear_bvh_node[node_count]      top level BVH, depth-first like bvh_tree
+//   uint32_t[prim_count]             leaf slots: primitive kind in the top 2 bits, index below
+//
+// triangle meshes are stored as plain triangles with their geometric normal, smooth normals and uvs
+// are not kept.
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "trace_stats.h"
+#include "triangle_mesh.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t snapshot_version = 1;
+constexpr uint32_t snapshot_endian_tag = 0x01020304;
+
+struct snapshot_header
+{
+    char magic[8];         // "RTSNAP\0\0"
+    uint32_t version;      // snapshot_version
+    uint32_t endian_tag;   // snapshot_endian_tag as written by the saving machine
+    uint32_t header_bytes; // sizeof(snapshot_header)
+    uint32_t scalar_bytes; // sizeof(double), the precision the primitives are stored in
+    uint64_t file_bytes;
+
+    uint64_t material_count, sphere_count, triangle_count, node_count, prim_count;
+    uint64_t material_offset, sphere_offset, triangle_offset, node_offset, prim_offset;
+
+    double bounds_min[3], bounds_max[3];
+};
+
+enum snapshot_material_type : uint32_t
+{
+    snapshot_lambertian = 0,
+    snapshot_metal = 1,
+    snapshot_dielectric = 2,
+    snapshot_diffuse_light = 3
+};
+
+struct snapshot_material
+{
+    uint32_t type;
+    uint32_t pad;
+    double albedo[3]; // diffuse_light: the emitted radiance
+    double param;     // metal: fuzz, dielectric: refraction index
+};
+
+struct snapshot_sphere
+{
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t pad;
+};
+
+struct snapshot_triangle
+{
+    double v0[3];
+    double edge1[3], edge2[3]; // v1 - v0, v2 - v0
+    double normal[3];
+    uint32_t material;
+    uint32_t pad;
+};
+
+static_assert(sizeof(snapshot_material) == 40, "snapshot layout changed, bump snapshot_version");
+static_assert(sizeof(snapshot_sphere) == 40, "snapshot layout changed, bump snapshot_version");
+static_assert(sizeof(snapshot_triangle) == 104, "snapshot layout changed, bump snapshot_version");
+
+namespace snapshot_detail
+{
+    constexpr uint32_t kind_shift = 30;
+    constexpr uint32_t index_mask = (1u << kind_shift) - 1;
+    constexpr uint32_t kind_sphere = 0;
+    constexpr uint32_t kind_triangle = 1;
+
+    inline uint64_t align64(uint64_t x) { return (x + 63) & ~uint64_t(63); }
+
+    inline void copy3(double out[3], const vec3 &v)
+    {
+        out[0] = v.x();
+        out[1] = v.y();
+        out[2] = v.z();
+    }
+
+    // gathers the primitives of a hittable_list (nested lists and meshes included) into flat arrays
+    struct flattener
+    {
+        std::vector<snapshot_material> materials;
+        std::vector<snapshot_sphere> spheres;
+        std::vector<snapshot_triangle> triangles;
+        std::vector<aabb> bounds;
+        std::vector<uint32_t> refs;
+        std::unordered_map<const material *, uint32_t> material_ids;
+
+        uint32_t material_id(const material *mat)
+        {
+            auto found = material_ids.find(mat);
+            if (found != material_ids.end())
+                return found->second;
+
+            snapshot_material m{};
+            if (auto l = dynamic_cast<const lambertian *>(mat))
+            {
+                m.type = snapshot_lambertian;
+                copy3(m.albedo, l->get_albedo());
+            }
+            else if (auto me = dynamic_cast<const metal *>(mat))
+            {
+                m.type = snapshot_metal;
+                copy3(m.albedo, me->get_albedo());
+                m.param = me->get_fuzz();
+            }
+            else if (auto d = dynamic_cast<const dielectric *>(mat))
+            {
+                m.type = snapshot_dielectric;
+                m.param = d->get_refraction_index();
+            }
+            else if (auto e = dynamic_cast<const diffuse_light *>(mat))
+            {
+                m.type = snapshot_diffuse_light;
+                copy3(m.albedo, e->get_emit());
+            }
+            else
+            {
+                throw std::runtime_error("scene snapshot: unsupported material type");
+            }
+
+            uint32_t id = uint32_t(materials.size());
+            materials.push_back(m);
+            material_ids[mat] = id;
+            return id;
+        }
+
+        void add_triangle(const point3 &v0, const point3 &v1, const point3 &v2, uint32_t mat)
+        {
+            snapshot_triangle t{};
+            copy3(t.v0, v0);
+            copy3(t.edge1, v1 - v0);
+            copy3(t.edge2, v2 - v0);
+            copy3(t.normal, unit_vector(cross(v1 - v0, v2 - v0)));
+            t.material = mat;
+
+            refs.push_back((kind_triangle << kind_shift) | uint32_t(triangles.size()));
+            bounds.push_back(aabb::surrounding_box(aabb(v0, v1), aabb(v2, v2)));
+            triangles.push_back(t);
+        }
+
+        void add(const hittable &object)
+        {
+            if (auto s = dynamic_cast<const sphere *>(&object))
+            {
+                snapshot_sphere sp{};
+                copy3(sp.center, s->get_center());
+                sp.radius = s->get_radius();
+                sp.material = material_id(s->get_material());
+
+                refs.push_back((kind_sphere << kind_shift) | uint32_t(spheres.size()));
+                bounds.push_back(s->bounding_box());
+                spheres.push_back(sp);
+            }
+            else if (auto t = dynamic_cast<const triangle *>(&object))
+            {
+                add_triangle(t->vertex(0), t->vertex(1), t->vertex(2), material_id(t->get_material()));
+            }
+            else if (auto m = dynamic_cast<const triangle_mesh *>(&object))
+            {
+                uint32_t mat = material_id(m->mat);
+                for (size_t i = 0; i < m->triangle_count(); i++)
+                    add_triangle(m->vertex(m->indices[3 * i]), m->vertex(m->indices[3 * i + 1]),
+                                 m->vertex(m->indices[3 * i + 2]), mat);
+            }
+            else if (auto list = dynamic_cast<const hittable_list *>(&object))
+            {
+                for (const auto &child : list->objects)
+                    add(*child);
+            }
+            else
+            {
+                throw std::runtime_error("scene snapshot: unsupported hittable (only spheres, triangles, "
+                                         "triangle meshes and lists can be stored)");
+            }
+
+            if (refs.size() > index_mask)
+                throw std::runtime_error("scene snapshot: too many primitives");
+        }
+    };
+
+    // read-only view of a whole file: mmap on POSIX, a file mapping on Windows
+    class mapped_file
+    {
+    public:
+        mapped_file() = default;
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+        ~mapped_file() { close(); }
+
+        void open(const std::string &path)
+        {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                throw std::runtime_error(path + ": cannot open snapshot");
+            LARGE_INTEGER file_size;
+            GetFileSizeEx(file, &file_size);
+            bytes = size_t(file_size.QuadPart);
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping)
+                throw std::runtime_error(path + ": cannot map snapshot");
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!view)
+                throw std::runtime_error(path + ": cannot map snapshot");
+#else
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error(path + ": cannot open snapshot");
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+                throw std::runtime_error(path + ": cannot stat snapshot");
+            bytes = size_t(st.st_size);
+            if (bytes == 0)
+                throw std::runtime_error(path + ": empty snapshot");
+            view = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view == MAP_FAILED)
+            {
+                view = nullptr;
+                throw std::runtime_error(path + ": cannot mmap snapshot");
+            }
+#endif
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if (view)
+                UnmapViewOfFile(view);
+            if (mapping)
+                CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (view)
+                munmap(view, bytes);
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+#endif
+            view = nullptr;
+            bytes = 0;
+        }
+
+        const unsigned char *data() const { return static_cast<const unsigned char *>(view); }
+        size_t size() const { return bytes; }
+
+    private:
+        void *view = nullptr;
+        size_t bytes = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int fd = -1;
+#endif
+    };
+}
+
+// flatten the scene, build a BVH over it and write everything to path. returns the build's stats
+inline bvh_build_stats save_scene_snapshot(const std::string &path, const hittable_list &world,
+                                const bvh_build_options &options = {})
+{
+    using namespace snapshot_detail;
+
+    flattener flat;
+    flat.add(world);
+
+    bvh_tree tree;
+    tree.build(flat.bounds, options);
+
+    std::vector<uint32_t> refs(flat.refs.size());
+    for (size_t slot = 0; slot < refs.size(); slot++)
+        refs[slot] = flat.refs[tree.prim_indices[slot]];
+
+    snapshot_header header{};
+    std::memcpy(header.magic, "RTSNAP\0\0", 8);
+    header.version = snapshot_version;
+    header.endian_tag = snapshot_endian_tag;
+    header.header_bytes = sizeof(snapshot_header);
+    header.scalar_bytes = sizeof(double);
+
+    header.material_count = flat.materials.size();
+    header.sphere_count = flat.spheres.size();
+    header.triangle_count = flat.triangles.size();
+    header.node_count = tree.nodes.size();
+    header.prim_count = refs.size();
+
+    uint64_t offset = align64(sizeof(snapshot_header));
+    auto place = [&](uint64_t &section, uint64_t bytes)
+    {
+        section = offset;
+        offset = align64(offset + bytes);
+    };
+    place(header.material_offset, header.material_count * sizeof(snapshot_material));
+    place(header.sphere_offset, header.sphere_count * sizeof(snapshot_sphere));
+    place(header.triangle_offset, header.triangle_count * sizeof(snapshot_triangle));
+    place(header.node_offset, header.node_count * sizeof(linear_bvh_node));
+    place(header.prim_offset, header.prim_count * sizeof(uint32_t));
+    header.file_bytes = offset;
+
+    aabb box = tree.bounds();
+    for (int a = 0; a < 3; a++)
+    {
+        header.bounds_min[a] = box.axis_interval(a).min;
+        header.bounds_max[a] = box.axis_interval(a).max;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error(path + ": cannot write snapshot");
+
+    auto write_at = [&](uint64_t at, const void *data, size_t bytes)
+    {
+        static const char zeros[64] = {};
+        uint64_t pos = uint64_t(out.tellp());
+        if (pos < at)
+            out.write(zeros, std::streamsize(at - pos));
+        if (bytes)
+            out.write(static_cast<const char *>(data), std::streamsize(bytes));
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.material_offset, flat.materials.data(), flat.materials.size() * sizeof(snapshot_material));
+    write_at(header.sphere_offset, flat.spheres.data(), flat.spheres.size() * sizeof(snapshot_sphere));
+    write_at(header.triangle_offset, flat.triangles.data(), flat.triangles.size() * sizeof(snapshot_triangle));
+    write_at(header.node_offset, tree.nodes.data(), tree.nodes.size() * sizeof(linear_bvh_node));
+    write_at(header.prim_offset, refs.data(), refs.size() * sizeof(uint32_t));
+    write_at(header.file_bytes, nullptr, 0);
+
+    if (!out)
+        throw std::runtime_error(path + ": error while writing snapshot");
+    return tree.stats();
+}
+
+// a snapshot mapped back in, traced directly from the file's pages
+class scene_snapshot : public hittable
+{
+public:
+    // every node, primitive reference and material id is range checked once (a corrupt file has to
+    // fail here, not read out of bounds while tracing). verify = true also checks that node boxes nest
+    // and every primitive slot sits in exactly one leaf.
+    explicit scene_snapshot(const std::string &path, bool verify = false)
+    {
+        using namespace snapshot_detail;
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        file.open(path);
+        if (file.size() < sizeof(snapshot_header))
+            throw std::runtime_error(path + ": too small to be a snapshot");
+
+        header = reinterpret_cast<const snapshot_header *>(file.data());
+        if (std::memcmp(header->magic, "RTSNAP\0\0", 8) != 0)
+            throw std::runtime_error(path + ": not a scene snapshot");
+        if (header->endian_tag != snapshot_endian_tag)
+            throw std::runtime_error(path + ": snapshot was written on a machine with different endianness");
+        if (header->version != snapshot_version)
+            throw std::runtime_error(path + ": snapshot version " + std::to_string(header->version) +
+                                     ", this build reads version " + std::to_string(snapshot_version));
+        if (header->header_bytes != sizeof(snapshot_header) || header->scalar_bytes != sizeof(double))
+            throw std::runtime_error(path + ": snapshot header layout does not match this build");
+        if (header->file_bytes != file.size())
+            throw std::runtime_error(path + ": snapshot is truncated or has trailing data");
+
+        materials_raw = section<snapshot_material>(path, header->material_offset, header->material_count);
+        spheres = section<snapshot_sphere>(path, header->sphere_offset, header->sphere_count);
+        triangles = section<snapshot_triangle>(path, header->triangle_offset, header->triangle_count);
+        nodes = section<linear_bvh_node>(path, header->node_offset, header->node_count);
+        prims = section<uint32_t>(path, header->prim_offset, header->prim_count);
+
+        // the material table is tiny, rebuild the objects (in file order, so ids index the table)
+        for (uint64_t m = 0; m < header->material_count; m++)
+        {
+            const auto &sm = materials_raw[m];
+            color albedo(sm.albedo[0], sm.albedo[1], sm.albedo[2]);
+            if (sm.type == snapshot_lambertian)
+                materials.make<lambertian>(albedo);
+            else if (sm.type == snapshot_metal)
+                materials.make<metal>(albedo, sm.param);
+            else if (sm.type == snapshot_dielectric)
+                materials.make<dielectric>(sm.param);
+            else if (sm.type == snapshot_diffuse_light)
+                materials.make<diffuse_light>(albedo);
+            else
+                throw std::runtime_error(path + ": unknown material type in snapshot");
+        }
+
+        check_ranges(path);
+        if (verify)
+            verify_contents(path);
+
+        bbox = aabb(point3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]),
+                    point3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]));
+
+        load_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        using namespace snapshot_detail;
+        return bvh_tree::traverse_nodes(nodes, size_t(header->node_count), r, ray_t, [&](uint32_t slot, interval &t)
+                                        {
+            uint32_t ref = prims[slot];
+            uint32_t index = ref & index_mask;
+            bool hit = (ref >> kind_shift) == kind_sphere ? hit_sphere(spheres[index], r, t, rec)
+                                                          : hit_triangle(triangles[index], r, t, rec);
+            if (hit)
+                t.max = rec.t;
+            return hit; });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // the emissive spheres and triangles, for light sampling (see lights.h). spheres come before
+    // triangles here, so the list can be in another order than light_list::collect on the original
+    // world gives: the same estimate, but not the same random choices.
+    light_list lights() const
+    {
+        light_list result;
+        auto point = [](const double v[3])
+        { return point3(v[0], v[1], v[2]); };
+        for (uint64_t i = 0; i < header->sphere_count; i++)
+            if (materials_raw[spheres[i].material].type == snapshot_diffuse_light)
+                result.add_sphere(point(spheres[i].center), spheres[i].radius, materials[spheres[i].material]);
+        for (uint64_t i = 0; i < header->triangle_count; i++)
+            if (materials_raw[triangles[i].material].type == snapshot_diffuse_light)
+            {
+                const snapshot_triangle &t = triangles[i];
+                point3 v0 = point(t.v0);
+                result.add_triangle(v0, v0 + point(t.edge1), v0 + point(t.edge2), materials[t.material]);
+            }
+        return result;
+    }
+
+    double load_milliseconds() const { return load_ms; }
+    size_t primitive_count() const { return size_t(header->prim_count); }
+    size_t file_bytes() const { return file.size(); }
+
+private:
+    snapshot_detail::mapped_file file;
+    const snapshot_header *header = nullptr;
+    const snapshot_material *materials_raw = nullptr;
+    const snapshot_sphere *spheres = nullptr;
+    const snapshot_triangle *triangles = nullptr;
+    const linear_bvh_node *nodes = nullptr;
+    const uint32_t *prims = nullptr;
+
+    material_table materials;
+    aabb bbox;
+    double load_ms = 0.0;
+
+    template <typename T>
+    const T *section(const std::string &path, uint64_t offset, uint64_t count) const
+    {
+        if (offset % 64 != 0 || offset > file.size() || count > (file.size() - offset) / sizeof(T))
+            throw std::runtime_error(path + ": snapshot section out of bounds");
+        return reinterpret_cast<const T *>(file.data() + offset);
+    }
+
+    // what traversal and lights() index with: child and primitive offsets, primitive references,
+    // material ids, and a depth the traversal stack holds. O(nodes + primitives)
+    void check_ranges(const std::string &path) const
+    {
+        using namespace snapshot_detail;
+        auto bad = [&]()
+        { throw std::runtime_error(path + ": corrupt snapshot contents"); };
+
+        // children come after their parent, so one forward sweep knows every node's depth before its children
+        std::vector<uint8_t> depth(size_t(header->node_count), 1);
+        for (uint64_t i = 0; i < header->node_count; i++)
+        {
+            const auto &n = nodes[i];
+            if (n.prim_count > 0 ? uint64_t(n.offset) + n.prim_count > header->prim_count
+                                 : (i + 1 >= header->node_count || n.offset <= i + 1 ||
+                                    n.offset >= header->node_count || n.axis > 2))
+                bad();
+            if (n.prim_count == 0)
+            {
+                if (depth[i] >= bvh_tree::max_depth)
+                    bad();
+                depth[i + 1] = std::max(depth[i + 1], uint8_t(depth[i] + 1));
+                depth[n.offset] = std::max(depth[n.offset], uint8_t(depth[i] + 1));
+            }
+        }
+        for (uint64_t i = 0; i < header->prim_count; i++)
+        {
+            uint32_t kind = prims[i] >> kind_shift, index = prims[i] & index_mask;
+            if (kind == kind_sphere ? index >= header->sphere_count
+                                    : (kind != kind_triangle || index >= header->triangle_count))
+                bad();
+        }
+        for (uint64_t i = 0; i < header->sphere_count; i++)
+            if (spheres[i].material >= header->material_count)
+                bad();
+        for (uint64_t i = 0; i < header->triangle_count; i++)
+            if (triangles[i].material >= header->material_count)
+                bad();
+    }
+
+    // the tree is a proper BVH: boxes are ordered and hold their children's, each slot is in one leaf
+    void verify_contents(const std::string &path) const
+    {
+        auto bad = [&]()
+        { throw std::runtime_error(path + ": corrupt snapshot contents"); };
+        auto inside = [](const linear_bvh_node &child, const linear_bvh_node &parent)
+        {
+            for (int a = 0; a < 3; a++)
+                if (!(child.bounds_min[a] >= parent.bounds_min[a] && child.bounds_max[a] <= parent.bounds_max[a]))
+                    return false;
+            return true;
+        };
+
+        std::vector<uint8_t> covered(size_t(header->prim_count), 0);
+        for (uint64_t i = 0; i < header->node_count; i++)
+        {
+            const auto &n = nodes[i];
+            for (int a = 0; a < 3; a++)
+                if (!(n.bounds_min[a] <= n.bounds_max[a]))
+                    bad();
+            if (n.prim_count > 0)
+            {
+                for (uint32_t slot = n.offset; slot < n.offset + n.prim_count; slot++)
+                    if (covered[slot]++)
+                        bad();
+            }
+            else if (!inside(nodes[i + 1], n) || !inside(nodes[n.offset], n))
+                bad();
+        }
+        if (std::find(covered.begin(), covered.end(), 0) != covered.end())
+            bad();
+    }
+
+    // same math as sphere::hit
+    bool hit_sphere(const snapshot_sphere &s, const ray &r, const interval &ray_t, hit_record &rec) const
+    {
+        RT_STAT(primitive_tests);
+        point3 center(s.center[0], s.center[1], s.center[2]);
+        vec3 oc = center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - s.radius * s.radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+        auto root = (h - sqrtd) / a;
+        if (!ray_t.surrounds(root))
+        {
+            root = (h + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, (rec.p - center) / s.radius);
+        rec.mat = materials[s.material];
+        return true;
+    }
+
+    // same math as triangle::hit, edges and normal come precomputed from the file
+    bool hit_triangle(const snapshot_triangle &tri, const ray &r, const interval &ray_t, hit_record &rec) const
+    {
+        RT_STAT(primitive_tests);
+        const real EPSILON = scalar_traits<real>::parallel_epsilon;
+        vec3 edge1(tri.edge1[0], tri.edge1[1], tri.edge1[2]);
+        vec3 edge2(tri.edge2[0], tri.edge2[1], tri.edge2[2]);
+
+        vec3 h = cross(r.direction(), edge2);
+        real a = dot(edge1, h);
+        if (a > -EPSILON && a < EPSILON)
+            return false;
+
+        real f = 1 / a;
+        vec3 s = r.origin() - point3(tri.v0[0], tri.v0[1], tri.v0[2]);
+        real u = f * dot(s, h);
+        if (u < 0 || u > 1)
+            return false;
+
+        vec3 q = cross(s, edge1);
+        real v = f * dot(r.direction(), q);
+        if (v < 0 || u + v > 1)
+            return false;
+
+        real t = f * dot(edge2, q);
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.u = u;
+        rec.v = v;
+        rec.mat = materials[tri.material];
+        rec.set_face_normal(r, vec3(tri.normal[0], tri.normal[1], tri.normal[2]));
+        return true;
+    }
+};
+
+#endif
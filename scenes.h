@@ -0,0 +1,211 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+// scene builders shared by main.cpp and benchmark.cpp
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include "animation.h"
+#include <algorithm>
+#include <vector>
+
+inline void create_impressive_scene(hittable_list &world, material_table &materials)
+{
+    // Ground
+    auto ground_material = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+    // final render for now! we will make a lot of random spheres and render theem
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                const material *sphere_material;
+
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = materials.make<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = materials.make<metal>(albedo, fuzz); // aside from color, add fuzziness paameter to the metals
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else
+                {
+                    // glass
+                    sphere_material = materials.make<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    // three hero spheres
+    auto material1 = materials.make<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = materials.make<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = materials.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    // add in trianglse because why not
+    auto triangle_material = materials.make<metal>(color(0.8, 0.3, 0.3), 0.1);
+
+    // a few triangular "sails" or "fins"
+    world.add(make_shared<triangle>(
+        point3(2, 0, 2), point3(3, 2, 2), point3(2, 2, 3), triangle_material));
+    world.add(make_shared<triangle>(
+        point3(-2, 0, 2), point3(-3, 2, 2), point3(-2, 2, 3), triangle_material));
+}
+
+// the impressive scene in motion, one loop every 'period' seconds: the small spheres bounce, the three
+// hero spheres are lifted off the ground and circle the origin (the middle one just turns in place),
+// the ground and the fins hold still. 'world' is what create_impressive_scene made.
+inline void animate_impressive_scene(const hittable_list &world, animated_scene &scene, double period = 4.0)
+{
+    for (const auto &object : world.objects)
+    {
+        auto ball = std::dynamic_pointer_cast<sphere>(object);
+        if (!ball || ball->get_radius() > 1.5)
+        {
+            scene.add(object);
+            continue;
+        }
+
+        if (ball->get_radius() < 0.5)
+        {
+            // a few hops per loop, each sphere with its own phase and height
+            double phase = random_double(), height = random_double(0.1, 0.5);
+            int hops = 1 + int(random_double() * 3);
+            scene.add(object, transform_track([=](double time)
+                                              {
+                double h = height * std::fabs(std::sin(pi * (hops * time / period + phase)));
+                return affine_transform::translate(vec3(0, real(h), 0)); }));
+        }
+        else
+        {
+            keyframe start, end;
+            start.position = end.position = vec3(0, 1, 0);
+            end.time = period;
+            end.degrees = 360;
+            scene.add(object, transform_track({start, end}));
+        }
+    }
+}
+
+// a parallelogram (corner q, edges u and v) as two triangles, both facing along cross(u, v)
+inline void add_quad(hittable_list &world, const point3 &q, const vec3 &u, const vec3 &v, const material *mat)
+{
+    world.add(make_shared<triangle>(q, q + u, q + v, mat));
+    world.add(make_shared<triangle>(q + u + v, q + v, q + u, mat));
+}
+
+// the Cornell box (555 units on a side, camera at (278, 278, -800) looking at (278, 278, 0), vfov 40),
+// lit only by a small ceiling panel and a smaller glowing sphere on the floor, so nearly all light
+// reaches the camera through one or two diffuse bounces off small emitters: the case light sampling
+// is for. render it with the sky turned off.
+inline void create_cornell_scene(hittable_list &world, material_table &materials)
+{
+    auto red = materials.make<lambertian>(color(.65, .05, .05));
+    auto white = materials.make<lambertian>(color(.73, .73, .73));
+    auto green = materials.make<lambertian>(color(.12, .45, .15));
+    auto panel = materials.make<diffuse_light>(color(15, 15, 15));
+    auto ember = materials.make<diffuse_light>(color(40, 16, 4));
+
+    add_quad(world, point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green);
+    add_quad(world, point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red);
+    add_quad(world, point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white);
+    add_quad(world, point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white);
+    add_quad(world, point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white);
+    add_quad(world, point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), panel); // faces down
+
+    world.add(make_shared<sphere>(point3(190, 90, 190), 90, materials.make<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(370, 120, 370), 120, white));
+    world.add(make_shared<sphere>(point3(420, 40, 120), 40, materials.make<metal>(color(0.8, 0.85, 0.9), 0.05)));
+    world.add(make_shared<sphere>(point3(110, 12, 80), 12, ember));
+}
+
+// n small random spheres scattered over a square patch of ground, sized so the density stays roughly
+// constant as n grows. used to get primitive counts far beyond the demo scene for benchmarking.
+inline void create_sphere_field(hittable_list &world, material_table &materials, size_t n)
+{
+    auto ground_material = materials.make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    std::vector<const material *> palette;
+    for (int m = 0; m < 16; m++)
+        palette.push_back(materials.make<lambertian>(color::random() * color::random()));
+    palette.push_back(materials.make<metal>(color(0.7, 0.6, 0.5), 0.1));
+    palette.push_back(materials.make<dielectric>(1.5));
+
+    double half_extent = 0.5 * std::sqrt(double(n));
+    for (size_t i = 0; i < n; i++)
+    {
+        double radius = random_double(0.05, 0.25);
+        point3 center(random_double(-half_extent, half_extent), radius + random_double(0, 2),
+                      random_double(-half_extent, half_extent));
+        auto mat = palette[size_t(random_double() * palette.size())];
+        world.add(make_shared<sphere>(center, radius, mat));
+    }
+}
+
+// the scaling benchmark's scene: n primitives over a square patch at constant density (like
+// create_sphere_field, without the ground), round(n * triangle_share) of them small randomly oriented
+// triangles in one triangle_mesh built with 'options', the rest spheres. the mesh keeps 10^7 triangles
+// to a few hundred MB where separate triangle objects would need gigabytes.
+inline void create_primitive_field(hittable_list &world, material_table &materials, size_t n,
+                                   double triangle_share = 0.5, const bvh_build_options &options = {})
+{
+    std::vector<const material *> palette;
+    for (int m = 0; m < 16; m++)
+        palette.push_back(materials.make<lambertian>(color::random() * color::random()));
+
+    size_t triangles = size_t(double(n) * std::clamp(triangle_share, 0.0, 1.0) + 0.5);
+    double half_extent = 0.5 * std::sqrt(double(n));
+    auto random_point = [&]()
+    {
+        return point3(random_double(-half_extent, half_extent), random_double(0, 2), random_double(-half_extent, half_extent));
+    };
+
+    for (size_t i = triangles; i < n; i++)
+        world.add(make_shared<sphere>(random_point(), random_double(0.05, 0.25), palette[size_t(random_double() * palette.size())]));
+
+    if (triangles > 0)
+    {
+        auto mesh = make_shared<triangle_mesh>(palette[0]);
+        mesh->positions.reserve(9 * triangles);
+        mesh->indices.reserve(3 * triangles);
+        for (size_t t = 0; t < triangles; t++)
+        {
+            point3 center = random_point();
+            for (int k = 0; k < 3; k++)
+            {
+                point3 v = center + random_double(0.1, 0.35) * random_unit_vector();
+                for (int a = 0; a < 3; a++)
+                    mesh->positions.push_back(float(v[a]));
+                mesh->indices.push_back(uint32_t(3 * t + k));
+            }
+        }
+        mesh->build(options);
+        world.add(mesh);
+    }
+}
+
+#endif
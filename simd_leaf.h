@@ -0,0 +1,451 @@
+#ifndef SIMD_LEAF_H
+#define SIMD_LEAF_H
+
+// SIMD leaf kernels. the spheres and triangles of a BVH leaf are packed into SoA blocks of 4 or 8
+// (centres and squared radii; first vertex and both edges) and one quadratic or Möller-Trumbore
+// test runs on all of them at once, with SSE for 4 and AVX for 8 lanes, and gives the nearest hit.
+// the block math is float. in a double build the winner is then re-tested with the primitive's own
+// hit(), which also fills in the hit_record, so results stay those of the scalar code except for
+// rays that graze an edge closer than float resolution.
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "trace_stats.h"
+#include "triangle.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// W floats in one register (or two SSE registers for W = 8 without AVX, or a plain array without
+// SSE), with just the operations the kernels below (and the denoiser) use
+template <int W>
+struct vfloat;
+
+#if defined(__SSE2__) || defined(_M_X64)
+template <>
+struct vfloat<4>
+{
+    __m128 v;
+
+    static vfloat load(const float *p) { return {_mm_load_ps(p)}; }
+    static vfloat loadu(const float *p) { return {_mm_loadu_ps(p)}; }
+    static vfloat set1(float x) { return {_mm_set1_ps(x)}; }
+    void store(float *p) const { _mm_store_ps(p, v); }
+    void storeu(float *p) const { _mm_storeu_ps(p, v); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend vfloat operator-(vfloat a, vfloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend vfloat operator/(vfloat a, vfloat b) { return {_mm_div_ps(a.v, b.v)}; }
+    friend vfloat operator<(vfloat a, vfloat b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+    friend vfloat operator>=(vfloat a, vfloat b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+    friend vfloat operator&(vfloat a, vfloat b) { return {_mm_and_ps(a.v, b.v)}; }
+    friend vfloat sqrt(vfloat a) { return {_mm_sqrt_ps(a.v)}; }
+    friend vfloat abs(vfloat a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+    // mask ? a : b
+    friend vfloat select(vfloat mask, vfloat a, vfloat b) { return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))}; }
+    friend int movemask(vfloat mask) { return _mm_movemask_ps(mask.v); }
+};
+#endif
+
+#if defined(__AVX__)
+template <>
+struct vfloat<8>
+{
+    __m256 v;
+
+    static vfloat load(const float *p) { return {_mm256_load_ps(p)}; }
+    static vfloat loadu(const float *p) { return {_mm256_loadu_ps(p)}; }
+    static vfloat set1(float x) { return {_mm256_set1_ps(x)}; }
+    void store(float *p) const { _mm256_store_ps(p, v); }
+    void storeu(float *p) const { _mm256_storeu_ps(p, v); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    friend vfloat operator/(vfloat a, vfloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+    friend vfloat operator<(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    friend vfloat operator>=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+    friend vfloat operator&(vfloat a, vfloat b) { return {_mm256_and_ps(a.v, b.v)}; }
+    friend vfloat sqrt(vfloat a) { return {_mm256_sqrt_ps(a.v)}; }
+    friend vfloat abs(vfloat a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+    friend vfloat select(vfloat mask, vfloat a, vfloat b) { return {_mm256_blendv_ps(b.v, a.v, mask.v)}; }
+    friend int movemask(vfloat mask) { return _mm256_movemask_ps(mask.v); }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+// two SSE halves
+template <>
+struct vfloat<8>
+{
+    vfloat<4> lo, hi;
+
+    static vfloat load(const float *p) { return {vfloat<4>::load(p), vfloat<4>::load(p + 4)}; }
+    static vfloat loadu(const float *p) { return {vfloat<4>::loadu(p), vfloat<4>::loadu(p + 4)}; }
+    static vfloat set1(float x) { return {vfloat<4>::set1(x), vfloat<4>::set1(x)}; }
+    void store(float *p) const { lo.store(p), hi.store(p + 4); }
+    void storeu(float *p) const { lo.storeu(p), hi.storeu(p + 4); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return {a.lo + b.lo, a.hi + b.hi}; }
+    friend vfloat operator-(vfloat a, vfloat b) { return {a.lo - b.lo, a.hi - b.hi}; }
+    friend vfloat operator*(vfloat a, vfloat b) { return {a.lo * b.lo, a.hi * b.hi}; }
+    friend vfloat operator/(vfloat a, vfloat b) { return {a.lo / b.lo, a.hi / b.hi}; }
+    friend vfloat operator<(vfloat a, vfloat b) { return {a.lo < b.lo, a.hi < b.hi}; }
+    friend vfloat operator>=(vfloat a, vfloat b) { return {a.lo >= b.lo, a.hi >= b.hi}; }
+    friend vfloat operator&(vfloat a, vfloat b) { return {a.lo & b.lo, a.hi & b.hi}; }
+    friend vfloat sqrt(vfloat a) { return {sqrt(a.lo), sqrt(a.hi)}; }
+    friend vfloat abs(vfloat a) { return {abs(a.lo), abs(a.hi)}; }
+    friend vfloat select(vfloat mask, vfloat a, vfloat b) { return {select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi)}; }
+    friend int movemask(vfloat mask) { return movemask(mask.lo) | (movemask(mask.hi) << 4); }
+};
+#endif
+
+#if !defined(__SSE2__) && !defined(_M_X64)
+// no SSE at all: the same operations on a plain array, masks are all-ones / all-zeros bit patterns
+template <int W>
+struct vfloat
+{
+    float v[W];
+
+    static vfloat load(const float *p)
+    {
+        vfloat r;
+        for (int k = 0; k < W; k++)
+            r.v[k] = p[k];
+        return r;
+    }
+    static vfloat set1(float x)
+    {
+        vfloat r;
+        for (int k = 0; k < W; k++)
+            r.v[k] = x;
+        return r;
+    }
+    static vfloat loadu(const float *p) { return load(p); }
+    void store(float *p) const
+    {
+        for (int k = 0; k < W; k++)
+            p[k] = v[k];
+    }
+    void storeu(float *p) const { store(p); }
+
+    template <typename F>
+    static vfloat map(vfloat a, vfloat b, F &&f)
+    {
+        vfloat r;
+        for (int k = 0; k < W; k++)
+            r.v[k] = f(a.v[k], b.v[k]);
+        return r;
+    }
+    static float mask_of(bool b) { return b ? -std::numeric_limits<float>::quiet_NaN() : 0.0f; }
+    static bool is_set(float m) { return std::signbit(m) || std::isnan(m); }
+
+    friend vfloat operator+(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x + y; }); }
+    friend vfloat operator-(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x - y; }); }
+    friend vfloat operator*(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x * y; }); }
+    friend vfloat operator/(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x / y; }); }
+    friend vfloat operator<(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return mask_of(x < y); }); }
+    friend vfloat operator>=(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return mask_of(x >= y); }); }
+    friend vfloat operator&(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return mask_of(is_set(x) && is_set(y)); }); }
+    friend vfloat sqrt(vfloat a) { return map(a, a, [](float x, float) { return std::sqrt(x); }); }
+    friend vfloat abs(vfloat a) { return map(a, a, [](float x, float) { return std::fabs(x); }); }
+    friend vfloat select(vfloat mask, vfloat a, vfloat b)
+    {
+        vfloat r;
+        for (int k = 0; k < W; k++)
+            r.v[k] = is_set(mask.v[k]) ? a.v[k] : b.v[k];
+        return r;
+    }
+    friend int movemask(vfloat mask)
+    {
+        int m = 0;
+        for (int k = 0; k < W; k++)
+            m |= is_set(mask.v[k]) ? 1 << k : 0;
+        return m;
+    }
+};
+#endif
+
+// lowest t among the lanes set in 'mask', -1 when there are none
+template <int W>
+inline int nearest_lane(int mask, const float *t)
+{
+    int best = -1;
+    for (int k = 0; k < W; k++)
+        if ((mask & (1 << k)) && (best < 0 || t[k] < t[best]))
+            best = k;
+    return best;
+}
+
+template <int W>
+struct alignas(32) sphere_block
+{
+    static_assert(W == 4 || W == 8, "leaf blocks are 4 or 8 wide");
+
+    float center[3][W];
+    float radius2[W]; // squared radius, -1 for unused lanes
+    const sphere *prim[W];
+    int count = 0;
+
+    sphere_block()
+    {
+        for (int k = 0; k < W; k++)
+        {
+            center[0][k] = center[1][k] = center[2][k] = 0;
+            radius2[k] = -1;
+            prim[k] = nullptr;
+        }
+    }
+
+    void add(const sphere &s)
+    {
+        for (int a = 0; a < 3; a++)
+            center[a][count] = float(s.get_center()[a]);
+        radius2[count] = float(s.get_radius()) * float(s.get_radius());
+        prim[count++] = &s;
+    }
+
+    // the same quadratic as sphere::hit for every lane. returns the lane of the nearest hit inside
+    // (tmin, tmax) and its distance in t, or -1
+    int hit(const ray &r, float tmin, float tmax, float &t) const
+    {
+        using vf = vfloat<W>;
+        vf ox = vf::set1(float(r.origin().x())), oy = vf::set1(float(r.origin().y())), oz = vf::set1(float(r.origin().z()));
+        vf dx = vf::set1(float(r.direction().x())), dy = vf::set1(float(r.direction().y())), dz = vf::set1(float(r.direction().z()));
+
+        vf ocx = vf::load(center[0]) - ox, ocy = vf::load(center[1]) - oy, ocz = vf::load(center[2]) - oz;
+        vf a = dx * dx + dy * dy + dz * dz;
+        vf h = dx * ocx + dy * ocy + dz * ocz;
+        vf c = ocx * ocx + ocy * ocy + ocz * ocz - vf::load(radius2);
+        vf disc = h * h - a * c;
+        vf zero = vf::set1(0.0f);
+        vf valid = disc >= zero;
+
+        vf sq = sqrt(select(valid, disc, zero));
+        vf near_root = (h - sq) / a, far_root = (h + sq) / a;
+        vf lo = vf::set1(tmin), hi = vf::set1(tmax);
+        // nearest root in range, else the far one
+        vf root = select(lo < near_root, near_root, far_root);
+        valid = valid & (lo < root) & (root < hi);
+
+        int mask = movemask(valid);
+        if (!mask)
+            return -1;
+        alignas(32) float roots[W];
+        root.store(roots);
+        int lane = nearest_lane<W>(mask, roots);
+        t = roots[lane];
+        return lane;
+    }
+};
+
+template <int W>
+struct alignas(32) triangle_block
+{
+    static_assert(W == 4 || W == 8, "leaf blocks are 4 or 8 wide");
+
+    float v0[3][W];
+    float edge1[3][W]; // zero for unused lanes, which makes them parallel to every ray
+    float edge2[3][W];
+    const triangle *prim[W];
+    int count = 0;
+
+    triangle_block()
+    {
+        for (int a = 0; a < 3; a++)
+            for (int k = 0; k < W; k++)
+                v0[a][k] = edge1[a][k] = edge2[a][k] = 0;
+        for (int k = 0; k < W; k++)
+            prim[k] = nullptr;
+    }
+
+    void add(const triangle &tri)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            v0[a][count] = float(tri.vertex(0)[a]);
+            edge1[a][count] = float(tri.vertex(1)[a] - tri.vertex(0)[a]);
+            edge2[a][count] = float(tri.vertex(2)[a] - tri.vertex(0)[a]);
+        }
+        prim[count++] = &tri;
+    }
+
+    // Möller-Trumbore for every lane, same contract as sphere_block::hit
+    int hit(const ray &r, float tmin, float tmax, float &t) const
+    {
+        using vf = vfloat<W>;
+        vf dx = vf::set1(float(r.direction().x())), dy = vf::set1(float(r.direction().y())), dz = vf::set1(float(r.direction().z()));
+        vf e1x = vf::load(edge1[0]), e1y = vf::load(edge1[1]), e1z = vf::load(edge1[2]);
+        vf e2x = vf::load(edge2[0]), e2y = vf::load(edge2[1]), e2z = vf::load(edge2[2]);
+
+        // h = d x e2, a = e1 . h
+        vf hx = dy * e2z - dz * e2y, hy = dz * e2x - dx * e2z, hz = dx * e2y - dy * e2x;
+        vf a = e1x * hx + e1y * hy + e1z * hz;
+        vf valid = vf::set1(scalar_traits<float>::parallel_epsilon) < abs(a);
+
+        vf f = vf::set1(1.0f) / select(valid, a, vf::set1(1.0f));
+        vf sx = vf::set1(float(r.origin().x())) - vf::load(v0[0]);
+        vf sy = vf::set1(float(r.origin().y())) - vf::load(v0[1]);
+        vf sz = vf::set1(float(r.origin().z())) - vf::load(v0[2]);
+        vf u = f * (sx * hx + sy * hy + sz * hz);
+
+        // q = s x e1
+        vf qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+        vf v = f * (dx * qx + dy * qy + dz * qz);
+        vf root = f * (e2x * qx + e2y * qy + e2z * qz);
+
+        vf zero = vf::set1(0.0f), one = vf::set1(1.0f);
+        valid = valid & (u >= zero) & (one >= u) & (v >= zero) & (one >= u + v);
+        valid = valid & (vf::set1(tmin) < root) & (root < vf::set1(tmax));
+
+        int mask = movemask(valid);
+        if (!mask)
+            return -1;
+        alignas(32) float roots[W];
+        root.store(roots);
+        int lane = nearest_lane<W>(mask, roots);
+        t = roots[lane];
+        return lane;
+    }
+};
+
+// linear_bvh with leaves of up to W primitives whose spheres and triangles sit in SIMD blocks.
+// anything else in a leaf is still tested one by one with its own hit(). a leaf bigger than W (the
+// builder does not promise max_leaf_size) just gets several blocks of each kind.
+template <int W>
+class simd_leaf_bvh : public hittable
+{
+public:
+    simd_leaf_bvh(const hittable_list &list, bvh_build_options options = {})
+    {
+        std::vector<aabb> bounds;
+        bounds.reserve(list.objects.size());
+        for (const auto &object : list.objects)
+            bounds.push_back(object->bounding_box());
+
+        // a whole block costs about one primitive test, so let the SAH make leaves up to W wide
+        options.max_leaf_size = W;
+        options.intersection_cost = std::min(options.intersection_cost, 4.0 / W * 0.5);
+        tree.build(bounds, options);
+
+        objects.reserve(list.objects.size());
+        for (uint32_t index : tree.prim_indices)
+            objects.push_back(list.objects[index]);
+
+        // one leaf_blocks entry per leaf, found through the leaf's first slot
+        leaf_of_slot.assign(objects.size(), 0);
+        for (const auto &node : tree.nodes)
+        {
+            if (node.prim_count == 0)
+                continue;
+            leaf_blocks leaf;
+            leaf.sphere_first = uint32_t(sphere_blocks.size());
+            leaf.triangle_first = uint32_t(triangle_blocks.size());
+            leaf.others_first = uint32_t(others.size());
+            for (uint32_t slot = node.offset; slot < node.offset + node.prim_count; slot++)
+            {
+                if (auto s = dynamic_cast<const sphere *>(objects[slot].get()))
+                    open_block(sphere_blocks, leaf.sphere_first).add(*s);
+                else if (auto tri = dynamic_cast<const triangle *>(objects[slot].get()))
+                    open_block(triangle_blocks, leaf.triangle_first).add(*tri);
+                else
+                    others.push_back(slot);
+            }
+            leaf.sphere_count = uint32_t(sphere_blocks.size()) - leaf.sphere_first;
+            leaf.triangle_count = uint32_t(triangle_blocks.size()) - leaf.triangle_first;
+            leaf.others_count = uint32_t(others.size()) - leaf.others_first;
+            leaf_of_slot[node.offset] = uint32_t(leaves.size());
+            leaves.push_back(leaf);
+        }
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return bvh_tree::traverse_leaves(tree.nodes.data(), 0, r, ray_t, [&](uint32_t first, uint32_t, interval &t)
+                                         {
+            const leaf_blocks &leaf = leaves[leaf_of_slot[first]];
+            bool hit_anything = false;
+            for (uint32_t b = 0; b < leaf.sphere_count; b++)
+                hit_anything |= hit_block(sphere_blocks[leaf.sphere_first + b], r, t, rec);
+            for (uint32_t b = 0; b < leaf.triangle_count; b++)
+                hit_anything |= hit_block(triangle_blocks[leaf.triangle_first + b], r, t, rec);
+            for (uint32_t i = 0; i < leaf.others_count; i++)
+                if (objects[others[leaf.others_first + i]]->hit(r, t, rec))
+                {
+                    t.max = rec.t;
+                    hit_anything = true;
+                }
+            return hit_anything; });
+    }
+
+    aabb bounding_box() const override { return tree.bounds(); }
+
+    const bvh_build_stats &stats() const { return tree.stats(); }
+    size_t sphere_block_count() const { return sphere_blocks.size(); }
+    size_t triangle_block_count() const { return triangle_blocks.size(); }
+
+private:
+    struct leaf_blocks
+    {
+        uint32_t sphere_first = 0, sphere_count = 0; // blocks in sphere_blocks
+        uint32_t triangle_first = 0, triangle_count = 0;
+        uint32_t others_first = 0, others_count = 0;
+    };
+
+    std::vector<shared_ptr<hittable>> objects; // slot order
+    bvh_tree tree;
+    std::vector<uint32_t> leaf_of_slot;
+    std::vector<leaf_blocks> leaves;
+    std::vector<sphere_block<W>> sphere_blocks;
+    std::vector<triangle_block<W>> triangle_blocks;
+    std::vector<uint32_t> others;
+
+    // the leaf's last block of this kind if it still has a free lane, else a new one
+    template <typename Block>
+    static Block &open_block(std::vector<Block> &blocks, uint32_t leaf_first)
+    {
+        if (blocks.size() == leaf_first || blocks.back().count == W)
+            blocks.emplace_back();
+        return blocks.back();
+    }
+
+    // nearest lane of the block, confirmed by the primitive's own hit() (called directly, not through
+    // the vtable) for the hit_record. if float and the primitive's precision disagree the lanes are
+    // tested one by one.
+    template <typename Block>
+    static bool hit_block(const Block &block, const ray &r, interval &ray_t, hit_record &rec)
+    {
+        using prim_type = std::remove_pointer_t<std::remove_const_t<std::remove_reference_t<decltype(block.prim[0])>>>;
+
+        float t;
+        int lane = block.hit(r, float(ray_t.min), float(ray_t.max) * 1.00001f, t);
+        // one test per lane, the confirming hit() below counts the winner's
+        RT_STAT_ADD(primitive_tests, lane < 0 ? block.count : block.count - 1);
+        if (lane < 0)
+            return false;
+
+        if (block.prim[lane]->prim_type::hit(r, ray_t, rec))
+        {
+            ray_t.max = rec.t;
+            return true;
+        }
+
+        bool hit_anything = false;
+        for (int k = 0; k < block.count; k++)
+            if (block.prim[k]->prim_type::hit(r, ray_t, rec))
+            {
+                ray_t.max = rec.t;
+                hit_anything = true;
+            }
+        return hit_anything;
+    }
+};
+
+#endif
@@ -4,17 +4,19 @@
 #include "hittable.h"
 #include "vec3.h"
 #include "aabb.h"
+#include "trace_stats.h"
 #include <cmath>
 
 class sphere : public hittable
 {
 public:
     // finally init the sphere with a material
-    sphere(const point3 &center, double radius, shared_ptr<material> mat)
-        : center(center), radius(std::fmax(0, radius)), mat(mat) {}
+    sphere(const point3 &center, real radius, const material *mat)
+        : center(center), radius(std::fmax(real(0), radius)), mat(mat) {}
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        RT_STAT(primitive_tests);
         vec3 oc = center - r.origin();
         auto a = r.direction().length_squared();
         auto h = dot(r.direction(), oc);
@@ -53,10 +55,15 @@ public:
         return aabb(center - radius_vec, center + radius_vec);
     }
 
+    // read access for serialisation (scene snapshots)
+    const point3 &get_center() const { return center; }
+    real get_radius() const { return radius; }
+    const material *get_material() const { return mat; }
+
 private:
     point3 center;
-    double radius;
-    shared_ptr<material> mat;
+    real radius;
+    const material *mat; // owned by the scene's material_table
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef TEXT_BLOCKS_H
+#define TEXT_BLOCKS_H
+
+// the streaming part of the text loaders (obj_loader.h, scene_loader.h): the file is read in large
+// blocks, every block is cut into chunks at line breaks, the chunks are parsed in parallel on a
+// thread_pool and the results handed back in file order. no line is ever split between chunks or
+// blocks, so a parser only ever sees whole lines.
+
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// parse(begin, end, result) runs once per chunk, on any thread; stitch(results) once per block, on
+// the calling thread, with the block's chunk results in file order. returns the bytes read.
+template <typename Result, typename Parse, typename Stitch>
+size_t parse_text_blocks(std::istream &file, size_t block_bytes, size_t chunk_bytes, thread_pool *pool,
+                         Parse &&parse, Stitch &&stitch)
+{
+    size_t file_bytes = 0;
+    std::unique_ptr<char[]> block(new char[block_bytes]); // not zeroed: a small file only touches what it fills
+    size_t capacity = block_bytes;
+    std::string carry; // unfinished last line of the previous block
+
+    while (true)
+    {
+        // refill: leftover partial line first, then as much of the file as fits
+        size_t carried = carry.size();
+        if (capacity < carried + block_bytes)
+        {
+            capacity = carried + block_bytes;
+            block.reset(new char[capacity]);
+        }
+        std::memcpy(block.get(), carry.data(), carried);
+        file.read(block.get() + carried, std::streamsize(block_bytes));
+        size_t got = size_t(file.gcount());
+        file_bytes += got;
+        size_t size = carried + got;
+        bool last_block = got < block_bytes;
+        if (size == 0)
+            break;
+
+        // keep the trailing partial line for the next block (unless this is the end of the file)
+        size_t usable = size;
+        if (!last_block)
+            while (usable > 0 && block[usable - 1] != '\n')
+                usable--;
+        carry.assign(block.get() + usable, size - usable);
+        if (usable == 0)
+            continue; // one line longer than a block: carry all of it and read on until it ends
+
+        // cut at line breaks into chunks of about chunk_bytes
+        std::vector<std::pair<size_t, size_t>> ranges;
+        size_t pos = 0;
+        while (pos < usable)
+        {
+            size_t cut = std::min(usable, pos + std::max<size_t>(chunk_bytes, 1));
+            while (cut < usable && block[cut - 1] != '\n')
+                cut++;
+            ranges.push_back({pos, cut});
+            pos = cut;
+        }
+
+        std::vector<Result> results(ranges.size());
+        auto parse_chunk = [&](size_t c, unsigned int)
+        { parse(block.get() + ranges[c].first, block.get() + ranges[c].second, results[c]); };
+        if (pool)
+            pool->parallel_for(ranges.size(), parse_chunk);
+        else
+            for (size_t c = 0; c < ranges.size(); c++)
+                parse_chunk(c, 0);
+
+        stitch(results);
+
+        if (last_block)
+            break;
+    }
+    return file_bytes;
+}
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// persistent work-stealing thread pool. the workers are created once and then sleep between jobs,
+// so render() (and anything else that wants to go wide) doesn't pay for spawning threads every call.
+// every worker owns a deque: it pops its own work from the back and, when it runs dry, steals from
+// the front of somebody else's deque. a job may throw: the group still counts it as done, and the
+// first exception of a group is rethrown by wait() (and so parallel_for) once all its jobs have run.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class thread_pool
+{
+public:
+    // counts outstanding jobs, wait() returns once all jobs submitted against it have finished
+    class task_group
+    {
+    public:
+        task_group() = default;
+        task_group(const task_group &) = delete;
+        task_group &operator=(const task_group &) = delete;
+
+    private:
+        friend class thread_pool;
+        std::atomic<size_t> pending{0};
+        std::mutex done_mutex;
+        std::condition_variable done;
+        std::exception_ptr error; // first exception thrown by one of its jobs, under done_mutex
+    };
+
+    // per worker counters, only ever written by the worker itself
+    struct worker_stats
+    {
+        uint64_t jobs = 0;         // jobs run by this worker
+        uint64_t stolen = 0;       // of those, how many were stolen from another worker
+        double busy_seconds = 0.0; // time spent inside jobs
+    };
+
+    // num_threads == 0 means one worker per hardware thread
+    explicit thread_pool(unsigned int num_threads = 0)
+    {
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0)
+            num_threads = 4; // fallback
+
+        queues.resize(num_threads);
+        for (auto &q : queues)
+            q = std::make_unique<worker_queue>();
+
+        for (unsigned int i = 0; i < num_threads; i++)
+            threads.emplace_back([this, i]()
+                                 { worker_loop(i); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    unsigned int size() const { return unsigned(threads.size()); }
+
+    // process wide pool sized to the machine, created on first use
+    static std::shared_ptr<thread_pool> global()
+    {
+        static std::shared_ptr<thread_pool> pool = std::make_shared<thread_pool>();
+        return pool;
+    }
+
+    // index of the calling worker in its pool, or -1 when called from outside any pool
+    static int current_worker()
+    {
+        return tls_worker;
+    }
+
+    // queue fn against a group. called from a worker the job lands on that worker's own deque (so
+    // recursive work stays local until someone steals it), otherwise jobs are dealt round-robin.
+    void submit(task_group &group, std::function<void(unsigned int)> fn)
+    {
+        group.pending++;
+        size_t target = (tls_pool == this) ? size_t(tls_worker) : next_queue++ % queues.size();
+        push(target, job{std::move(fn), &group});
+    }
+
+    // block until every job of the group has run, then rethrow the first exception one of them threw.
+    // a worker waiting on nested work keeps executing jobs in the meantime instead of sleeping, so
+    // recursive task trees can't deadlock the pool.
+    void wait(task_group &group)
+    {
+        std::exception_ptr error;
+        if (tls_pool == this)
+        {
+            unsigned int me = unsigned(tls_worker);
+            while (group.pending.load(std::memory_order_acquire) > 0)
+            {
+                job j;
+                bool stolen = false;
+                if (pop_local(me, j) || (stolen = steal(me, j)))
+                    run(me, j, stolen);
+                else
+                    std::this_thread::yield();
+            }
+            std::lock_guard<std::mutex> lock(group.done_mutex);
+            error = std::exchange(group.error, nullptr);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(group.done_mutex);
+            group.done.wait(lock, [&]()
+                            { return group.pending.load(std::memory_order_acquire) == 0; });
+            error = std::exchange(group.error, nullptr);
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // run fn(index, worker) for every index in [0, count) and return when all are done. indices are
+    // handed out as one contiguous block per worker, in order, and idle workers steal from the far
+    // end of other blocks, which keeps neighbouring indices (tiles, rows, chunks) on the same thread.
+    void parallel_for(size_t count, const std::function<void(size_t, unsigned int)> &fn)
+    {
+        if (count == 0)
+            return;
+
+        task_group group;
+        group.pending += count;
+
+        size_t workers = queues.size();
+        for (size_t w = 0; w < workers; w++)
+        {
+            size_t begin = count * w / workers;
+            size_t end = count * (w + 1) / workers;
+            if (begin == end)
+                continue;
+
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            // owners pop from the back, so push the block reversed to have it run front to back
+            for (size_t i = end; i-- > begin;)
+                queues[w]->jobs.push_back(job{[&fn, i](unsigned int worker)
+                                              { fn(i, worker); },
+                                              &group});
+            queued_jobs += end - begin;
+        }
+        notify_workers();
+
+        wait(group);
+    }
+
+    void reset_stats()
+    {
+        for (auto &q : queues)
+            q->stats = worker_stats();
+    }
+
+    // only meaningful while the pool is idle, e.g. right after parallel_for() returned
+    std::vector<worker_stats> stats() const
+    {
+        std::vector<worker_stats> result;
+        for (auto &q : queues)
+            result.push_back(q->stats);
+        return result;
+    }
+
+    // per-thread utilisation for the work since the last reset_stats(), against the given wall time
+    void print_utilisation(std::ostream &out, double wall_seconds, const char *unit = "jobs") const
+    {
+        double total_busy = 0;
+        out << "Thread utilisation over " << wall_seconds << " s:\n";
+        for (size_t w = 0; w < queues.size(); w++)
+        {
+            const auto &s = queues[w]->stats;
+            double util = wall_seconds > 0 ? 100.0 * s.busy_seconds / wall_seconds : 0.0;
+            total_busy += s.busy_seconds;
+            out << "  thread " << std::setw(3) << w << ": "
+                << std::setw(6) << s.jobs << ' ' << unit << " (" << s.stolen << " stolen), busy "
+                << std::fixed << std::setprecision(3) << s.busy_seconds << " s = "
+                << std::setprecision(1) << util << "%\n"
+                << std::defaultfloat << std::setprecision(6);
+        }
+        if (wall_seconds > 0)
+            out << "  average utilisation " << std::fixed << std::setprecision(1)
+                << 100.0 * total_busy / (wall_seconds * queues.size()) << "%\n"
+                << std::defaultfloat << std::setprecision(6);
+    }
+
+private:
+    struct job
+    {
+        std::function<void(unsigned int)> fn;
+        task_group *group = nullptr;
+    };
+
+    // aligned so two workers' queues and counters never share a cache line
+    struct alignas(64) worker_queue
+    {
+        std::mutex mutex;
+        std::deque<job> jobs;
+        worker_stats stats;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> queued_jobs{0}; // jobs sitting in any deque
+    std::atomic<size_t> next_queue{0};  // round-robin target for submissions from outside
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static inline thread_local thread_pool *tls_pool = nullptr;
+    static inline thread_local int tls_worker = -1;
+
+    void push(size_t target, job j)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->jobs.push_back(std::move(j));
+            queued_jobs++;
+        }
+        notify_workers();
+    }
+
+    void notify_workers()
+    {
+        // taking the lock orders this against a worker that is just about to go to sleep
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_all();
+    }
+
+    bool pop_local(unsigned int me, job &j)
+    {
+        auto &q = *queues[me];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.jobs.empty())
+            return false;
+        j = std::move(q.jobs.back());
+        q.jobs.pop_back();
+        queued_jobs--;
+        return true;
+    }
+
+    bool steal(unsigned int me, job &j)
+    {
+        size_t n = queues.size();
+        for (size_t k = 1; k < n; k++)
+        {
+            auto &q = *queues[(me + k) % n];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.jobs.empty())
+                continue;
+            j = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            queued_jobs--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(unsigned int me, job &j, bool stolen)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::exception_ptr error;
+        try
+        {
+            j.fn(me);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        auto &s = queues[me]->stats;
+        s.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        s.jobs++;
+        if (stolen)
+            s.stolen++;
+
+        // the last decrement happens under the group's mutex, and waiters take that mutex before
+        // returning, so the group can't be destroyed while we are still notifying it
+        task_group *group = j.group;
+        j.fn = nullptr;
+        std::lock_guard<std::mutex> lock(group->done_mutex);
+        if (error && !group->error)
+            group->error = std::move(error);
+        if (group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            group->done.notify_all();
+    }
+
+    void worker_loop(unsigned int me)
+    {
+        tls_pool = this;
+        tls_worker = int(me);
+
+        while (true)
+        {
+            job j;
+            bool stolen = false;
+            if (pop_local(me, j) || (stolen = steal(me, j)))
+            {
+                run(me, j, stolen);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&]()
+                      { return stopping || queued_jobs.load() > 0; });
+            if (stopping && queued_jobs.load() == 0)
+                return;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef TRACE_STATS_H
+#define TRACE_STATS_H
+
+// hot path counters: rays per bounce depth, BVH nodes visited, box and primitive tests, hits per
+// material kind and why paths ended. they are compiled in only with -DRT_STATS; without it every
+// RT_STAT macro is empty and the traversal loops are exactly what they were.
+//
+// every thread counts into its own thread_local trace_counters, plain integers with no atomics or
+// shared cache lines. the render adds all threads' counters up when it is done (collect), so reading
+// them while a render runs would race, and nobody does.
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+enum class path_end
+{
+    escaped,   // missed everything, took the background
+    absorbed,  // the material did not scatter (emitters, rays absorbed by metal)
+    max_depth, // ran into max_depth
+    roulette,  // stopped by Russian roulette
+    count
+};
+
+struct trace_counters
+{
+    static constexpr int depth_slots = 64;    // rays at depth 63 and beyond share the last slot
+    static constexpr int material_kinds = 16; // material::max_kinds
+
+    uint64_t rays[depth_slots] = {};  // path segments by bounce: camera rays at 0
+    uint64_t shadow_rays = 0;         // next event estimation
+    uint64_t nodes_visited = 0;       // BVH nodes taken off the traversal stack (wide nodes count once)
+    uint64_t box_tests = 0;           // ray against bounding box, a wide node tests one per child
+    uint64_t primitive_tests = 0;     // ray against sphere or triangle, SIMD leaf lanes included
+    uint64_t hits[material_kinds] = {}; // closest hits of path segments by material::kind()
+    uint64_t ends[int(path_end::count)] = {};
+
+    void add(const trace_counters &other)
+    {
+        for (int d = 0; d < depth_slots; d++)
+            rays[d] += other.rays[d];
+        shadow_rays += other.shadow_rays;
+        nodes_visited += other.nodes_visited;
+        box_tests += other.box_tests;
+        primitive_tests += other.primitive_tests;
+        for (int k = 0; k < material_kinds; k++)
+            hits[k] += other.hits[k];
+        for (int e = 0; e < int(path_end::count); e++)
+            ends[e] += other.ends[e];
+    }
+
+    uint64_t path_rays() const
+    {
+        uint64_t total = 0;
+        for (uint64_t n : rays)
+            total += n;
+        return total;
+    }
+
+    // the traversal work a pixel's cost map entry counts
+    uint64_t cost() const { return box_tests + primitive_tests; }
+
+    void print(std::ostream &out) const
+    {
+        uint64_t traced = path_rays() + shadow_rays;
+        auto per_ray = [&](uint64_t n)
+        { return traced ? double(n) / traced : 0.0; };
+        out << "Trace statistics: " << path_rays() << " path rays, " << shadow_rays << " shadow rays\n"
+            << "  per ray: " << per_ray(nodes_visited) << " nodes visited, " << per_ray(box_tests) << " box tests, "
+            << per_ray(primitive_tests) << " primitive tests\n";
+
+        int deepest = 0;
+        for (int d = 0; d < depth_slots; d++)
+            if (rays[d])
+                deepest = d;
+        out << "  rays by depth:";
+        for (int d = 0; d <= deepest; d++)
+            out << (d % 10 == 0 && d > 0 ? "\n                " : "") << ' ' << rays[d];
+        out << '\n';
+
+        static const char *kind_names[] = {"other", "lambertian", "metal", "dielectric", "diffuse_light"};
+        out << "  hits by material:";
+        for (int k = 0; k < material_kinds; k++)
+            if (hits[k])
+            {
+                if (k < 5)
+                    out << ' ' << kind_names[k];
+                else
+                    out << " kind " << k;
+                out << ' ' << hits[k];
+            }
+        out << '\n';
+
+        static const char *end_names[] = {"escaped", "absorbed", "max depth", "roulette"};
+        uint64_t paths = 0;
+        for (uint64_t n : ends)
+            paths += n;
+        out << "  paths ended:";
+        for (int e = 0; e < int(path_end::count); e++)
+            out << ' ' << end_names[e] << ' ' << std::fixed << std::setprecision(1)
+                << (paths ? 100.0 * ends[e] / paths : 0.0) << '%' << std::defaultfloat << std::setprecision(6);
+        out << " of " << paths << std::endl;
+    }
+};
+
+namespace trace_stats_detail
+{
+    // every thread's counters, and what threads that have exited left behind. never freed: pool threads
+    // may exit during static destruction, after a function static would already be gone.
+    struct registry
+    {
+        std::mutex mutex;
+        std::vector<trace_counters *> live;
+        trace_counters retired;
+    };
+
+    inline registry &counters_registry()
+    {
+        static registry *r = new registry();
+        return *r;
+    }
+
+    struct thread_slot
+    {
+        trace_counters counters;
+
+        thread_slot()
+        {
+            registry &r = counters_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.live.push_back(&counters);
+        }
+
+        ~thread_slot()
+        {
+            registry &r = counters_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.retired.add(counters);
+            r.live.erase(std::find(r.live.begin(), r.live.end(), &counters));
+        }
+    };
+}
+
+// the calling thread's counters
+inline trace_counters &thread_counters()
+{
+    thread_local trace_stats_detail::thread_slot slot;
+    return slot.counters;
+}
+
+// all threads' counters added up. only while no thread is counting.
+inline trace_counters collect_trace_counters()
+{
+    auto &r = trace_stats_detail::counters_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    trace_counters total = r.retired;
+    for (const trace_counters *c : r.live)
+        total.add(*c);
+    return total;
+}
+
+// zero every thread's counters. only while no thread is counting.
+inline void reset_trace_counters()
+{
+    auto &r = trace_stats_detail::counters_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.retired = trace_counters();
+    for (trace_counters *c : r.live)
+        *c = trace_counters();
+}
+
+#ifdef RT_STATS
+constexpr bool trace_stats_enabled = true;
+#define RT_STAT(field) (++thread_counters().field)
+#define RT_STAT_ADD(field, n) (thread_counters().field += uint64_t(n))
+#define RT_STAT_RAY(depth) (++thread_counters().rays[std::min(int(depth), trace_counters::depth_slots - 1)])
+#define RT_STAT_HIT(kind) (++thread_counters().hits[int(kind) & (trace_counters::material_kinds - 1)])
+#define RT_STAT_END(reason) (++thread_counters().ends[int(path_end::reason)])
+#else
+constexpr bool trace_stats_enabled = false;
+#define RT_STAT(field) ((void)0)
+#define RT_STAT_ADD(field, n) ((void)0)
+#define RT_STAT_RAY(depth) ((void)0)
+#define RT_STAT_HIT(kind) ((void)0)
+#define RT_STAT_END(reason) ((void)0)
+#endif
+
+#endif
@@ -6,13 +6,14 @@
 #include "material.h"
 #include "rtweekend.h"
 #include "aabb.h"    // For bounding box
+#include "trace_stats.h"
 #include <algorithm> // For std::min, std::max
 #include <cmath>
 
 class triangle : public hittable
 {
 public:
-    triangle(const point3 &v0, const point3 &v1, const point3 &v2, shared_ptr<material> mat)
+    triangle(const point3 &v0, const point3 &v1, const point3 &v2, const material *mat)
         : v0(v0), v1(v1), v2(v2), mat(mat)
     {
         // pre-compute edges and normal for efficiency
@@ -32,33 +33,34 @@ public:
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        RT_STAT(primitive_tests);
         // Möller-Trumbore ray-triangle intersection algorithm, this is the gold standard for ray-triangle intersection
         // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
         // I have yet to fully understand it too
-        const double EPSILON = 1e-8;
+        const real EPSILON = scalar_traits<real>::parallel_epsilon;
         vec3 h = cross(r.direction(), edge2);
-        double a = dot(edge1, h);
+        real a = dot(edge1, h);
 
         // ray is parallel to triangle
         if (a > -EPSILON && a < EPSILON)
             return false;
 
-        double f = 1.0 / a;
+        real f = 1 / a;
         vec3 s = r.origin() - v0;
-        double u = f * dot(s, h);
+        real u = f * dot(s, h);
 
         // check if intersection point is outside triangle
-        if (u < 0.0 || u > 1.0)
+        if (u < 0 || u > 1)
             return false;
 
         vec3 q = cross(s, edge1);
-        double v = f * dot(r.direction(), q);
+        real v = f * dot(r.direction(), q);
 
-        if (v < 0.0 || u + v > 1.0)
+        if (v < 0 || u + v > 1)
             return false;
 
         // compute intersection distance
-        double t = f * dot(edge2, q);
+        real t = f * dot(edge2, q);
 
         if (!ray_t.surrounds(t))
             return false;
@@ -78,11 +80,15 @@ public:
     // Essential for BVH construction
     aabb bounding_box() const { return bbox; }
 
+    // read access for serialisation (scene snapshots)
+    const point3 &vertex(int i) const { return i == 0 ? v0 : (i == 1 ? v1 : v2); }
+    const material *get_material() const { return mat; }
+
 private:
     point3 v0, v1, v2;        // Triangle vertices
     vec3 edge1, edge2;        // Pre-computed edges (v1-v0, v2-v0)
     vec3 normal;              // pre-computed normal
-    shared_ptr<material> mat; // manage object lifietime using reference counting
+    const material *mat;      // owned by the scene's material_table
     aabb bbox;                // bounding box for this triangle
 };
 
@@ -0,0 +1,167 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+// indexed triangle mesh. vertices live once in shared float arrays and triangles are just three 32 bit
+// indices, instead of every triangle object carrying its own doubles, edges, normal, box and a
+// shared_ptr. the mesh is one hittable with its own BVH over its triangles; edges and normals are
+// worked out on the fly when a leaf is tested.
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "trace_stats.h"
+#include <cstdint>
+#include <vector>
+
+class triangle_mesh : public hittable
+{
+public:
+    std::vector<float> positions; // x y z per vertex
+    std::vector<float> normals;   // x y z per normal, optional
+    std::vector<float> uvs;       // u v per texture coordinate, optional
+
+    // 3 per triangle. normal_indices and uv_indices are either empty or the same length as indices,
+    // the way OBJ indexes them separately
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> normal_indices;
+    std::vector<uint32_t> uv_indices;
+
+    const material *mat = nullptr; // owned by the scene's material_table
+
+    triangle_mesh() {}
+    triangle_mesh(const material *mat) : mat(mat) {}
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    // call once the buffers are filled. builds the mesh BVH and reorders the triangles to leaf order.
+    void build(const bvh_build_options &options = {})
+    {
+        size_t n = triangle_count();
+        std::vector<aabb> bounds(n);
+        for (size_t t = 0; t < n; t++)
+        {
+            point3 p0 = vertex(indices[3 * t]), p1 = vertex(indices[3 * t + 1]), p2 = vertex(indices[3 * t + 2]);
+            bounds[t] = aabb::surrounding_box(aabb(p0, p1), aabb(p2, p2));
+        }
+
+        tree.build(bounds, options);
+
+        reorder(indices);
+        reorder(normal_indices);
+        reorder(uv_indices);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return tree.traverse(r, ray_t, [&](uint32_t tri, interval &t)
+                             {
+            if (!hit_triangle(tri, r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true; });
+    }
+
+    aabb bounding_box() const override { return tree.bounds(); }
+
+    const bvh_tree &acceleration() const { return tree; }
+
+    // everything the mesh keeps alive, vertex data, indices and BVH
+    size_t memory_bytes() const
+    {
+        return sizeof(*this) +
+               (positions.capacity() + normals.capacity() + uvs.capacity()) * sizeof(float) +
+               (indices.capacity() + normal_indices.capacity() + uv_indices.capacity()) * sizeof(uint32_t) +
+               tree.nodes.capacity() * sizeof(linear_bvh_node) + tree.prim_indices.capacity() * sizeof(uint32_t);
+    }
+
+    point3 vertex(uint32_t i) const
+    {
+        return point3(positions[3 * size_t(i)], positions[3 * size_t(i) + 1], positions[3 * size_t(i) + 2]);
+    }
+
+private:
+    bvh_tree tree;
+
+    template <typename T>
+    void reorder(std::vector<T> &per_corner)
+    {
+        if (per_corner.empty())
+            return;
+        std::vector<T> sorted(per_corner.size());
+        for (size_t slot = 0; slot < tree.prim_indices.size(); slot++)
+            for (int k = 0; k < 3; k++)
+                sorted[3 * slot + k] = per_corner[3 * size_t(tree.prim_indices[slot]) + k];
+        per_corner.swap(sorted);
+    }
+
+    // same Möller-Trumbore test as triangle::hit, with the edges computed here instead of stored
+    bool hit_triangle(uint32_t tri, const ray &r, const interval &ray_t, hit_record &rec) const
+    {
+        RT_STAT(primitive_tests);
+        const real EPSILON = scalar_traits<real>::parallel_epsilon;
+        point3 v0 = vertex(indices[3 * tri]);
+        vec3 edge1 = vertex(indices[3 * tri + 1]) - v0;
+        vec3 edge2 = vertex(indices[3 * tri + 2]) - v0;
+
+        vec3 h = cross(r.direction(), edge2);
+        real a = dot(edge1, h);
+        if (a > -EPSILON && a < EPSILON)
+            return false; // ray is parallel to triangle
+
+        real f = 1 / a;
+        vec3 s = r.origin() - v0;
+        real u = f * dot(s, h);
+        if (u < 0 || u > 1)
+            return false;
+
+        vec3 q = cross(s, edge1);
+        real v = f * dot(r.direction(), q);
+        if (v < 0 || u + v > 1)
+            return false;
+
+        real t = f * dot(edge2, q);
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+        rec.set_face_normal(r, unit_vector(cross(edge1, edge2)));
+
+        real w = 1 - u - v;
+        if (!uv_indices.empty())
+        {
+            const float *t0 = &uvs[2 * size_t(uv_indices[3 * tri])];
+            const float *t1 = &uvs[2 * size_t(uv_indices[3 * tri + 1])];
+            const float *t2 = &uvs[2 * size_t(uv_indices[3 * tri + 2])];
+            rec.u = w * t0[0] + u * t1[0] + v * t2[0];
+            rec.v = w * t0[1] + u * t1[1] + v * t2[1];
+        }
+        else
+        {
+            rec.u = u;
+            rec.v = v;
+        }
+
+        if (!normal_indices.empty())
+        {
+            // smooth shading normal, kept on the same side as the geometric one set above
+            const float *n0 = &normals[3 * size_t(normal_indices[3 * tri])];
+            const float *n1 = &normals[3 * size_t(normal_indices[3 * tri + 1])];
+            const float *n2 = &normals[3 * size_t(normal_indices[3 * tri + 2])];
+            vec3 n(w * n0[0] + u * n1[0] + v * n2[0],
+                   w * n0[1] + u * n1[1] + v * n2[1],
+                   w * n0[2] + u * n1[2] + v * n2[2]);
+            if (n.length_squared() > 0)
+            {
+                n = unit_vector(n);
+                rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+            }
+        }
+
+        return true;
+    }
+};
+
+#endif
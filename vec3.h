@@ -3,24 +3,34 @@
 
 // #include <cmath>
 // #include <iostream>
+#include "real.h"
 
-class vec3
+// 3 component vector over scalar type T. the renderer uses vec3 = vec3_t<real> (see real.h);
+// the free functions take their scalar arguments as T without deducing from them, so 0.5 * v
+// works for float vectors as well.
+template <typename T>
+class vec3_t
 {
 public:
-    double e[3];
+    using scalar = T;
+    T e[3];
 
-    vec3() : e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    vec3_t() : e{0, 0, 0} {}
+    vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    // between float and double vectors only explicitly
+    template <typename U>
+    explicit vec3_t(const vec3_t<U> &v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double &operator[](int i) { return e[i]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    vec3 &operator+=(const vec3 &v)
+    vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T &operator[](int i) { return e[i]; }
+
+    vec3_t &operator+=(const vec3_t &v)
     {
         e[0] += v.e[0];
         e[1] += v.e[1];
@@ -28,7 +38,7 @@ public:
         return *this;
     }
 
-    vec3 &operator*=(double t)
+    vec3_t &operator*=(T t)
     {
         e[0] *= t;
         e[1] *= t;
@@ -36,91 +46,112 @@ public:
         return *this;
     }
 
-    vec3 &operator/=(double t)
+    vec3_t &operator/=(T t)
     {
         return *this *= 1 / t;
     }
 
-    double length() const
+    T length() const
     {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const
+    T length_squared() const
     {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
     bool near_zero() const
     {
         // return true if the vector is close to zero in all dimensions.
-        auto s = 1e-8;
+        auto s = scalar_traits<T>::near_zero;
         return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
     // just random utiliy funcitons to gnerate arbitrary random vectors
-    static vec3 random()
+    static vec3_t random()
     {
-        return vec3(random_double(), random_double(), random_double());
+        return vec3_t(T(random_double()), T(random_double()), T(random_double()));
     }
 
-    static vec3 random(double min, double max)
+    static vec3_t random(double min, double max)
     {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        return vec3_t(T(random_double(min, max)), T(random_double(min, max)), T(random_double(min, max)));
     }
 };
 
+using vec3 = vec3_t<real>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 
 // Vector Utility Functions
 
-inline std::ostream &operator<<(std::ostream &out, const vec3 &v)
+// T in a parameter that must not take part in deducing it
+template <typename T>
+struct scalar_of
+{
+    using type = T;
+};
+template <typename T>
+using scalar_arg = typename scalar_of<T>::type;
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &out, const vec3_t<T> &v)
 {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v)
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v)
 {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v)
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v)
 {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v)
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v)
 {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v)
+template <typename T>
+inline vec3_t<T> operator*(scalar_arg<T> t, const vec3_t<T> &v)
 {
-    return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+    return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t)
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, scalar_arg<T> t)
 {
     return t * v;
 }
 
-inline vec3 operator/(const vec3 &v, double t)
+template <typename T>
+inline vec3_t<T> operator/(const vec3_t<T> &v, scalar_arg<T> t)
 {
     return (1 / t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v)
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v)
 {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v)
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v)
 {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                     u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                     u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(const vec3 &v)
+template <typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T> &v)
 {
     return v / v.length();
 }
@@ -132,10 +163,10 @@ inline vec3 random_unit_vector()
     {
         auto p = vec3::random(-1, 1);
         auto lensq = p.length_squared();
-        if (1e-160 < lensq && lensq <= 1) // the 1e-160 is pretty important becuse there is a chance i will underflow if not
+        if (scalar_traits<real>::min_length_squared < lensq && lensq <= 1) // the 1e-160 is pretty important becuse there is a chance i will underflow if not
                                           // if all three coordinates are small enough (that is, very near the center of the sphere), the norm of the vector will be zero, and thus normalizing will yield the bogus vector [±∞,±∞,±∞]
 
-            return p / sqrt(lensq);
+            return p / std::sqrt(lensq);
     }
 }
 // take the dot product of surface norml and random vector to determine if it is in the correct hemisphre
@@ -149,7 +180,8 @@ inline vec3 random_on_hemisphere(const vec3 &normal)
         return -on_unit_sphere;
 }
 //
-inline vec3 reflect(const vec3 &v, const vec3 &n)
+template <typename T>
+inline vec3_t<T> reflect(const vec3_t<T> &v, const vec3_t<T> &n)
 {
     return v - 2 * dot(v, n) * n;
 }
@@ -159,18 +191,19 @@ inline vec3 random_in_unit_disk()
 {
     while (true)
     {
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+        auto p = vec3(real(random_double(-1, 1)), real(random_double(-1, 1)), 0);
         if (p.length_squared() < 1)
             return p;
     }
 }
 // refraction is described by snell's law η⋅sinθ=η′⋅sinθ′
 // given R′⊥=ηη′(R+(−R⋅n)n), compute R'
-inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat)
+template <typename T>
+inline vec3_t<T> refract(const vec3_t<T> &uv, const vec3_t<T> &n, scalar_arg<T> etai_over_etat)
 {
-    auto cos_theta = std::fmin(dot(-uv, n), 1.0);
-    vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    vec3 r_out_parallel = -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n;
+    T cos_theta = std::fmin(dot(-uv, n), T(1));
+    vec3_t<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
+    vec3_t<T> r_out_parallel = -std::sqrt(std::fabs(T(1) - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 #endif
\ No newline at end of file
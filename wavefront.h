@@ -0,0 +1,131 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+// building blocks of the wavefront (breadth first) renderer in camera.h. instead of finishing one
+// path after another, a whole batch of paths lives in the arrays below and every bounce runs as
+// separate passes over all of them: extend (closest hit for every live path), sort (group the hits
+// by material kind), shade (scatter) and compact (drop the paths that ended). each pass is a tight
+// loop over one kind of work, so the BVH and the material code stop evicting each other, and each
+// pass is split into chunks on the thread_pool.
+
+#include "hittable.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// path state, one array per field, indexed by the path's position in the batch
+struct wavefront_paths
+{
+    std::vector<point3> origin;
+    std::vector<vec3> direction;
+    std::vector<color> throughput;
+    std::vector<color> radiance;   // light gathered so far
+    std::vector<float> pdf;        // density of the bounce that made the current ray, see camera::hit_emission
+    std::vector<xoshiro256> rng;   // every path has its own generator, so results ignore scheduling
+    std::vector<hit_record> hit;   // written by extend, read by shade
+    std::vector<uint8_t> kind;     // extend: 0 for a miss, else 1 + the material's kind()
+    std::vector<uint8_t> alive;    // cleared by shade when the path ends
+
+    void resize(size_t n)
+    {
+        origin.resize(n);
+        direction.resize(n);
+        throughput.resize(n);
+        radiance.resize(n);
+        pdf.resize(n);
+        rng.resize(n);
+        hit.resize(n);
+        kind.resize(n);
+        alive.resize(n);
+    }
+};
+
+namespace wavefront_detail
+{
+    // fixed chunking of n items, so passes that need two sweeps (count, then write) see the same chunks
+    inline size_t chunk_count(const thread_pool *pool, size_t n)
+    {
+        const size_t min_chunk = 2048;
+        if (!pool || n < 2 * min_chunk)
+            return 1;
+        return std::min(n / min_chunk, size_t(pool->size()) * 4);
+    }
+
+    // fn(chunk, begin, end) for every chunk of [0, n), on the pool when there is more than one
+    template <typename F>
+    void for_each_chunk(thread_pool *pool, size_t chunks, size_t n, F &&fn)
+    {
+        if (chunks == 1)
+        {
+            fn(size_t(0), size_t(0), n);
+            return;
+        }
+        pool->parallel_for(chunks, [&](size_t c, unsigned int)
+                           { fn(c, n * c / chunks, n * (c + 1) / chunks); });
+    }
+}
+
+// stable counting sort of the path indices in 'in' by key(path) < buckets, into 'out'
+template <typename KeyFn>
+void wavefront_sort(thread_pool *pool, const std::vector<uint32_t> &in, std::vector<uint32_t> &out, int buckets,
+                    KeyFn &&key)
+{
+    using namespace wavefront_detail;
+    size_t n = in.size();
+    out.resize(n);
+    size_t chunks = chunk_count(pool, n);
+
+    // per chunk histograms, then every (bucket, chunk) pair gets its start offset in that order
+    std::vector<size_t> offsets(chunks * buckets, 0);
+    for_each_chunk(pool, chunks, n, [&](size_t c, size_t begin, size_t end)
+                   {
+        for (size_t i = begin; i < end; i++)
+            offsets[c * buckets + key(in[i])]++; });
+
+    size_t sum = 0;
+    for (int b = 0; b < buckets; b++)
+        for (size_t c = 0; c < chunks; c++)
+        {
+            size_t count = offsets[c * buckets + b];
+            offsets[c * buckets + b] = sum;
+            sum += count;
+        }
+
+    for_each_chunk(pool, chunks, n, [&](size_t c, size_t begin, size_t end)
+                   {
+        size_t *next = &offsets[c * buckets];
+        for (size_t i = begin; i < end; i++)
+            out[next[key(in[i])]++] = in[i]; });
+}
+
+// the path indices of 'in' for which keep(path) is true, in order, into 'out'
+template <typename KeepFn>
+void wavefront_compact(thread_pool *pool, const std::vector<uint32_t> &in, std::vector<uint32_t> &out, KeepFn &&keep)
+{
+    using namespace wavefront_detail;
+    size_t n = in.size();
+    size_t chunks = chunk_count(pool, n);
+
+    std::vector<size_t> offsets(chunks + 1, 0);
+    for_each_chunk(pool, chunks, n, [&](size_t c, size_t begin, size_t end)
+                   {
+        size_t count = 0;
+        for (size_t i = begin; i < end; i++)
+            count += keep(in[i]) ? 1 : 0;
+        offsets[c + 1] = count; });
+
+    for (size_t c = 0; c < chunks; c++)
+        offsets[c + 1] += offsets[c];
+    out.resize(offsets[chunks]);
+
+    for_each_chunk(pool, chunks, n, [&](size_t c, size_t begin, size_t end)
+                   {
+        size_t next = offsets[c];
+        for (size_t i = begin; i < end; i++)
+            if (keep(in[i]))
+                out[next++] = in[i]; });
+}
+
+#endif
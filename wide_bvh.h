@@ -0,0 +1,343 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+// 4-wide and 8-wide BVHs made by collapsing the binary bvh_tree. every node keeps the boxes of all its
+// children in SoA form (all min x together, all min y together, ...) so one SSE (4 wide) or AVX (8 wide)
+// slab test checks every child at once, and the children that were hit get visited nearest first.
+// without SSE/AVX at compile time the same layout is tested with a plain loop.
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "trace_stats.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+template <int W>
+struct alignas(32) wide_bvh_node
+{
+    static_assert(W == 4 || W == 8, "wide BVH nodes are 4 or 8 wide");
+
+    float bounds[6][W]; // rows: min x, min y, min z, max x, max y, max z
+    uint32_t child[W];  // interior child: node index, leaf child: first primitive slot
+    uint16_t count[W];  // primitives in a leaf child, 0 for interior children and empty slots
+};
+
+template <int W>
+class wide_bvh_tree
+{
+public:
+    static constexpr uint32_t empty_child = std::numeric_limits<uint32_t>::max();
+
+    std::vector<wide_bvh_node<W>> nodes;
+
+    // collapse a binary tree: starting from a node's two children, keep opening the interior child
+    // with the biggest surface area until W slots are filled. leaves keep the binary tree's slots,
+    // so whatever primitive array the binary tree indexes works unchanged.
+    void build(const bvh_tree &binary)
+    {
+        nodes.clear();
+        if (binary.nodes.empty())
+            return;
+        nodes.reserve(binary.nodes.size() / 2 + 1);
+
+        const auto &root = binary.nodes[0];
+        if (root.prim_count > 0)
+        {
+            // the whole tree is one leaf, wrap it in a node with a single child
+            nodes.push_back(make_empty_node());
+            set_child(nodes[0], 0, root);
+            return;
+        }
+        collapse(binary, 0);
+    }
+
+    // same contract as bvh_tree::traverse: leaf(slot, ray_t) shrinks ray_t.max on a hit
+    template <typename LeafFn>
+    bool traverse(const ray &r, interval ray_t, LeafFn &&leaf) const
+    {
+        if (nodes.empty())
+            return false;
+
+        ray_query q(r);
+
+        struct entry
+        {
+            uint32_t child;
+            uint16_t count;
+            float tnear;
+        };
+        entry stack[stack_size];
+        int sp = 0;
+        stack[sp++] = entry{0, 0, float(ray_t.min)};
+        bool hit_anything = false;
+
+        while (sp > 0)
+        {
+            entry e = stack[--sp];
+            if (e.tnear > ray_t.max)
+                continue; // something closer was found after this entry was pushed
+
+            if (e.count > 0)
+            {
+                for (uint32_t i = 0; i < e.count; i++)
+                    if (leaf(e.child + i, ray_t))
+                        hit_anything = true;
+                continue;
+            }
+
+            const wide_bvh_node<W> &node = nodes[e.child];
+            RT_STAT(nodes_visited);
+            RT_STAT_ADD(box_tests, W);
+            alignas(32) float tnear[W];
+            int mask = intersect_children(node, q, float(ray_t.min), float(ray_t.max), tnear);
+            if (mask == 0)
+                continue;
+
+            // order the hit children by entry distance and push them far to near, so the nearest
+            // one comes off the stack first
+            int order[W];
+            int hits = 0;
+            for (int k = 0; k < W; k++)
+            {
+                if (!(mask & (1 << k)))
+                    continue;
+                int pos = hits++;
+                while (pos > 0 && tnear[order[pos - 1]] < tnear[k])
+                {
+                    order[pos] = order[pos - 1];
+                    pos--;
+                }
+                order[pos] = k;
+            }
+            for (int h = 0; h < hits; h++)
+            {
+                int k = order[h];
+                stack[sp++] = entry{node.child[k], node.count[k], tnear[k]};
+            }
+        }
+
+        return hit_anything;
+    }
+
+    size_t memory_bytes() const { return nodes.size() * sizeof(wide_bvh_node<W>); }
+
+private:
+    static constexpr int stack_size = W * bvh_tree::max_depth;
+
+    // the ray in float, with near/far rows picked by direction sign so the slab test needs no swaps
+    struct ray_query
+    {
+        float org[3];
+        float inv_dir[3];
+        int near_row[3], far_row[3];
+
+        explicit ray_query(const ray &r)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                org[a] = float(r.origin()[a]);
+                inv_dir[a] = float(1.0 / r.direction()[a]);
+                bool neg = inv_dir[a] < 0;
+                near_row[a] = neg ? 3 + a : a;
+                far_row[a] = neg ? a : 3 + a;
+            }
+        }
+    };
+
+    // float rounding of the ray can put an exit point just in front of a box it really touches,
+    // so the exit distance is pushed out by a few ulps before comparing
+    static constexpr float far_scale = 1.00001f;
+
+    static int intersect_children(const wide_bvh_node<W> &node, const ray_query &q, float tmin, float tmax,
+                                  float *tnear_out)
+    {
+#if defined(__AVX__)
+        if constexpr (W == 8)
+        {
+            __m256 tn = _mm256_set1_ps(tmin);
+            __m256 tf = _mm256_set1_ps(tmax);
+            for (int a = 0; a < 3; a++)
+            {
+                __m256 o = _mm256_set1_ps(q.org[a]);
+                __m256 inv = _mm256_set1_ps(q.inv_dir[a]);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[q.near_row[a]]), o), inv);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[q.far_row[a]]), o), inv);
+                tn = _mm256_max_ps(t0, tn); // NaN slabs (0 * inf) leave the running value alone
+                tf = _mm256_min_ps(t1, tf);
+            }
+            _mm256_store_ps(tnear_out, tn);
+            __m256 hit = _mm256_cmp_ps(tn, _mm256_mul_ps(tf, _mm256_set1_ps(far_scale)), _CMP_LE_OQ);
+            return _mm256_movemask_ps(hit);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        if constexpr (W == 4)
+        {
+            __m128 tn = _mm_set1_ps(tmin);
+            __m128 tf = _mm_set1_ps(tmax);
+            for (int a = 0; a < 3; a++)
+            {
+                __m128 o = _mm_set1_ps(q.org[a]);
+                __m128 inv = _mm_set1_ps(q.inv_dir[a]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[q.near_row[a]]), o), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[q.far_row[a]]), o), inv);
+                tn = _mm_max_ps(t0, tn);
+                tf = _mm_min_ps(t1, tf);
+            }
+            _mm_store_ps(tnear_out, tn);
+            __m128 hit = _mm_cmple_ps(tn, _mm_mul_ps(tf, _mm_set1_ps(far_scale)));
+            return _mm_movemask_ps(hit);
+        }
+#endif
+        int mask = 0;
+        for (int k = 0; k < W; k++)
+        {
+            float tn = tmin, tf = tmax;
+            for (int a = 0; a < 3; a++)
+            {
+                float t0 = (node.bounds[q.near_row[a]][k] - q.org[a]) * q.inv_dir[a];
+                float t1 = (node.bounds[q.far_row[a]][k] - q.org[a]) * q.inv_dir[a];
+                tn = t0 > tn ? t0 : tn;
+                tf = t1 < tf ? t1 : tf;
+            }
+            tnear_out[k] = tn;
+            if (tn <= tf * far_scale)
+                mask |= 1 << k;
+        }
+        return mask;
+    }
+
+    static wide_bvh_node<W> make_empty_node()
+    {
+        wide_bvh_node<W> node;
+        for (int k = 0; k < W; k++)
+        {
+            // inverted box, no ray ever gets a tnear below its tfar
+            for (int a = 0; a < 3; a++)
+            {
+                node.bounds[a][k] = std::numeric_limits<float>::infinity();
+                node.bounds[3 + a][k] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[k] = empty_child;
+            node.count[k] = 0;
+        }
+        return node;
+    }
+
+    static void set_child(wide_bvh_node<W> &node, int k, const linear_bvh_node &src)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            node.bounds[a][k] = src.bounds_min[a];
+            node.bounds[3 + a][k] = src.bounds_max[a];
+        }
+        node.child[k] = src.offset;
+        node.count[k] = src.prim_count;
+    }
+
+    uint32_t collapse(const bvh_tree &binary, uint32_t binary_index)
+    {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.push_back(make_empty_node());
+
+        const auto &bn = binary.nodes[binary_index];
+        std::vector<uint32_t> kids = {binary_index + 1, bn.offset};
+
+        while (int(kids.size()) < W)
+        {
+            int best = -1;
+            double best_area = -1;
+            for (int k = 0; k < int(kids.size()); k++)
+            {
+                const auto &kid = binary.nodes[kids[k]];
+                if (kid.prim_count > 0)
+                    continue;
+                double area = bvh_tree::surface_area(bvh_tree::node_bounds(kid));
+                if (area > best_area)
+                {
+                    best = k;
+                    best_area = area;
+                }
+            }
+            if (best < 0)
+                break; // only leaves left
+
+            uint32_t opened = kids[best];
+            kids[best] = opened + 1;
+            kids.push_back(binary.nodes[opened].offset);
+        }
+
+        for (int k = 0; k < int(kids.size()); k++)
+        {
+            const auto &kid = binary.nodes[kids[k]];
+            if (kid.prim_count > 0)
+            {
+                set_child(nodes[index], k, kid);
+            }
+            else
+            {
+                uint32_t child_index = collapse(binary, kids[k]); // may reallocate nodes
+                set_child(nodes[index], k, kid);
+                nodes[index].child[k] = child_index;
+            }
+        }
+        return index;
+    }
+};
+
+// hittable over a hittable_list, like linear_bvh but traversing the collapsed wide tree
+template <int W>
+class wide_bvh : public hittable
+{
+public:
+    wide_bvh(const hittable_list &list, const bvh_build_options &options = {})
+    {
+        std::vector<aabb> bounds;
+        bounds.reserve(list.objects.size());
+        for (const auto &object : list.objects)
+            bounds.push_back(object->bounding_box());
+
+        bvh_tree binary;
+        binary.build(bounds, options);
+        tree.build(binary);
+        bbox = binary.bounds();
+        build_stats = binary.stats();
+
+        objects.reserve(list.objects.size());
+        for (uint32_t index : binary.prim_indices)
+            objects.push_back(list.objects[index]);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval &t)
+                             {
+            if (!objects[slot]->hit(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true; });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    const bvh_build_stats &stats() const { return build_stats; }
+    const wide_bvh_tree<W> &acceleration() const { return tree; }
+
+private:
+    std::vector<shared_ptr<hittable>> objects;
+    wide_bvh_tree<W> tree;
+    aabb bbox;
+    bvh_build_stats build_stats;
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif